@@ -0,0 +1,19 @@
+/*
+ * FatFS takes its configuration from ffconf.h, which Zephyr amends with
+ * zephyr_fatfs_config.h. Zephyr has no Kconfig option for fast seek, so this
+ * header sits in front of Zephyr's on the include path of every target (see
+ * CMakeLists.txt) and enables it after Zephyr's own settings.
+ */
+
+#include_next <zephyr_fatfs_config.h>
+
+#ifndef NUCLEOI2S_FATFS_CONFIG_H_
+#define NUCLEOI2S_FATFS_CONFIG_H_
+
+#if defined(CONFIG_AUDIO_SEEK_FAST)
+// f_lseek(CREATE_LINKMAP) and the cluster map lookups, see wav_fast_seek_init
+#undef FF_USE_FASTSEEK
+#define FF_USE_FASTSEEK 1
+#endif
+
+#endif /* NUCLEOI2S_FATFS_CONFIG_H_ */
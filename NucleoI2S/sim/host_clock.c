@@ -0,0 +1,12 @@
+#include <time.h>
+
+#include "host_clock.h"
+
+uint64_t host_clock_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000U + ts.tv_nsec / 1000U;
+}
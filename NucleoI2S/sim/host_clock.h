@@ -0,0 +1,16 @@
+#ifndef HOST_CLOCK_H_
+#define HOST_CLOCK_H_
+
+#include <stdint.h>
+
+/*
+ * Host monotonic clock for native_sim.
+ *
+ * Code takes no simulated time, so stage timings on the simulator are taken
+ * from the host instead. Built into the native simulator runner, which links
+ * against the host C library.
+ */
+
+uint64_t host_clock_us(void);
+
+#endif /* HOST_CLOCK_H_ */
@@ -0,0 +1,290 @@
+#define DT_DRV_COMPAT zephyr_i2s_sink_sim
+
+#include <errno.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/i2s.h>
+#include <zephyr/logging/log.h>
+
+#include "i2s_sink_sim.h"
+
+/* ----- module registers ----- */
+LOG_MODULE_REGISTER(i2s_sink_sim, LOG_LEVEL_INF);
+
+/* ----- definitions ----- */
+#define QUEUE_DEPTH CONFIG_I2S_SINK_SIM_TX_BLOCK_COUNT
+
+/* ----- private static variables and types ----- */
+struct sink_item {
+	void *block;
+	size_t size;
+};
+
+struct sink_data {
+	struct i2s_config cfg;
+	enum i2s_state state;
+	struct k_msgq queue;
+	char queue_buf[QUEUE_DEPTH * sizeof(struct sink_item)];
+	struct k_timer timer;
+	struct k_spinlock lock;
+	struct sink_item cur; // block on the wire, NULL block when idle
+	uint64_t start_us;    // simulated time the stream started
+	uint64_t frames;      // frames sent by the end of cur
+	bool stop_after_cur;  // STOP: finish cur and keep the queue
+	bool drain;           // DRAIN: finish the queue
+	struct i2s_sink_sim_stats stats;
+};
+
+/* ----- private function declarations ----- */
+static bool sink_next(struct sink_data *data);
+static void sink_flush(struct sink_data *data);
+static void sink_tick(struct k_timer *timer);
+
+/* ----- function definitions ----- */
+
+// Take the next queued block and schedule its end, on the absolute frame clock so
+// rounding of one block does not shift the ones after it
+static bool sink_next(struct sink_data *data)
+{
+	size_t frame_bytes = (data->cfg.word_size / 8U) * data->cfg.channels;
+
+	if (k_msgq_get(&data->queue, &data->cur, K_NO_WAIT) < 0) {
+		data->cur.block = NULL;
+		return false;
+	}
+
+	data->frames += data->cur.size / frame_bytes;
+	k_timer_start(&data->timer,
+		      K_TIMEOUT_ABS_US(data->start_us +
+				       data->frames * USEC_PER_SEC / data->cfg.frame_clk_freq),
+		      K_NO_WAIT);
+
+	return true;
+}
+
+static void sink_flush(struct sink_data *data)
+{
+	struct sink_item item;
+
+	k_timer_stop(&data->timer);
+	if (data->cur.block != NULL) {
+		k_mem_slab_free(data->cfg.mem_slab, data->cur.block);
+		data->cur.block = NULL;
+	}
+	while (k_msgq_get(&data->queue, &item, K_NO_WAIT) == 0) {
+		k_mem_slab_free(data->cfg.mem_slab, item.block);
+	}
+}
+
+static void sink_tick(struct k_timer *timer)
+{
+	struct sink_data *data = CONTAINER_OF(timer, struct sink_data, timer);
+	k_spinlock_key_t key = k_spin_lock(&data->lock);
+
+	if (data->cur.block == NULL) {
+		// Dropped while the timer was firing
+		k_spin_unlock(&data->lock, key);
+		return;
+	}
+
+	k_mem_slab_free(data->cfg.mem_slab, data->cur.block);
+	data->cur.block = NULL;
+	data->stats.blocks++;
+	data->stats.bytes += data->cur.size;
+
+	if (data->stop_after_cur) {
+		data->state = I2S_STATE_READY;
+	} else if (data->drain) {
+		if (!sink_next(data)) {
+			data->state = I2S_STATE_READY;
+		}
+	} else {
+		data->stats.min_queued =
+			MIN(data->stats.min_queued, k_msgq_num_used_get(&data->queue));
+		if (!sink_next(data)) {
+			data->stats.underruns++;
+			data->state = I2S_STATE_ERROR;
+		}
+	}
+
+	k_spin_unlock(&data->lock, key);
+}
+
+static int sink_configure(const struct device *dev, enum i2s_dir dir,
+			  const struct i2s_config *cfg)
+{
+	struct sink_data *data = dev->data;
+
+	if (dir != I2S_DIR_TX) {
+		return -ENOSYS;
+	}
+
+	if (data->state != I2S_STATE_NOT_READY && data->state != I2S_STATE_READY) {
+		return -EINVAL;
+	}
+
+	if (cfg->frame_clk_freq == 0U) {
+		data->state = I2S_STATE_NOT_READY;
+		return 0;
+	}
+
+	if (cfg->mem_slab == NULL || cfg->block_size == 0U || cfg->channels == 0U ||
+	    cfg->word_size % 8U != 0U) {
+		return -EINVAL;
+	}
+
+	data->cfg = *cfg;
+	data->state = I2S_STATE_READY;
+
+	return 0;
+}
+
+static const struct i2s_config *sink_config_get(const struct device *dev, enum i2s_dir dir)
+{
+	struct sink_data *data = dev->data;
+
+	if (dir != I2S_DIR_TX || data->state == I2S_STATE_NOT_READY) {
+		return NULL;
+	}
+
+	return &data->cfg;
+}
+
+static int sink_read(const struct device *dev, void **mem_block, size_t *size)
+{
+	return -ENOSYS;
+}
+
+static int sink_write(const struct device *dev, void *mem_block, size_t size)
+{
+	struct sink_data *data = dev->data;
+	struct sink_item item = {
+		.block = mem_block,
+		.size = size,
+	};
+	int ret;
+
+	if (data->state != I2S_STATE_READY && data->state != I2S_STATE_RUNNING) {
+		return -EIO;
+	}
+
+	if (size > data->cfg.block_size) {
+		return -EINVAL;
+	}
+
+	ret = k_msgq_put(&data->queue, &item, SYS_TIMEOUT_MS(data->cfg.timeout));
+	if (ret == -ENOMSG) {
+		return -EIO;
+	}
+
+	return ret;
+}
+
+static int sink_trigger(const struct device *dev, enum i2s_dir dir, enum i2s_trigger_cmd cmd)
+{
+	struct sink_data *data = dev->data;
+	k_spinlock_key_t key;
+	int ret = 0;
+
+	if (dir != I2S_DIR_TX) {
+		return -ENOSYS;
+	}
+
+	key = k_spin_lock(&data->lock);
+
+	switch (cmd) {
+	case I2S_TRIGGER_START:
+		if (data->state != I2S_STATE_READY || k_msgq_num_used_get(&data->queue) == 0U) {
+			ret = -EIO;
+			break;
+		}
+		data->start_us = k_ticks_to_us_floor64(k_uptime_ticks());
+		data->frames = 0;
+		data->stop_after_cur = false;
+		data->drain = false;
+		sink_next(data);
+		data->state = I2S_STATE_RUNNING;
+		break;
+	case I2S_TRIGGER_STOP:
+	case I2S_TRIGGER_DRAIN:
+		if (data->state != I2S_STATE_RUNNING) {
+			ret = -EIO;
+			break;
+		}
+		data->stop_after_cur = (cmd == I2S_TRIGGER_STOP);
+		data->drain = (cmd == I2S_TRIGGER_DRAIN);
+		data->state = I2S_STATE_STOPPING;
+		break;
+	case I2S_TRIGGER_DROP:
+		if (data->state == I2S_STATE_NOT_READY) {
+			ret = -EIO;
+			break;
+		}
+		sink_flush(data);
+		data->state = I2S_STATE_READY;
+		break;
+	case I2S_TRIGGER_PREPARE:
+		if (data->state != I2S_STATE_ERROR) {
+			ret = -EIO;
+			break;
+		}
+		sink_flush(data);
+		data->state = I2S_STATE_READY;
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+	k_spin_unlock(&data->lock, key);
+
+	return ret;
+}
+
+void i2s_sink_sim_stats_get(const struct device *dev, struct i2s_sink_sim_stats *stats)
+{
+	struct sink_data *data = dev->data;
+	k_spinlock_key_t key = k_spin_lock(&data->lock);
+
+	*stats = data->stats;
+	k_spin_unlock(&data->lock, key);
+}
+
+void i2s_sink_sim_stats_reset(const struct device *dev)
+{
+	struct sink_data *data = dev->data;
+	k_spinlock_key_t key = k_spin_lock(&data->lock);
+
+	memset(&data->stats, 0, sizeof(data->stats));
+	data->stats.min_queued = UINT32_MAX;
+	k_spin_unlock(&data->lock, key);
+}
+
+static int sink_init(const struct device *dev)
+{
+	struct sink_data *data = dev->data;
+
+	k_msgq_init(&data->queue, data->queue_buf, sizeof(struct sink_item), QUEUE_DEPTH);
+	k_timer_init(&data->timer, sink_tick, NULL);
+	data->state = I2S_STATE_NOT_READY;
+	data->stats.min_queued = UINT32_MAX;
+
+	return 0;
+}
+
+static const struct i2s_driver_api sink_api = {
+	.configure = sink_configure,
+	.config_get = sink_config_get,
+	.read = sink_read,
+	.write = sink_write,
+	.trigger = sink_trigger,
+};
+
+#define SINK_SIM_DEFINE(n)                                                                         \
+	static struct sink_data sink_data_##n;                                                     \
+	DEVICE_DT_INST_DEFINE(n, sink_init, NULL, &sink_data_##n, NULL, POST_KERNEL,               \
+			      CONFIG_I2S_INIT_PRIORITY, &sink_api);
+
+DT_INST_FOREACH_STATUS_OKAY(SINK_SIM_DEFINE)
@@ -0,0 +1,26 @@
+#ifndef I2S_SINK_SIM_H_
+#define I2S_SINK_SIM_H_
+
+#include <stdint.h>
+
+#include <zephyr/device.h>
+
+/*
+ * Emulated I2S transmitter for native_sim.
+ *
+ * Queued blocks are consumed at the cadence of the configured frame clock, in
+ * simulated time, and returned to the stream's slab. A deadline with no block
+ * queued stops the stream with an underrun, like the STM32 driver does.
+ */
+
+struct i2s_sink_sim_stats {
+	uint32_t blocks;     // blocks played out
+	uint64_t bytes;      // bytes played out
+	uint32_t underruns;  // deadlines that found the queue empty
+	uint32_t min_queued; // fewest blocks waiting at a deadline, UINT32_MAX before the first
+};
+
+void i2s_sink_sim_stats_get(const struct device *dev, struct i2s_sink_sim_stats *stats);
+void i2s_sink_sim_stats_reset(const struct device *dev);
+
+#endif /* I2S_SINK_SIM_H_ */
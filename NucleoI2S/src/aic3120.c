@@ -0,0 +1,321 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/i2c.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+
+#include "aic3120.h"
+
+/* ----- module registers ----- */
+LOG_MODULE_REGISTER(aic3120, LOG_LEVEL_INF);
+
+/* ----- definitions ----- */
+#define AIC3120_I2C_ADDR 0x18
+
+#define REG_PAGE_SELECT 0
+#define REG_SW_RESET    1 // page 0
+#define REG_DAC_MUTE    64
+#define REG_DAC_VOLUME  65
+
+#define DAC_MUTE_LEFT BIT(3)
+
+// Table entry that waits instead of writing, the value is the delay in ms
+#define REG_DELAY 0xff
+
+// The reset needs 1 ms before the codec accepts register writes again
+#define RESET_DELAY_MS 1
+
+// Longest auto-increment burst sent in one transfer
+#define BURST_MAX 16
+
+#define PAGE_SIZE 128
+
+/* ----- private static variables and types ----- */
+struct aic3120_reg {
+	uint8_t reg;
+	uint8_t val;
+};
+
+/*
+ * Register writes in the order the datasheet bring-up requires. Runs of
+ * consecutive registers are sent as one burst, nothing is reordered.
+ */
+static const struct aic3120_reg init_table[] = {
+	// 1. Define starting point
+	{REG_PAGE_SELECT, 0x00}, // Set register page to 0
+	{REG_SW_RESET, 0x01},    // Initiate SW reset
+	{REG_DELAY, RESET_DELAY_MS},
+
+	// 2. Program clock settings
+	{4, 0x03},  // PLL_clkin = MCLK
+	{6, 0x08},  // J = 8
+	{7, 0x00},  // D = 0000
+	{8, 0x00},  // D(7:0) = 0
+	{5, 0x91},  // Power up PLL, P=1, R=1
+	{11, 0x88}, // Program and power up NDAC
+	{12, 0x82}, // Program and power up MDAC
+	{13, 0x00}, // DOSR = 128
+	{14, 0x80}, // DOSR(7:0) = 128
+	{27, 0x00}, // Program I2S word length and master mode
+	{60, 0x10}, // Select DAC DSP Processing Block PRB_P16
+	{REG_PAGE_SELECT, 0x08},
+	{1, 0x04},
+	{REG_PAGE_SELECT, 0x80},
+
+	// 3. Program analog blocks
+	{REG_PAGE_SELECT, 0x01}, // Set register page to 1
+	{31, 0x04},              // Program common-mode voltage
+	{33, 0x4e},              // Program headphone-specific depop settings
+	{35, 0x40},              // Route DAC output to HPOUT
+	{40, 0x06},              // Unmute HPOUT, set gain = 0 dB
+	{42, 0x1c},              // Unmute Class-D, set gain = 18 dB
+	{31, 0x82},              // HPOUT powered up
+	{32, 0xc6},              // Power-up Class-D drivers
+	{36, 0x92},              // Set HPOUT output analog volume
+	{38, 0x92},              // Set Class-D output analog volume
+
+	// 5. Power up DAC
+	{REG_PAGE_SELECT, 0x00}, // Power up DAC
+	{63, 0x94},              // Power up DAC channels and set digital gain
+	{REG_DAC_VOLUME, 0xd4},  // DAC gain = -22 dB
+	{REG_DAC_MUTE, 0x04},    // Unmute DAC
+};
+
+// Pages with a shadow, writes to other pages always go to the bus
+static const uint8_t shadow_pages[] = {0, 1, 8};
+
+static uint8_t shadow[ARRAY_SIZE(shadow_pages)][PAGE_SIZE];
+static uint32_t shadow_valid[ARRAY_SIZE(shadow_pages)][PAGE_SIZE / 32];
+static uint8_t page_cur;
+static bool page_known;
+
+// NULL on boards without the codec bus, every call then fails with -ENODEV
+static const struct device *const i2c_dev = DEVICE_DT_GET_OR_NULL(DT_NODELABEL(i2c1));
+static K_MUTEX_DEFINE(aic3120_lock);
+
+// Bus statistics of the transfers issued so far
+static struct {
+	uint32_t transfers;
+	uint32_t bytes;
+	uint32_t cycles;
+} bus_stats;
+
+/* ----- private function declarations ----- */
+static int aic3120_burst(uint8_t reg, const uint8_t *vals, size_t len);
+static void aic3120_shadow_update(uint8_t reg, const uint8_t *vals, size_t len);
+static int shadow_index(uint8_t page);
+
+/* ----- function definitions ----- */
+static int shadow_index(uint8_t page)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(shadow_pages); i++) {
+		if (shadow_pages[i] == page) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static void aic3120_shadow_update(uint8_t reg, const uint8_t *vals, size_t len)
+{
+	for (size_t i = 0; i < len; i++, reg++) {
+		if (reg == REG_PAGE_SELECT) {
+			page_cur = vals[i];
+			page_known = true;
+			continue;
+		}
+
+		if (page_cur == 0 && reg == REG_SW_RESET && (vals[i] & 0x01)) {
+			// Everything is back at its reset value, which the shadow does not know
+			memset(shadow_valid, 0, sizeof(shadow_valid));
+			page_cur = 0;
+			continue;
+		}
+
+		int idx = shadow_index(page_cur);
+
+		if (idx >= 0 && reg < PAGE_SIZE) {
+			shadow[idx][reg] = vals[i];
+			shadow_valid[idx][reg / 32] |= BIT(reg % 32);
+		}
+	}
+}
+
+// Write len registers starting at reg with the codec's address auto-increment
+static int aic3120_burst(uint8_t reg, const uint8_t *vals, size_t len)
+{
+	uint8_t buf[1 + BURST_MAX];
+	struct i2c_msg msg = {
+		.buf = buf,
+		.len = 1 + len,
+		.flags = I2C_MSG_WRITE | I2C_MSG_STOP,
+	};
+	uint32_t start;
+	int ret;
+
+	if (i2c_dev == NULL) {
+		return -ENODEV;
+	}
+
+	buf[0] = reg;
+	memcpy(&buf[1], vals, len);
+
+	start = k_cycle_get_32();
+	ret = i2c_transfer(i2c_dev, &msg, 1, AIC3120_I2C_ADDR);
+	bus_stats.cycles += k_cycle_get_32() - start;
+	bus_stats.transfers++;
+	bus_stats.bytes += msg.len;
+
+	if (ret < 0) {
+		LOG_ERR("Failed to write %zu register(s) from 0x%02x on page %u: %d", len, reg,
+			page_cur, ret);
+		return ret;
+	}
+
+	aic3120_shadow_update(reg, vals, len);
+
+	return 0;
+}
+
+int aic3120_init(void)
+{
+	uint8_t vals[BURST_MAX];
+	size_t writes = 0;
+	size_t i = 0;
+	int ret = 0;
+
+	if (i2c_dev == NULL) {
+		LOG_INF("No codec on this board");
+		return -ENODEV;
+	}
+
+	if (!device_is_ready(i2c_dev)) {
+		LOG_ERR("I2C bus not ready");
+		return -ENODEV;
+	}
+
+	k_mutex_lock(&aic3120_lock, K_FOREVER);
+	memset(&bus_stats, 0, sizeof(bus_stats));
+	page_known = false;
+
+	while (i < ARRAY_SIZE(init_table) && ret == 0) {
+		const struct aic3120_reg *first = &init_table[i];
+		size_t len = 0;
+
+		if (first->reg == REG_DELAY) {
+			k_msleep(first->val);
+			i++;
+			continue;
+		}
+
+		// Page selects and the reset change how later bytes are decoded, so they
+		// never start or join a burst
+		do {
+			vals[len++] = init_table[i++].val;
+		} while (first->reg != REG_PAGE_SELECT && first->reg != REG_SW_RESET &&
+			 len < BURST_MAX && i < ARRAY_SIZE(init_table) &&
+			 init_table[i].reg == first->reg + len);
+
+		ret = aic3120_burst(first->reg, vals, len);
+		writes += len;
+	}
+
+	k_mutex_unlock(&aic3120_lock);
+
+	LOG_INF("Codec %s: %zu registers in %u transfers, %u bytes, %u us on the bus",
+		ret == 0 ? "configured" : "init failed", writes, bus_stats.transfers,
+		bus_stats.bytes, k_cyc_to_us_floor32(bus_stats.cycles));
+
+	return ret;
+}
+
+int aic3120_write(uint8_t page, uint8_t reg, uint8_t val)
+{
+	int idx = shadow_index(page);
+	int ret = 0;
+
+	if (reg == REG_PAGE_SELECT || reg >= PAGE_SIZE) {
+		return -EINVAL;
+	}
+
+	k_mutex_lock(&aic3120_lock, K_FOREVER);
+
+	if (idx >= 0 && (shadow_valid[idx][reg / 32] & BIT(reg % 32)) && shadow[idx][reg] == val) {
+		goto out;
+	}
+
+	if (!page_known || page_cur != page) {
+		ret = aic3120_burst(REG_PAGE_SELECT, &page, 1);
+		if (ret < 0) {
+			goto out;
+		}
+	}
+
+	ret = aic3120_burst(reg, &val, 1);
+
+out:
+	k_mutex_unlock(&aic3120_lock);
+
+	return ret;
+}
+
+int aic3120_set_volume(int8_t half_db)
+{
+	if (half_db < -127 || half_db > 48) {
+		return -EINVAL;
+	}
+
+	return aic3120_write(0, REG_DAC_VOLUME, (uint8_t)half_db);
+}
+
+int aic3120_set_mute(bool mute)
+{
+	int idx = shadow_index(0);
+	uint8_t val = shadow[idx][REG_DAC_MUTE];
+
+	val = mute ? (val | DAC_MUTE_LEFT) : (val & ~DAC_MUTE_LEFT);
+
+	return aic3120_write(0, REG_DAC_MUTE, val);
+}
+
+static int cmd_codec(const struct shell *shell, size_t argc, char **argv)
+{
+	shell_print(shell, "%u transfers, %u bytes, %u us on the bus since init",
+		    bus_stats.transfers, bus_stats.bytes, k_cyc_to_us_floor32(bus_stats.cycles));
+
+	return 0;
+}
+
+static int cmd_codec_volume(const struct shell *shell, size_t argc, char **argv)
+{
+	// Accept whole dB with an optional .5
+	long half_db = strtol(argv[1], NULL, 10) * 2;
+
+	if (strstr(argv[1], ".5") != NULL) {
+		half_db += argv[1][0] == '-' ? -1 : 1;
+	}
+
+	if (half_db < -127 || half_db > 48) {
+		shell_error(shell, "Volume must be -63.5 to 24 dB");
+		return -EINVAL;
+	}
+
+	return aic3120_set_volume(half_db);
+}
+
+static int cmd_codec_mute(const struct shell *shell, size_t argc, char **argv)
+{
+	return aic3120_set_mute(strcmp(argv[1], "on") == 0);
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	codec_cmds, SHELL_CMD_ARG(volume, NULL, "DAC volume in dB", cmd_codec_volume, 2, 0),
+	SHELL_CMD_ARG(mute, NULL, "on|off", cmd_codec_mute, 2, 0), SHELL_SUBCMD_SET_END);
+
+SHELL_SUBCMD_ADD((audio), codec, &codec_cmds, "Show codec bus usage, set volume or mute",
+		 cmd_codec, 1, 0);
@@ -0,0 +1,24 @@
+#ifndef AIC3120_H_
+#define AIC3120_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * TLV320AIC3120 codec control over I2C.
+ *
+ * Register writes go through a per-page shadow, so repeated volume and mute
+ * changes only put the bytes that actually changed on the bus.
+ */
+
+// Reset the codec and program clocks, DAC and output stage for 16-bit I2S playback
+int aic3120_init(void);
+
+// Write one register, skipped when the shadow already holds val
+int aic3120_write(uint8_t page, uint8_t reg, uint8_t val);
+
+// DAC digital volume in 0.5 dB steps, -127 (-63.5 dB) to 48 (+24 dB)
+int aic3120_set_volume(int8_t half_db);
+int aic3120_set_mute(bool mute);
+
+#endif /* AIC3120_H_ */
@@ -0,0 +1,542 @@
+#include <errno.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#ifdef CONFIG_SHELL_BACKEND_SERIAL
+#include <zephyr/shell/shell_uart.h>
+#endif
+
+#include "audio_bench.h"
+#include "audio_convert.h"
+#include "audio_dsp.h"
+#include "audio_latency.h"
+#include "audio_mixer.h"
+#include "audio_resample.h"
+#include "audio_stats.h"
+#include "audio_stream.h"
+#include "playlist.h"
+#include "tone_gen.h"
+#include "wav_reader.h"
+
+#ifdef CONFIG_I2S_SINK_SIM
+#include "i2s_sink_sim.h"
+#endif
+#ifdef CONFIG_ARCH_POSIX
+#include "posix_board_if.h"
+#endif
+
+/* ----- module registers ----- */
+LOG_MODULE_REGISTER(audio_bench, LOG_LEVEL_INF);
+
+/* ----- definitions ----- */
+#define BENCH_MAX_FILES 16
+
+// Kernels are timed on blocks of the default 25 ms period at the output rate
+#define KERNEL_RATE     44100
+#define KERNEL_BLOCK_US 25000
+#define KERNEL_FRAMES   (KERNEL_RATE * KERNEL_BLOCK_US / USEC_PER_SEC)
+#define KERNEL_RUNS     32
+
+// Source rate of the resampler kernel, the common conversion of 48 kHz files
+#define KERNEL_RESAMPLE_RATE 48000
+
+#define CYCLES_PER_US (sys_clock_hw_cycles_per_sec() / USEC_PER_SEC)
+
+/* ----- private static variables and types ----- */
+struct bench_result {
+	uint32_t blocks;
+	uint64_t audio_us; // played duration, to within one block
+	uint64_t busy_us;  // time spent refilling blocks
+	uint32_t reads;    // fs_read calls, each one or more card commands
+	uint32_t refill_max_us;
+	uint32_t late;
+	uint32_t underruns;
+	uint32_t errors;
+};
+
+static char bench_files[BENCH_MAX_FILES][PLAYLIST_NAME_MAX];
+static size_t bench_count;
+
+struct bench_kernel {
+	const char *name;
+	void (*prepare)(void); // untimed, restores the input of an in-place kernel
+	void (*run)(void);
+	uint16_t budget; // share of the block period in hundredths of a percent
+};
+
+// Noise every kernel starts from, also the staged file data of the read kernel
+static int16_t kernel_input[KERNEL_FRAMES * AUDIO_OUT_CHANNELS];
+static int16_t kernel_block[KERNEL_FRAMES * AUDIO_OUT_CHANNELS];
+
+static struct audio_convert kernel_cv;
+static size_t kernel_convert_frames;
+static struct audio_resample kernel_rs;
+static size_t kernel_resample_frames;
+static WavFile kernel_wav;
+static int kernel_mix_ids[CONFIG_AUDIO_MIXER_STREAMS];
+
+// EQ and limiter settings of the user, put back after the filter kernel
+static struct audio_dsp_band kernel_bands[AUDIO_DSP_BANDS];
+static bool kernel_limiter;
+static int16_t kernel_threshold;
+static uint32_t kernel_release_ms;
+
+#ifdef CONFIG_I2S_SINK_SIM
+static const struct device *const sink_dev = DEVICE_DT_GET_ONE(zephyr_i2s_sink_sim);
+#endif
+
+/* ----- private function declarations ----- */
+static void bench_collect(const char *name, void *ctx);
+static int bench_file(const struct shell *shell, const char *name, struct bench_result *res);
+static uint32_t bench_rt(const struct bench_result *res);
+static void bench_print(const struct shell *shell, const char *name,
+			const struct bench_result *res);
+static void kernel_copy_input(void);
+static void kernel_tone(void);
+static void kernel_convert(void);
+static void kernel_resample(void);
+static size_t kernel_mix_fill(void *ctx, int16_t *buf, size_t frames);
+static void kernel_mix(void);
+static void kernel_filter(void);
+static void kernel_read_prepare(void);
+static void kernel_read(void);
+static int kernel_setup(void);
+static void kernel_teardown(void);
+static void kernel_time(const struct bench_kernel *k, struct audio_bench_kernel *res);
+
+/*
+ * The share of the block period each kernel may take, in the worst case it is set
+ * up for. Together they leave half the period to the card, the I2S driver and the
+ * shell. They hold on every platform, the bench suite's baselines are tighter.
+ */
+static const struct bench_kernel kernels[AUDIO_BENCH_KERNELS] = {
+	{"tone", NULL, kernel_tone, 500},
+	{"convert", kernel_copy_input, kernel_convert, 500},
+	{"resample", kernel_copy_input, kernel_resample, 1000},
+	{"mix", kernel_copy_input, kernel_mix, 1000},
+	{"filter", kernel_copy_input, kernel_filter, 1500},
+	{"read", kernel_read_prepare, kernel_read, 500},
+};
+
+/* ----- function definitions ----- */
+static void bench_collect(const char *name, void *ctx)
+{
+	if (bench_count < BENCH_MAX_FILES && strlen(name) < PLAYLIST_NAME_MAX) {
+		strcpy(bench_files[bench_count++], name);
+	}
+}
+
+static int bench_file(const struct shell *shell, const char *name, struct bench_result *res)
+{
+	struct audio_stage_summary refill;
+	struct audio_stage_summary read;
+	int ret;
+
+	playlist_clear();
+	ret = playlist_add(name);
+	if (ret < 0) {
+		return ret;
+	}
+
+	audio_stats_reset();
+#ifdef CONFIG_I2S_SINK_SIM
+	i2s_sink_sim_stats_reset(sink_dev);
+#endif
+
+	ret = audio_stream_play(shell);
+	if (ret < 0) {
+		return ret;
+	}
+	audio_stream_wait(K_FOREVER);
+
+	audio_stats_stage_get(AUDIO_STAGE_REFILL, &refill);
+	res->blocks = refill.calls;
+	res->audio_us = (uint64_t)refill.calls * audio_latency_get()->block_us;
+	res->busy_us = refill.total_us;
+	res->refill_max_us = refill.max_us;
+	audio_stats_stage_get(AUDIO_STAGE_READ, &read);
+	res->reads = read.calls;
+	res->late = audio_stats_event_count(AUDIO_EVENT_LATE_BLOCK);
+	res->underruns = audio_stats_event_count(AUDIO_EVENT_UNDERRUN);
+	res->errors = audio_stats_event_count(AUDIO_EVENT_I2S_ERROR) +
+		      audio_stats_event_count(AUDIO_EVENT_READ_ERROR);
+
+#ifdef CONFIG_I2S_SINK_SIM
+	struct i2s_sink_sim_stats sink;
+
+	// The sink also sees an underrun the writer never hears of, at the end of a file
+	i2s_sink_sim_stats_get(sink_dev, &sink);
+	res->underruns = MAX(res->underruns, sink.underruns);
+#endif
+
+	return 0;
+}
+
+// Real-time factor in hundredths, how much faster than playback blocks are refilled
+static uint32_t bench_rt(const struct bench_result *res)
+{
+	return res->busy_us ? (uint32_t)MIN(res->audio_us * 100 / res->busy_us, UINT32_MAX)
+			    : UINT32_MAX;
+}
+
+static void bench_print(const struct shell *shell, const char *name,
+			const struct bench_result *res)
+{
+	uint32_t rt = res->busy_us ? bench_rt(res) : 0;
+	uint32_t reads_per_s =
+		res->audio_us ? (uint32_t)((uint64_t)res->reads * USEC_PER_SEC / res->audio_us) : 0;
+
+	shell_print(shell, "%-16s %7u %9u %8u %5u.%02u %8u %7u %5u %5u %5u", name, res->blocks,
+		    (uint32_t)(res->audio_us / USEC_PER_MSEC),
+		    (uint32_t)(res->busy_us / USEC_PER_MSEC), rt / 100, rt % 100,
+		    res->refill_max_us, reads_per_s, res->late, res->underruns, res->errors);
+}
+
+int audio_bench_run(const struct shell *shell, size_t count, char **files)
+{
+	struct bench_result total = {0};
+	uint32_t block_us = audio_latency_get()->block_us;
+	uint32_t slow = 0;
+	int ret;
+
+	if (count == 0) {
+		bench_count = 0;
+		ret = wav_list(bench_collect, NULL);
+		if (ret < 0) {
+			shell_error(shell, "Cannot list the card: %d", ret);
+			return ret;
+		}
+	} else {
+		bench_count = 0;
+		for (size_t i = 0; i < count; i++) {
+			bench_collect(files[i], NULL);
+		}
+	}
+
+	if (bench_count == 0) {
+		shell_error(shell, "No WAV files to bench");
+		return -ENOENT;
+	}
+
+	shell_print(shell, "Block period %u us, %u blocks", block_us, audio_latency_get()->blocks);
+	shell_print(shell, "%-16s %7s %9s %8s %8s %8s %7s %5s %5s %5s", "file", "blocks",
+		    "audio ms", "busy ms", "x rt", "max us", "reads/s", "late", "under", "err");
+
+	for (size_t i = 0; i < bench_count; i++) {
+		struct bench_result res = {0};
+
+		ret = bench_file(shell, bench_files[i], &res);
+		if (ret < 0) {
+			shell_error(shell, "%s: %d", bench_files[i], ret);
+			return ret;
+		}
+
+		bench_print(shell, bench_files[i], &res);
+
+		total.blocks += res.blocks;
+		total.audio_us += res.audio_us;
+		total.busy_us += res.busy_us;
+		total.reads += res.reads;
+		total.refill_max_us = MAX(total.refill_max_us, res.refill_max_us);
+		total.late += res.late;
+		total.underruns += res.underruns;
+		total.errors += res.errors;
+		// Simulated time does not pass while a block is refilled, so a slow refill
+		// never underruns the sink on native_sim, only its timing shows it
+		if (res.refill_max_us > block_us || bench_rt(&res) < CONFIG_AUDIO_BENCH_MIN_RT) {
+			slow++;
+		}
+	}
+
+	bench_print(shell, "total", &total);
+	if (slow > 0) {
+		shell_error(shell,
+			    "%u file(s) had a refill slower than %u us or ran below %u.%02ux "
+			    "real time",
+			    slow, block_us, CONFIG_AUDIO_BENCH_MIN_RT / 100,
+			    CONFIG_AUDIO_BENCH_MIN_RT % 100);
+	}
+
+	return (total.underruns > 0 || total.errors > 0 || slow > 0) ? -EIO : 0;
+}
+
+static void kernel_copy_input(void)
+{
+	memcpy(kernel_block, kernel_input, sizeof(kernel_block));
+}
+
+// Every tone at once
+static void kernel_tone(void)
+{
+	tone_gen_fill(kernel_block, KERNEL_FRAMES);
+}
+
+// 24-bit stereo with dither, the most a full block of any PCM source costs
+static void kernel_convert(void)
+{
+	audio_convert_block(&kernel_cv, kernel_block, kernel_convert_frames);
+}
+
+static void kernel_resample(void)
+{
+	audio_resample_block(&kernel_rs, kernel_block, kernel_resample_frames, KERNEL_FRAMES);
+}
+
+static size_t kernel_mix_fill(void *ctx, int16_t *buf, size_t frames)
+{
+	frames = MIN(frames, KERNEL_FRAMES);
+	memcpy(buf, kernel_input, frames * AUDIO_OUT_FRAME_BYTES);
+
+	return frames;
+}
+
+// Every mixer stream at once
+static void kernel_mix(void)
+{
+	audio_mixer_mix(kernel_block, KERNEL_FRAMES);
+}
+
+// Every EQ band and the limiter
+static void kernel_filter(void)
+{
+	audio_dsp_process(kernel_block, KERNEL_FRAMES);
+}
+
+// The copy out of the staging buffer, without the card reads that refill it
+static void kernel_read_prepare(void)
+{
+	kernel_wav.stage_pos = 0;
+}
+
+static void kernel_read(void)
+{
+	read_data(&kernel_wav, kernel_block, sizeof(kernel_block));
+}
+
+static int kernel_setup(void)
+{
+	const WavFormat s24 = {
+		.audio_format = WAVE_FORMAT_PCM,
+		.num_channels = AUDIO_OUT_CHANNELS,
+		.bits_per_sample = 24,
+		.valid_bits = 24,
+		.block_align = AUDIO_OUT_CHANNELS * 3,
+	};
+	uint32_t seed = 1;
+	int ret;
+
+	// The kernels share state with the audio thread, which must not be using it
+	if (audio_stream_state_get() != AUDIO_STREAM_IDLE || tone_gen_active() ||
+	    audio_mixer_active()) {
+		return -EBUSY;
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(kernel_input); i++) {
+		seed = seed * 1664525 + 1013904223;
+		kernel_input[i] = (int16_t)(seed >> 16) / 2;
+	}
+
+	for (int id = 0; id < TONE_GEN_MAX; id++) {
+		tone_gen_set(id, 440 + id * 1000, INT16_MAX / TONE_GEN_MAX);
+	}
+
+	audio_convert_init(&kernel_cv, &s24);
+	kernel_convert_frames = audio_convert_max_frames(&kernel_cv, sizeof(kernel_block));
+
+	ret = audio_resample_init(&kernel_rs, KERNEL_RESAMPLE_RATE, KERNEL_RATE);
+	if (ret < 0) {
+		tone_gen_stop_all();
+		return ret;
+	}
+	kernel_resample_frames = audio_resample_max_input(&kernel_rs, KERNEL_FRAMES);
+
+	// Every stream at an equal share, so the sum stays below full scale
+	for (int i = 0; i < CONFIG_AUDIO_MIXER_STREAMS; i++) {
+		int16_t gain = AUDIO_MIXER_UNITY / CONFIG_AUDIO_MIXER_STREAMS;
+
+		kernel_mix_ids[i] = audio_mixer_start(kernel_mix_fill, NULL, gain);
+	}
+
+	audio_dsp_get_limiter(&kernel_limiter, &kernel_threshold, &kernel_release_ms);
+	for (int band = 0; band < AUDIO_DSP_BANDS; band++) {
+		const struct audio_dsp_band peak = {
+			.type = AUDIO_DSP_PEAK, .freq = 100 + band * 1000, .gain = 60, .q = 100};
+
+		audio_dsp_get_band(band, &kernel_bands[band]);
+		audio_dsp_set_band(band, &peak);
+	}
+	audio_dsp_set_limiter(true, -30, 50);
+
+	memset(&kernel_wav, 0, sizeof(kernel_wav));
+	kernel_wav.is_open = true;
+	kernel_wav.data_remaining = UINT32_MAX;
+	kernel_wav.stage = (uint8_t *)kernel_input;
+	kernel_wav.stage_size = sizeof(kernel_input);
+	kernel_wav.stage_len = sizeof(kernel_input);
+
+	return 0;
+}
+
+static void kernel_teardown(void)
+{
+	tone_gen_stop_all();
+	audio_resample_free(&kernel_rs);
+
+	// Stopped streams are released once their fade out was mixed
+	for (int i = 0; i < CONFIG_AUDIO_MIXER_STREAMS; i++) {
+		audio_mixer_stop(kernel_mix_ids[i]);
+	}
+	while (audio_mixer_active()) {
+		audio_mixer_mix(kernel_block, KERNEL_FRAMES);
+	}
+
+	for (int band = 0; band < AUDIO_DSP_BANDS; band++) {
+		audio_dsp_set_band(band, &kernel_bands[band]);
+	}
+	audio_dsp_set_limiter(kernel_limiter, kernel_threshold, kernel_release_ms);
+}
+
+static void kernel_time(const struct bench_kernel *k, struct audio_bench_kernel *res)
+{
+	uint64_t total = 0;
+
+	res->name = k->name;
+	res->budget = k->budget;
+	res->max = 0;
+
+	// The first run warms the caches and adopts new settings, it is not counted
+	for (int i = 0; i <= KERNEL_RUNS; i++) {
+		uint32_t start;
+		uint32_t cycles;
+
+		if (k->prepare != NULL) {
+			k->prepare();
+		}
+
+		start = audio_stats_now();
+		k->run();
+		cycles = audio_stats_now() - start;
+
+		if (i > 0) {
+			total += cycles;
+			res->max = MAX(res->max, cycles);
+		}
+	}
+
+	res->mean = total / KERNEL_RUNS;
+	res->share = (uint64_t)res->mean * 10000 / ((uint64_t)KERNEL_BLOCK_US * CYCLES_PER_US);
+}
+
+int audio_bench_kernels_time(struct audio_bench_kernel res[AUDIO_BENCH_KERNELS])
+{
+	int ret = kernel_setup();
+
+	if (ret < 0) {
+		return ret;
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(kernels); i++) {
+		kernel_time(&kernels[i], &res[i]);
+	}
+
+	kernel_teardown();
+
+	return 0;
+}
+
+int audio_bench_kernels(const struct shell *shell, bool json)
+{
+	struct audio_bench_kernel res[AUDIO_BENCH_KERNELS];
+	uint32_t failed = 0;
+	int ret;
+
+	ret = audio_bench_kernels_time(res);
+	if (ret < 0) {
+		shell_error(shell, "Cannot set up the kernels: %d", ret);
+		return ret;
+	}
+
+	if (!json) {
+		shell_print(shell, "%u frames per block, %u us budget", KERNEL_FRAMES,
+			    KERNEL_BLOCK_US);
+		shell_print(shell, "%-10s %10s %8s %8s %7s %7s", "kernel", "cycles", "mean us",
+			    "max us", "share", "budget");
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(res); i++) {
+		const struct audio_bench_kernel *k = &res[i];
+		bool pass = k->share <= k->budget;
+
+		if (!pass) {
+			failed++;
+		}
+
+		if (json) {
+			shell_print(shell,
+				    "{\"kernel\":\"%s\",\"cycles\":%u,\"mean_us\":%u,"
+				    "\"max_us\":%u,\"share\":%u,\"budget\":%u,\"pass\":%s}",
+				    k->name, k->mean, k->mean / CYCLES_PER_US,
+				    k->max / CYCLES_PER_US, k->share, k->budget,
+				    pass ? "true" : "false");
+		} else {
+			shell_print(shell, "%-10s %10u %8u %8u %4u.%02u%% %4u.%02u%%%s", k->name,
+				    k->mean, k->mean / CYCLES_PER_US, k->max / CYCLES_PER_US,
+				    k->share / 100, k->share % 100, k->budget / 100,
+				    k->budget % 100, pass ? "" : " over budget");
+		}
+	}
+
+	if (json) {
+		shell_print(shell,
+			    "{\"frames\":%u,\"block_us\":%u,\"runs\":%u,\"failed\":%u}",
+			    KERNEL_FRAMES, KERNEL_BLOCK_US, KERNEL_RUNS, failed);
+	}
+
+	return failed > 0 ? -EIO : 0;
+}
+
+void audio_bench_autorun(void)
+{
+#ifdef CONFIG_SHELL_BACKEND_SERIAL
+	const struct shell *shell = shell_backend_uart_get_ptr();
+	int ret = audio_bench_kernels(shell, true);
+
+	if (ret == 0) {
+		ret = audio_bench_run(shell, 0, NULL);
+	}
+
+	LOG_INF("Benchmark %s", ret == 0 ? "passed" : "failed");
+#ifdef CONFIG_ARCH_POSIX
+	posix_exit(ret == 0 ? 0 : 1);
+#endif
+#endif
+}
+
+static int cmd_bench(const struct shell *shell, size_t argc, char **argv)
+{
+	return audio_bench_run(shell, argc - 1, &argv[1]);
+}
+
+static int cmd_bench_kernels(const struct shell *shell, size_t argc, char **argv)
+{
+	if (argc > 1 && strcmp(argv[1], "json") != 0) {
+		shell_error(shell, "Unknown option %s", argv[1]);
+		return -EINVAL;
+	}
+
+	return audio_bench_kernels(shell, argc > 1);
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	bench_cmds,
+	SHELL_CMD_ARG(kernels, NULL,
+		      "Time each per-block kernel against its share of the block period: [json]",
+		      cmd_bench_kernels, 1, 1),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_SUBCMD_ADD((audio), bench, &bench_cmds,
+		 "Stream files and report refill throughput, card reads and underruns: [file...], "
+		 "every .wav when none are given",
+		 cmd_bench, 1, 8);
@@ -0,0 +1,55 @@
+#ifndef AUDIO_BENCH_H_
+#define AUDIO_BENCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <zephyr/shell/shell.h>
+
+/*
+ * End-to-end playback benchmark, 'audio bench'.
+ *
+ * Streams each file through the normal playback path and reports how fast the
+ * reader refills blocks compared to real time, the slowest refill against the
+ * block period and the underruns. Returns -EIO when any file underran, had a
+ * refill slower than the block period or was refilled below
+ * CONFIG_AUDIO_BENCH_MIN_RT.
+ */
+
+// Bench the given files, or every .wav in the card's root when count is 0
+int audio_bench_run(const struct shell *shell, size_t count, char **files);
+
+// Per-block kernels: tone, convert, resample, mix, filter and read
+#define AUDIO_BENCH_KERNELS 6
+
+// Cycles of audio_stats_now() one kernel took per block
+struct audio_bench_kernel {
+	const char *name;
+	uint32_t mean;
+	uint32_t max;
+	uint32_t share;  // of the block period by the mean, hundredths of a percent
+	uint32_t budget; // largest share allowed, in the same unit
+};
+
+/*
+ * Time the per-block kernels (tone, conversion, resampling, mixing, filtering and
+ * the read_data copy) on 25 ms blocks, each in its most expensive setup, with the
+ * DWT cycle counter on hardware and the host clock on native_sim. Results are in
+ * the order above. Fails with -EBUSY while the stream, tones or the mixer are in
+ * use. The bench test suite checks them against their budgets and, once measured,
+ * against per-platform baselines.
+ */
+int audio_bench_kernels_time(struct audio_bench_kernel res[AUDIO_BENCH_KERNELS]);
+
+/*
+ * Print the kernel timings against their share of the block period, returns -EIO
+ * when any kernel is over budget. With json every kernel is printed as one JSON
+ * object per line, followed by a summary object.
+ */
+int audio_bench_kernels(const struct shell *shell, bool json);
+
+// Bench the kernels and every file at boot, native_sim then exits with the result as its status
+void audio_bench_autorun(void);
+
+#endif /* AUDIO_BENCH_H_ */
@@ -0,0 +1,571 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+
+#include "audio_cache.h"
+#include "audio_convert.h"
+#include "audio_decode.h"
+#include "audio_latency.h"
+#include "audio_mem.h"
+#include "audio_mixer.h"
+#include "audio_resample.h"
+#include "audio_stats.h"
+#include "audio_stream.h"
+#include "playlist.h"
+#include "wav_reader.h"
+
+/* ----- module registers ----- */
+LOG_MODULE_REGISTER(audio_cache, LOG_LEVEL_INF);
+
+/* ----- definitions ----- */
+#define ENTRIES CONFIG_AUDIO_CACHE_ENTRIES
+#define VOICES  CONFIG_AUDIO_MIXER_STREAMS
+
+// Output frames converted per card read while loading
+#define LOAD_FRAMES 512
+
+// Values of cache_voice.state
+#define VOICE_FREE    0
+#define VOICE_PLAYING 1
+
+/* ----- private static variables and types ----- */
+struct cache_entry {
+	char name[PLAYLIST_NAME_MAX];
+	int16_t *pcm; // 16-bit stereo at the output rate, NULL when the entry is free
+	uint32_t frames;
+	uint32_t bytes;
+	uint32_t last_used; // cache_clock of the last load or trigger
+	atomic_t users;     // voices playing it, it is not evicted while they do
+};
+
+struct cache_voice {
+	atomic_t state;
+	struct cache_entry *entry;
+	uint32_t pos;     // next frame, touched by the audio thread only
+	uint32_t trigger; // audio_stats_now() at audio_cache_play
+	int mixer_id;     // -1 until the mixer stream is set up
+};
+
+K_HEAP_DEFINE(cache_heap, CONFIG_AUDIO_CACHE_SIZE);
+
+// Entries, cache_clock and the loader state below, voices are set up under it too
+static K_MUTEX_DEFINE(cache_lock);
+static struct cache_entry entries[ENTRIES];
+static struct cache_voice voices[VOICES];
+static uint32_t cache_clock;
+static uint32_t cache_rate;
+static uint32_t cache_max_bytes; // largest block the empty heap gives, headers included
+static uint32_t cache_used;
+static uint32_t cache_hits;
+static uint32_t cache_misses;
+static uint32_t cache_evictions;
+
+static WavFile cache_wav;
+static struct audio_convert cache_cv;
+static struct audio_resample cache_rs;
+static uint8_t __audio_dma __aligned(AUDIO_DMA_ALIGN) cache_scratch[LOAD_FRAMES *
+								     AUDIO_OUT_FRAME_BYTES];
+
+// Trigger to output, written by the audio thread and read by the shell
+static struct k_spinlock latency_lock;
+static struct cache_latency {
+	uint32_t last;
+	uint32_t max;
+	uint32_t count;
+	uint64_t total;
+	uint32_t mix_us; // of the last trigger, up to its first mixed frame
+	uint32_t queued; // of the last trigger, I2S blocks ahead of that frame
+} latency;
+
+/* ----- private function declarations ----- */
+static struct cache_entry *cache_find(const char *name);
+static uint32_t cache_probe_max(void);
+static void cache_evict(struct cache_entry *e);
+static void cache_reclaim_voices(void);
+static struct cache_entry *cache_lru(void);
+static void *cache_alloc(size_t bytes);
+static int cache_read(int16_t *pcm, uint32_t max_frames, uint32_t *frames);
+static int cache_load_locked(const char *name, struct cache_entry **loaded);
+static void cache_voice_release(struct cache_voice *v);
+static size_t cache_voice_fill(void *ctx, int16_t *buf, size_t frames);
+
+/* ----- function definitions ----- */
+static struct cache_entry *cache_find(const char *name)
+{
+	for (int i = 0; i < ENTRIES; i++) {
+		if (entries[i].pcm != NULL && strcmp(entries[i].name, name) == 0) {
+			return &entries[i];
+		}
+	}
+
+	return NULL;
+}
+
+// Largest allocation the empty heap satisfies, the budget less the heap's own headers
+static uint32_t cache_probe_max(void)
+{
+	uint32_t lo = 0;
+	uint32_t hi = CONFIG_AUDIO_CACHE_SIZE;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo + 1) / 2;
+		void *p = k_heap_alloc(&cache_heap, mid, K_NO_WAIT);
+
+		if (p != NULL) {
+			k_heap_free(&cache_heap, p);
+			lo = mid;
+		} else {
+			hi = mid - 1;
+		}
+	}
+
+	return lo;
+}
+
+static void cache_evict(struct cache_entry *e)
+{
+	k_heap_free(&cache_heap, e->pcm);
+	cache_used -= e->bytes;
+	e->pcm = NULL;
+	e->frames = 0;
+	e->bytes = 0;
+}
+
+// Free voices the mixer stopped before they reached their end
+static void cache_reclaim_voices(void)
+{
+	for (int i = 0; i < VOICES; i++) {
+		struct cache_voice *v = &voices[i];
+
+		if (atomic_get(&v->state) == VOICE_PLAYING && v->mixer_id >= 0 &&
+		    !audio_mixer_playing(v->mixer_id, v)) {
+			cache_voice_release(v);
+		}
+	}
+}
+
+// Least recently used entry that is not playing
+static struct cache_entry *cache_lru(void)
+{
+	struct cache_entry *lru = NULL;
+
+	cache_reclaim_voices();
+	for (int i = 0; i < ENTRIES; i++) {
+		struct cache_entry *e = &entries[i];
+
+		if (e->pcm == NULL || atomic_get(&e->users) > 0) {
+			continue;
+		}
+		if (lru == NULL || (int32_t)(e->last_used - lru->last_used) < 0) {
+			lru = e;
+		}
+	}
+
+	return lru;
+}
+
+// Allocate from the budget, evicting idle effects until the block fits
+static void *cache_alloc(size_t bytes)
+{
+	void *pcm;
+
+	while ((pcm = k_heap_alloc(&cache_heap, bytes, K_NO_WAIT)) == NULL) {
+		struct cache_entry *lru = cache_lru();
+
+		if (lru == NULL) {
+			return NULL;
+		}
+
+		LOG_INF("Evicting %s", lru->name);
+		cache_evict(lru);
+		cache_evictions++;
+	}
+
+	return pcm;
+}
+
+// Convert the open cache_wav into pcm, at most max_frames output frames
+static int cache_read(int16_t *pcm, uint32_t max_frames, uint32_t *frames)
+{
+	int16_t *scratch = (int16_t *)cache_scratch;
+	uint32_t done = 0;
+
+	for (;;) {
+		size_t in = MIN(audio_convert_max_frames(&cache_cv, sizeof(cache_scratch)),
+				audio_resample_max_input(&cache_rs, LOAD_FRAMES));
+		size_t bytes = in * cache_cv.frame_bytes;
+		int32_t num_read;
+		size_t out;
+
+		audio_mem_dma_write_prepare(cache_scratch, bytes);
+		num_read = read_data(&cache_wav, cache_scratch, bytes);
+		audio_mem_dma_write_complete(cache_scratch, bytes);
+		if (num_read < 0) {
+			return num_read;
+		}
+		if (num_read < cache_cv.frame_bytes) {
+			break;
+		}
+
+		in = num_read / cache_cv.frame_bytes;
+		audio_convert_block(&cache_cv, scratch, in);
+		out = audio_resample_block(&cache_rs, scratch, in, LOAD_FRAMES);
+		out = MIN(out, max_frames - done);
+		memcpy(&pcm[done * AUDIO_OUT_CHANNELS], scratch, out * AUDIO_OUT_FRAME_BYTES);
+		done += out;
+	}
+
+	*frames = done;
+
+	return 0;
+}
+
+static int cache_load_locked(const char *name, struct cache_entry **loaded)
+{
+	struct cache_entry *e = cache_find(name);
+	uint64_t max_frames;
+	uint32_t frames;
+	int16_t *pcm;
+	int ret;
+
+	if (e != NULL) {
+		e->last_used = ++cache_clock;
+		*loaded = e;
+		return 0;
+	}
+
+	if (strlen(name) >= PLAYLIST_NAME_MAX) {
+		return -ENAMETOOLONG;
+	}
+
+	ret = read_wav_file(name, &cache_wav);
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (audio_decode_needed(&cache_wav.format)) {
+		LOG_ERR("%s is compressed, only PCM and float files are cached", name);
+		ret = -ENOTSUP;
+		goto out;
+	}
+
+	ret = audio_convert_init(&cache_cv, &cache_wav.format);
+	if (ret == 0) {
+		ret = audio_resample_init(&cache_rs, cache_wav.format.sample_rate, cache_rate);
+	}
+	if (ret < 0) {
+		goto out;
+	}
+
+	// The resampler may carry one frame more than the ratio gives
+	max_frames = cache_wav.format.data_size / cache_cv.frame_bytes;
+	if (!cache_rs.bypass) {
+		max_frames = max_frames * cache_rs.up / cache_rs.down + 1;
+	}
+	if (max_frames * AUDIO_OUT_FRAME_BYTES > cache_max_bytes) {
+		ret = -EFBIG;
+		goto out;
+	}
+
+	// A free slot, or the slot of the least recently used effect
+	for (int i = 0; i < ENTRIES && e == NULL; i++) {
+		if (entries[i].pcm == NULL) {
+			e = &entries[i];
+		}
+	}
+	if (e == NULL) {
+		e = cache_lru();
+		if (e == NULL) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		LOG_INF("Evicting %s", e->name);
+		cache_evict(e);
+		cache_evictions++;
+	}
+
+	pcm = cache_alloc(max_frames * AUDIO_OUT_FRAME_BYTES);
+	if (pcm == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ret = cache_read(pcm, max_frames, &frames);
+	if (ret < 0) {
+		k_heap_free(&cache_heap, pcm);
+		goto out;
+	}
+
+	strcpy(e->name, name);
+	e->pcm = pcm;
+	e->frames = frames;
+	e->bytes = max_frames * AUDIO_OUT_FRAME_BYTES;
+	e->last_used = ++cache_clock;
+	cache_used += e->bytes;
+	*loaded = e;
+
+	LOG_INF("Cached %s, %u frames", name, frames);
+
+out:
+	close_wav_file(&cache_wav);
+	audio_resample_free(&cache_rs);
+
+	return ret;
+}
+
+int audio_cache_init(uint32_t sample_rate)
+{
+	cache_rate = sample_rate;
+	cache_max_bytes = cache_probe_max();
+	for (int i = 0; i < VOICES; i++) {
+		voices[i].mixer_id = -1;
+	}
+
+	return 0;
+}
+
+int audio_cache_load(const char *name)
+{
+	struct cache_entry *e;
+	int ret;
+
+	k_mutex_lock(&cache_lock, K_FOREVER);
+	ret = cache_load_locked(name, &e);
+	k_mutex_unlock(&cache_lock);
+
+	return ret;
+}
+
+int audio_cache_load_list(const char *names)
+{
+	char name[PLAYLIST_NAME_MAX];
+	int failed = 0;
+
+	while (*names != '\0') {
+		size_t len = strcspn(names, " ");
+
+		if (len > 0 && len < sizeof(name)) {
+			memcpy(name, names, len);
+			name[len] = '\0';
+			if (audio_cache_load(name) < 0) {
+				LOG_WRN("Cannot preload %s", name);
+				failed++;
+			}
+		}
+
+		names += len;
+		names += strspn(names, " ");
+	}
+
+	return failed ? -EIO : 0;
+}
+
+int audio_cache_drop(const char *name)
+{
+	struct cache_entry *e;
+	int ret = 0;
+
+	k_mutex_lock(&cache_lock, K_FOREVER);
+	cache_reclaim_voices();
+	e = cache_find(name);
+	if (e == NULL) {
+		ret = -ENOENT;
+	} else if (atomic_get(&e->users) > 0) {
+		ret = -EBUSY;
+	} else {
+		cache_evict(e);
+	}
+	k_mutex_unlock(&cache_lock);
+
+	return ret;
+}
+
+static void cache_voice_release(struct cache_voice *v)
+{
+	// The audio thread and a reclaim may both see the end, only one releases
+	if (atomic_cas(&v->state, VOICE_PLAYING, VOICE_FREE)) {
+		atomic_dec(&v->entry->users);
+	}
+}
+
+// Mixer source of a triggered effect, the first call is its first mixed frame
+static size_t cache_voice_fill(void *ctx, int16_t *buf, size_t frames)
+{
+	struct cache_voice *v = ctx;
+	const struct cache_entry *e = v->entry;
+	size_t n = MIN(frames, e->frames - v->pos);
+
+	if (v->pos == 0) {
+		uint32_t mix_us = (audio_stats_now() - v->trigger) /
+				  (sys_clock_hw_cycles_per_sec() / USEC_PER_SEC);
+		uint32_t queued = audio_stream_queued();
+		uint32_t us = mix_us + queued * audio_latency_get()->block_us;
+		k_spinlock_key_t key = k_spin_lock(&latency_lock);
+
+		latency.last = us;
+		latency.max = MAX(latency.max, us);
+		latency.count++;
+		latency.total += us;
+		latency.mix_us = mix_us;
+		latency.queued = queued;
+		k_spin_unlock(&latency_lock, key);
+	}
+
+	memcpy(buf, &e->pcm[v->pos * AUDIO_OUT_CHANNELS], n * AUDIO_OUT_FRAME_BYTES);
+	v->pos += n;
+	if (n < frames) {
+		cache_voice_release(v);
+	}
+
+	return n;
+}
+
+int audio_cache_play(const char *name, int16_t gain)
+{
+	struct cache_voice *v = NULL;
+	struct cache_entry *e;
+	int ret;
+
+	k_mutex_lock(&cache_lock, K_FOREVER);
+
+	if (cache_find(name) != NULL) {
+		cache_hits++;
+	} else {
+		cache_misses++;
+	}
+	ret = cache_load_locked(name, &e);
+	if (ret < 0) {
+		goto out;
+	}
+
+	cache_reclaim_voices();
+	for (int i = 0; i < VOICES && v == NULL; i++) {
+		if (atomic_get(&voices[i].state) == VOICE_FREE) {
+			v = &voices[i];
+		}
+	}
+	if (v == NULL) {
+		ret = -ENOSPC;
+		goto out;
+	}
+
+	atomic_inc(&e->users);
+	v->entry = e;
+	v->pos = 0;
+	v->mixer_id = -1;
+	v->trigger = audio_stats_now();
+	atomic_set(&v->state, VOICE_PLAYING);
+
+	ret = audio_mixer_start(cache_voice_fill, v, gain);
+	if (ret < 0) {
+		cache_voice_release(v);
+		goto out;
+	}
+	v->mixer_id = ret;
+
+out:
+	k_mutex_unlock(&cache_lock);
+
+	return ret;
+}
+
+static int cmd_cache(const struct shell *shell, size_t argc, char **argv)
+{
+	const struct audio_latency *lat = audio_latency_get();
+	struct cache_latency l;
+	k_spinlock_key_t key;
+
+	k_mutex_lock(&cache_lock, K_FOREVER);
+	cache_reclaim_voices();
+	for (int i = 0; i < ENTRIES; i++) {
+		const struct cache_entry *e = &entries[i];
+
+		if (e->pcm == NULL) {
+			continue;
+		}
+		shell_print(shell, "%-24s %6u ms %7u bytes, last used %u uses ago%s", e->name,
+			    (uint32_t)((uint64_t)e->frames * MSEC_PER_SEC / cache_rate),
+			    e->bytes, cache_clock - e->last_used,
+			    atomic_get(&e->users) > 0 ? ", playing" : "");
+	}
+	shell_print(shell, "%u of %u bytes used, %u hits, %u misses, %u evictions", cache_used,
+		    cache_max_bytes, cache_hits, cache_misses, cache_evictions);
+	k_mutex_unlock(&cache_lock);
+
+	/*
+	 * The effect is heard once the I2S blocks queued ahead of its first mixed frame
+	 * have played, the block playing then counts in full
+	 */
+	key = k_spin_lock(&latency_lock);
+	l = latency;
+	k_spin_unlock(&latency_lock, key);
+
+	shell_print(shell, "Trigger to output: last %u us, avg %u us, max %u us", l.last,
+		    l.count ? (uint32_t)(l.total / l.count) : 0, l.max);
+	shell_print(shell, "Last: first mixed frame after %u us, then %u queued blocks of %u us",
+		    l.mix_us, l.queued, lat->block_us);
+
+	return 0;
+}
+
+static int cmd_cache_load(const struct shell *shell, size_t argc, char **argv)
+{
+	for (size_t i = 1; i < argc; i++) {
+		int ret = audio_cache_load(argv[i]);
+
+		if (ret < 0) {
+			shell_error(shell, "Cannot cache %s: %d", argv[i], ret);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+static int cmd_cache_drop(const struct shell *shell, size_t argc, char **argv)
+{
+	int ret = audio_cache_drop(argv[1]);
+
+	if (ret < 0) {
+		shell_error(shell, "Cannot drop %s: %d", argv[1], ret);
+	}
+
+	return ret;
+}
+
+static int cmd_cache_play(const struct shell *shell, size_t argc, char **argv)
+{
+	long pct = argc > 2 ? CLAMP(strtol(argv[2], NULL, 10), 0, 100) : 100;
+	int id;
+	int ret;
+
+	id = audio_cache_play(argv[1], pct * AUDIO_MIXER_UNITY / 100);
+	if (id < 0) {
+		shell_error(shell, "Cannot play %s: %d", argv[1], id);
+		return id;
+	}
+
+	// Effects are heard through the mixer, run the engine on silence if nothing plays
+	ret = audio_stream_start(shell, AUDIO_SOURCE_SILENCE);
+	if (ret < 0 && ret != -EBUSY) {
+		shell_error(shell, "Cannot start the audio engine: %d", ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	cache_cmds, SHELL_CMD_ARG(load, NULL, "<file> [file...]", cmd_cache_load, 2, 7),
+	SHELL_CMD_ARG(drop, NULL, "<file>", cmd_cache_drop, 2, 0),
+	SHELL_CMD_ARG(play, NULL, "<file> [gain_pct]", cmd_cache_play, 2, 1),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_SUBCMD_ADD((audio), cache, &cache_cmds,
+		 "List cached effects and trigger latency, load, drop or play them", cmd_cache, 1,
+		 0);
@@ -0,0 +1,41 @@
+#ifndef AUDIO_CACHE_H_
+#define AUDIO_CACHE_H_
+
+#include <stdint.h>
+
+/*
+ * RAM cache of short sound effects.
+ *
+ * Files are read, converted to 16-bit stereo and resampled to the output rate once,
+ * into a heap of CONFIG_AUDIO_CACHE_SIZE bytes. A trigger then only claims a mixer
+ * stream that copies frames from RAM, so nothing touches the card and the effect
+ * is mixed into the next block the engine writes. When the budget is exhausted the
+ * least recently played effects that are not playing are evicted.
+ *
+ * Compressed files are not cached, their decoder is shared with playback.
+ */
+
+// Output rate effects are converted to
+int audio_cache_init(uint32_t sample_rate);
+
+/*
+ * Load name unless it is cached already. -EFBIG when it alone does not fit the
+ * empty heap, whose headers take part of the budget, -ENOMEM when it only fits by
+ * evicting effects that are playing.
+ */
+int audio_cache_load(const char *name);
+
+// Load every file of a space separated list, such as CONFIG_AUDIO_CACHE_PRELOAD
+int audio_cache_load_list(const char *names);
+
+// Drop name from the cache, -EBUSY while it plays
+int audio_cache_drop(const char *name);
+
+/*
+ * Mix name into the output at a Q15 gain, loading it first on a miss. Returns the
+ * mixer stream id. It is heard once the audio engine runs, start it on
+ * AUDIO_SOURCE_SILENCE when nothing plays.
+ */
+int audio_cache_play(const char *name, int16_t gain);
+
+#endif /* AUDIO_CACHE_H_ */
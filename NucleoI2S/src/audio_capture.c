@@ -0,0 +1,293 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+
+#include "audio_capture.h"
+#include "audio_mem.h"
+#include "audio_stats.h"
+#include "audio_stream.h"
+#include "wav_reader.h"
+
+/* ----- module registers ----- */
+LOG_MODULE_REGISTER(audio_capture, LOG_LEVEL_INF);
+
+/* ----- definitions ----- */
+
+// Eight sectors, so every block is written straight from the DMA buffer
+#define CAPTURE_BLOCK_SIZE 4096
+#define CAPTURE_CHANNELS   2
+
+// Bounds i2s_read so a stop request is noticed without traffic
+#define CAPTURE_READ_TIMEOUT_MS 1000
+
+#define CAPTURE_RX_STACK_SIZE 1024
+#define CAPTURE_WR_STACK_SIZE 2048
+
+enum capture_state {
+	CAPTURE_IDLE,
+	CAPTURE_PENDING, // joint start, waiting for the playback writer
+	CAPTURE_RUNNING,
+};
+
+/* ----- private static variables and types ----- */
+struct capture_item {
+	void *block;
+	size_t size;
+};
+
+K_MEM_SLAB_DEFINE_IN_SECT_STATIC(capture_slab, __audio_dma, CAPTURE_BLOCK_SIZE,
+				 CONFIG_AUDIO_CAPTURE_BLOCKS, AUDIO_DMA_ALIGN);
+K_MSGQ_DEFINE(capture_queue, sizeof(struct capture_item), CONFIG_AUDIO_CAPTURE_BLOCKS, 4);
+
+static K_THREAD_STACK_DEFINE(capture_rx_stack, CAPTURE_RX_STACK_SIZE);
+static K_THREAD_STACK_DEFINE(capture_wr_stack, CAPTURE_WR_STACK_SIZE);
+static struct k_thread capture_rx_thread_data;
+static struct k_thread capture_wr_thread_data;
+
+static const struct device *capture_dev;
+static struct i2s_config capture_cfg;
+static atomic_t capture_state;
+static atomic_t capture_running;
+static WavFile capture_file;
+
+// Totals of the current or last recording
+static struct {
+	uint32_t blocks;
+	uint32_t dropped;
+} capture_stats;
+
+/* ----- private function declarations ----- */
+static void capture_rx_thread(void *arg1, void *arg2, void *arg3);
+static void capture_wr_thread(void *arg1, void *arg2, void *arg3);
+static void capture_block_free(void *block);
+
+/* ----- function definitions ----- */
+
+/*
+ * The slab links free blocks through their first word. Clean that line before the
+ * driver can take the block again from its DMA interrupt, or a later eviction
+ * would overwrite received samples.
+ */
+static void capture_block_free(void *block)
+{
+	unsigned int key = irq_lock();
+
+	k_mem_slab_free(&capture_slab, block);
+	audio_mem_dma_read_prepare(block, sizeof(void *));
+	irq_unlock(key);
+}
+
+static void capture_rx_thread(void *arg1, void *arg2, void *arg3)
+{
+	struct capture_item item;
+	int ret;
+
+	while (atomic_get(&capture_running)) {
+		ret = i2s_read(capture_dev, &item.block, &item.size);
+		if (ret == -EAGAIN) {
+			continue;
+		} else if (ret < 0) {
+			// The driver stops on an RX overrun
+			LOG_ERR("I2S read failed: %d", ret);
+			audio_stats_event(AUDIO_EVENT_CAPTURE_DROP);
+			break;
+		}
+
+		audio_mem_dma_write_complete(item.block, item.size);
+
+		if (k_msgq_put(&capture_queue, &item, K_NO_WAIT) < 0) {
+			// The card fell behind by the whole queue, keep the stream running
+			capture_block_free(item.block);
+			capture_stats.dropped++;
+			audio_stats_event(AUDIO_EVENT_CAPTURE_DROP);
+		}
+	}
+
+	// Tell the file writer to finish
+	item.block = NULL;
+	item.size = 0;
+	k_msgq_put(&capture_queue, &item, K_FOREVER);
+}
+
+static void capture_wr_thread(void *arg1, void *arg2, void *arg3)
+{
+	struct capture_item item;
+	uint32_t start;
+	int32_t ret;
+
+	for (;;) {
+		k_msgq_get(&capture_queue, &item, K_FOREVER);
+		if (item.block == NULL) {
+			break;
+		}
+
+		start = audio_stats_now();
+		ret = write_data(&capture_file, item.block, item.size);
+		audio_stats_stage(AUDIO_STAGE_CAPTURE_WRITE, start);
+		capture_block_free(item.block);
+
+		if (ret < (int32_t)item.size) {
+			if (ret < 0) {
+				LOG_ERR("Failed to write capture: %d", ret);
+			} else {
+				LOG_INF("Capture reached its preallocated length");
+			}
+			// Stop receiving, the rx thread then ends the queue
+			atomic_clear(&capture_running);
+		}
+		capture_stats.blocks++;
+	}
+}
+
+void audio_capture_init(const struct device *dev, const struct i2s_config *cfg)
+{
+	capture_dev = dev;
+	capture_cfg = *cfg;
+	capture_cfg.block_size = CAPTURE_BLOCK_SIZE;
+	capture_cfg.mem_slab = &capture_slab;
+	capture_cfg.timeout = CAPTURE_READ_TIMEOUT_MS;
+}
+
+int audio_capture_start(const char *file_name, uint32_t seconds, bool joint)
+{
+	uint32_t max_data;
+	int ret;
+
+	if (capture_dev == NULL) {
+		return -ENODEV;
+	}
+
+	// A half-duplex driver cannot add RX to a running TX stream
+	if (joint && !IS_ENABLED(CONFIG_AUDIO_I2S_FULL_DUPLEX)) {
+		return -ENOTSUP;
+	}
+	if (!joint && audio_stream_state_get() != AUDIO_STREAM_IDLE) {
+		return -EBUSY;
+	}
+
+	if (!atomic_cas(&capture_state, CAPTURE_IDLE, joint ? CAPTURE_PENDING : CAPTURE_RUNNING)) {
+		return -EALREADY;
+	}
+
+	max_data = MIN((uint64_t)seconds * capture_cfg.frame_clk_freq * CAPTURE_CHANNELS *
+			       sizeof(int16_t),
+		       UINT32_MAX - WAV_WRITE_HEADER_SIZE);
+
+	ret = create_wav_file(file_name, &capture_file, CAPTURE_CHANNELS,
+			      capture_cfg.frame_clk_freq, max_data);
+	if (ret < 0) {
+		atomic_set(&capture_state, CAPTURE_IDLE);
+		return ret;
+	}
+
+	ret = i2s_configure(capture_dev, I2S_DIR_RX, &capture_cfg);
+	if (ret < 0) {
+		LOG_ERR("Failed to configure I2S RX: %d", ret);
+		finish_wav_file(&capture_file);
+		atomic_set(&capture_state, CAPTURE_IDLE);
+		return ret;
+	}
+
+	memset(&capture_stats, 0, sizeof(capture_stats));
+	k_msgq_purge(&capture_queue);
+	atomic_set(&capture_running, 1);
+
+	k_thread_create(&capture_wr_thread_data, capture_wr_stack,
+			K_THREAD_STACK_SIZEOF(capture_wr_stack), capture_wr_thread, NULL, NULL,
+			NULL, CONFIG_AUDIO_READER_THREAD_PRIORITY, 0, K_NO_WAIT);
+	k_thread_name_set(&capture_wr_thread_data, "capture_wr");
+	k_thread_create(&capture_rx_thread_data, capture_rx_stack,
+			K_THREAD_STACK_SIZEOF(capture_rx_stack), capture_rx_thread, NULL, NULL,
+			NULL, CONFIG_AUDIO_WRITER_THREAD_PRIORITY, 0, K_NO_WAIT);
+	k_thread_name_set(&capture_rx_thread_data, "capture_rx");
+
+	if (!joint) {
+		ret = i2s_trigger(capture_dev, I2S_DIR_RX, I2S_TRIGGER_START);
+		if (ret < 0) {
+			LOG_ERR("Failed to start I2S RX: %d", ret);
+			audio_capture_stop();
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+int audio_capture_stop(void)
+{
+	int ret;
+
+	if (atomic_get(&capture_state) == CAPTURE_IDLE) {
+		return -EALREADY;
+	}
+
+	atomic_clear(&capture_running);
+
+	// Discard the block in progress, i2s_read then returns and the rx thread exits
+	i2s_trigger(capture_dev, I2S_DIR_RX, I2S_TRIGGER_DROP);
+	k_thread_join(&capture_rx_thread_data, K_FOREVER);
+	k_thread_join(&capture_wr_thread_data, K_FOREVER);
+
+	ret = finish_wav_file(&capture_file);
+	LOG_INF("Captured %u bytes in %u blocks, %u dropped", capture_file.format.data_size,
+		capture_stats.blocks, capture_stats.dropped);
+
+	atomic_set(&capture_state, CAPTURE_IDLE);
+
+	return ret;
+}
+
+bool audio_capture_active(void)
+{
+	return atomic_get(&capture_state) != CAPTURE_IDLE;
+}
+
+bool audio_capture_joint_pending(void)
+{
+	return atomic_get(&capture_state) == CAPTURE_PENDING;
+}
+
+void audio_capture_joint_started(void)
+{
+	atomic_cas(&capture_state, CAPTURE_PENDING, CAPTURE_RUNNING);
+}
+
+static int cmd_record(const struct shell *shell, size_t argc, char **argv)
+{
+	uint32_t seconds = argc > 2 ? strtoul(argv[2], NULL, 10) : CONFIG_AUDIO_CAPTURE_MAX_SECONDS;
+	int ret;
+
+	ret = audio_capture_start(argv[1], seconds, false);
+	if (ret == -EBUSY) {
+		shell_error(shell, "Playback uses the I2S peripheral, stop it first");
+	} else if (ret < 0) {
+		shell_error(shell, "Failed to start recording: %d", ret);
+	}
+
+	return ret;
+}
+
+static int cmd_record_stop(const struct shell *shell, size_t argc, char **argv)
+{
+	int ret = audio_capture_stop();
+
+	if (ret < 0 && ret != -EALREADY) {
+		shell_error(shell, "Failed to finish the recording: %d", ret);
+	}
+	shell_print(shell, "%u bytes captured, %u blocks dropped", capture_file.format.data_size,
+		    capture_stats.dropped);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(record_cmds,
+			       SHELL_CMD(stop, NULL, "Stop recording and close the file",
+					 cmd_record_stop),
+			       SHELL_SUBCMD_SET_END);
+
+SHELL_SUBCMD_ADD((audio), record, &record_cmds, "Record I2S RX to a WAV file: <file> [seconds]",
+		 cmd_record, 2, 1);
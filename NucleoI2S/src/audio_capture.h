@@ -0,0 +1,45 @@
+#ifndef AUDIO_CAPTURE_H_
+#define AUDIO_CAPTURE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <zephyr/device.h>
+#include <zephyr/drivers/i2s.h>
+
+/*
+ * I2S RX capture to a WAV file on the SD card.
+ *
+ * A receive thread takes blocks from the I2S driver as soon as they complete and
+ * queues them for a low priority thread that writes them to a preallocated file,
+ * so a slow SD write never backs up into the driver's short RX queue.
+ */
+
+/*
+ * Use dev with the stream settings of cfg (word size, rate, clocking) for
+ * capture. The block size and slab of cfg are replaced by the capture ones.
+ */
+void audio_capture_init(const struct device *dev, const struct i2s_config *cfg);
+
+/*
+ * Start recording up to seconds of audio into file_name. With joint the RX stream
+ * is only configured, and the playback writer starts both directions together
+ * with I2S_DIR_BOTH so capture and playback are sample aligned. A joint capture
+ * needs CONFIG_AUDIO_I2S_FULL_DUPLEX, -ENOTSUP otherwise. Any other capture
+ * returns -EBUSY while playback runs, as both use the same I2S peripheral.
+ */
+int audio_capture_start(const char *file_name, uint32_t seconds, bool joint);
+
+// Stop recording and finish the file
+int audio_capture_stop(void);
+
+// True from the start of a capture until it is stopped
+bool audio_capture_active(void);
+
+// True while a joint capture waits for the playback writer to start the stream
+bool audio_capture_joint_pending(void);
+
+// Called by the playback writer once I2S_DIR_BOTH was started
+void audio_capture_joint_started(void);
+
+#endif /* AUDIO_CAPTURE_H_ */
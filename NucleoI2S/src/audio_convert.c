@@ -0,0 +1,255 @@
+#include <errno.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "audio_convert.h"
+#include "audio_simd.h"
+
+#ifdef CONFIG_CMSIS_DSP
+#include <arm_math.h>
+#endif
+
+/* ----- module registers ----- */
+LOG_MODULE_REGISTER(audio_convert, LOG_LEVEL_INF);
+
+/* ----- definitions ----- */
+
+// Numerical Recipes LCG, advanced once per dithered sample
+#define DITHER_SEED    0x2545f491u
+#define DITHER_NEXT(x) ((x) * 1664525u + 1013904223u)
+
+// Added before dropping the low 16 bits of a left-justified sample to round to nearest
+#define Q15_ROUND (1 << 15)
+
+/* ----- private function declarations ----- */
+static inline int32_t sat_add32(int32_t a, int32_t b);
+static inline int32_t tpdf_dither(uint32_t *state);
+
+/* ----- function definitions ----- */
+static inline int32_t sat_add32(int32_t a, int32_t b)
+{
+	int64_t sum = (int64_t)a + b;
+
+	return (int32_t)CLAMP(sum, INT32_MIN, INT32_MAX);
+}
+
+// Triangular dither of +-1 LSB of the 16-bit output, in left-justified 32-bit units
+static inline int32_t tpdf_dither(uint32_t *state)
+{
+	uint32_t r = *state = DITHER_NEXT(*state);
+
+	return (int32_t)(r & 0xFFFF) - (int32_t)(r >> 16);
+}
+
+void audio_convert_s24_to_q15_ref(int16_t *dst, const uint8_t *src, size_t samples,
+				  uint32_t *dither)
+{
+	for (size_t i = 0; i < samples; i++, src += 3) {
+		int32_t s = (int32_t)(((uint32_t)src[0] << 8) | ((uint32_t)src[1] << 16) |
+				      ((uint32_t)src[2] << 24));
+		int32_t d = tpdf_dither(dither);
+
+		dst[i] = (int16_t)(sat_add32(s, d + Q15_ROUND) >> 16);
+	}
+}
+
+void audio_convert_s32_to_q15_ref(int16_t *dst, const int32_t *src, size_t samples)
+{
+	for (size_t i = 0; i < samples; i++) {
+		dst[i] = (int16_t)(sat_add32(src[i], Q15_ROUND) >> 16);
+	}
+}
+
+void audio_convert_f32_to_q15_ref(int16_t *dst, const float *src, size_t samples)
+{
+	// Same truncation and saturation as arm_float_to_q15 on a Cortex-M7 FPU
+	for (size_t i = 0; i < samples; i++) {
+		float x = src[i];
+
+		if (x >= 1.0f) {
+			dst[i] = INT16_MAX;
+		} else if (x <= -1.0f) {
+			dst[i] = INT16_MIN;
+		} else if (x != x) {
+			dst[i] = 0;
+		} else {
+			dst[i] = (int16_t)(int32_t)(x * 32768.0f);
+		}
+	}
+}
+
+void audio_convert_mono_to_stereo_ref(int16_t *buf, size_t frames)
+{
+	// Back to front so the expansion can run in place
+	for (size_t i = frames; i-- > 0;) {
+		int16_t s = buf[i];
+
+		buf[2 * i] = s;
+		buf[2 * i + 1] = s;
+	}
+}
+
+#if AUDIO_SIMD
+/*
+ * Four 24-bit samples are three words. Each sample is shifted into the top of a
+ * word, dithered and rounded with a saturating QADD, and two results are packed
+ * into one output word with PKHTB.
+ */
+void audio_convert_s24_to_q15(int16_t *dst, const uint8_t *src, size_t samples, uint32_t *dither)
+{
+	uint32_t *out = (uint32_t *)dst;
+	uint32_t state = *dither;
+	size_t quads = samples / 4;
+
+	for (size_t i = 0; i < quads; i++, src += 12) {
+		uint32_t w[3];
+
+		memcpy(w, src, sizeof(w));
+
+		int32_t s0 = (int32_t)(w[0] << 8);
+		int32_t s1 = (int32_t)(((w[0] >> 16) & 0xFF00) | (w[1] << 16));
+		int32_t s2 = (int32_t)(((w[1] >> 8) & 0xFFFF00) | (w[2] << 24));
+		int32_t s3 = (int32_t)(w[2] & 0xFFFFFF00);
+
+		s0 = __QADD(s0, tpdf_dither(&state) + Q15_ROUND);
+		s1 = __QADD(s1, tpdf_dither(&state) + Q15_ROUND);
+		s2 = __QADD(s2, tpdf_dither(&state) + Q15_ROUND);
+		s3 = __QADD(s3, tpdf_dither(&state) + Q15_ROUND);
+
+		*out++ = __PKHTB(s1, s0, 16);
+		*out++ = __PKHTB(s3, s2, 16);
+	}
+
+	audio_convert_s24_to_q15_ref((int16_t *)out, src, samples % 4, &state);
+	*dither = state;
+}
+
+void audio_convert_s32_to_q15(int16_t *dst, const int32_t *src, size_t samples)
+{
+	uint32_t *out = (uint32_t *)dst;
+	size_t pairs = samples / 2;
+
+	for (size_t i = 0; i < pairs; i++, src += 2) {
+		int32_t s0 = __QADD(src[0], Q15_ROUND);
+		int32_t s1 = __QADD(src[1], Q15_ROUND);
+
+		*out++ = __PKHTB(s1, s0, 16);
+	}
+
+	audio_convert_s32_to_q15_ref((int16_t *)out, src, samples % 2);
+}
+
+void audio_convert_mono_to_stereo(int16_t *buf, size_t frames)
+{
+	const uint32_t *in = (const uint32_t *)buf;
+	uint32_t *out = (uint32_t *)buf;
+	size_t pairs = frames / 2;
+
+	// The odd last frame sits past every pair, handle it first
+	if (frames & 1) {
+		uint32_t s = (uint16_t)buf[frames - 1];
+
+		out[frames - 1] = s | (s << 16);
+	}
+
+	for (size_t i = pairs; i-- > 0;) {
+		uint32_t w = in[i];
+
+		out[2 * i + 1] = __PKHTB(w, w, 16);
+		out[2 * i] = __PKHBT(w, w, 16);
+	}
+}
+#else
+void audio_convert_s24_to_q15(int16_t *dst, const uint8_t *src, size_t samples, uint32_t *dither)
+{
+	audio_convert_s24_to_q15_ref(dst, src, samples, dither);
+}
+
+void audio_convert_s32_to_q15(int16_t *dst, const int32_t *src, size_t samples)
+{
+	audio_convert_s32_to_q15_ref(dst, src, samples);
+}
+
+void audio_convert_mono_to_stereo(int16_t *buf, size_t frames)
+{
+	audio_convert_mono_to_stereo_ref(buf, frames);
+}
+#endif /* AUDIO_SIMD */
+
+void audio_convert_f32_to_q15(int16_t *dst, const float *src, size_t samples)
+{
+#ifdef CONFIG_CMSIS_DSP
+	arm_float_to_q15(src, dst, samples);
+#else
+	audio_convert_f32_to_q15_ref(dst, src, samples);
+#endif
+}
+
+int audio_convert_init(struct audio_convert *cv, const WavFormat *format)
+{
+	switch (format->audio_format) {
+	case WAVE_FORMAT_PCM:
+		if (format->bits_per_sample == 16) {
+			cv->kind = AUDIO_SAMPLE_S16;
+		} else if (format->bits_per_sample == 24) {
+			cv->kind = AUDIO_SAMPLE_S24;
+		} else if (format->bits_per_sample == 32) {
+			cv->kind = AUDIO_SAMPLE_S32;
+		} else {
+			return -ENOTSUP;
+		}
+		break;
+	case WAVE_FORMAT_IEEE_FLOAT:
+		if (format->bits_per_sample != 32) {
+			return -ENOTSUP;
+		}
+		cv->kind = AUDIO_SAMPLE_F32;
+		break;
+	default:
+		return -ENOTSUP;
+	}
+
+	if (format->num_channels != 1 && format->num_channels != AUDIO_OUT_CHANNELS) {
+		return -ENOTSUP;
+	}
+
+	cv->channels = format->num_channels;
+	cv->frame_bytes = format->block_align;
+	cv->dither = DITHER_SEED;
+
+	return 0;
+}
+
+size_t audio_convert_max_frames(const struct audio_convert *cv, size_t block_size)
+{
+	return block_size / MAX(cv->frame_bytes, AUDIO_OUT_FRAME_BYTES);
+}
+
+size_t audio_convert_block(struct audio_convert *cv, void *block, size_t frames)
+{
+	int16_t *out = block;
+	size_t samples = frames * cv->channels;
+
+	// Narrow to 16 bits front to back, the output never overtakes the input
+	switch (cv->kind) {
+	case AUDIO_SAMPLE_S16:
+		break;
+	case AUDIO_SAMPLE_S24:
+		audio_convert_s24_to_q15(out, block, samples, &cv->dither);
+		break;
+	case AUDIO_SAMPLE_S32:
+		audio_convert_s32_to_q15(out, block, samples);
+		break;
+	case AUDIO_SAMPLE_F32:
+		audio_convert_f32_to_q15(out, block, samples);
+		break;
+	}
+
+	if (cv->channels == 1) {
+		audio_convert_mono_to_stereo(out, frames);
+	}
+
+	return frames * AUDIO_OUT_FRAME_BYTES;
+}
@@ -0,0 +1,61 @@
+#ifndef AUDIO_CONVERT_H_
+#define AUDIO_CONVERT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wav_reader.h"
+
+/*
+ * Sample format conversion into the fixed 16-bit stereo I2S stream.
+ *
+ * Source frames are read to the start of an I2S block and converted in place,
+ * front to back for narrowing conversions and back to front for the mono upmix,
+ * so no second buffer is needed.
+ */
+
+#define AUDIO_OUT_CHANNELS    2
+#define AUDIO_OUT_FRAME_BYTES (AUDIO_OUT_CHANNELS * sizeof(int16_t))
+
+enum audio_sample_kind {
+	AUDIO_SAMPLE_S16,
+	AUDIO_SAMPLE_S24,
+	AUDIO_SAMPLE_S32,
+	AUDIO_SAMPLE_F32,
+};
+
+struct audio_convert {
+	enum audio_sample_kind kind;
+	uint8_t channels;
+	uint8_t frame_bytes;
+	uint32_t dither; // TPDF dither generator state, carried across blocks
+};
+
+int audio_convert_init(struct audio_convert *cv, const WavFormat *format);
+
+// Largest number of source frames that, read raw and converted, fit in block_size bytes
+size_t audio_convert_max_frames(const struct audio_convert *cv, size_t block_size);
+
+/*
+ * Convert frames source frames at the start of block into 16-bit stereo in place.
+ * Returns the number of output bytes.
+ */
+size_t audio_convert_block(struct audio_convert *cv, void *block, size_t frames);
+
+/*
+ * Kernels. dst may equal src for in-place conversion. The *_ref versions are the
+ * scalar reference the optimized versions must match bit for bit, which
+ * tests/convert checks.
+ */
+void audio_convert_s24_to_q15(int16_t *dst, const uint8_t *src, size_t samples, uint32_t *dither);
+void audio_convert_s32_to_q15(int16_t *dst, const int32_t *src, size_t samples);
+void audio_convert_f32_to_q15(int16_t *dst, const float *src, size_t samples);
+void audio_convert_mono_to_stereo(int16_t *buf, size_t frames);
+
+void audio_convert_s24_to_q15_ref(int16_t *dst, const uint8_t *src, size_t samples,
+				  uint32_t *dither);
+void audio_convert_s32_to_q15_ref(int16_t *dst, const int32_t *src, size_t samples);
+void audio_convert_f32_to_q15_ref(int16_t *dst, const float *src, size_t samples);
+void audio_convert_mono_to_stereo_ref(int16_t *buf, size_t frames);
+
+#endif /* AUDIO_CONVERT_H_ */
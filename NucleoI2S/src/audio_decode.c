@@ -0,0 +1,849 @@
+#include <errno.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/linker/section_tags.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "audio_decode.h"
+#include "audio_stats.h"
+
+/* ----- module registers ----- */
+LOG_MODULE_REGISTER(audio_decode, LOG_LEVEL_INF);
+
+/* ----- definitions ----- */
+#define BLOCK_SIZE     CONFIG_AUDIO_DECODE_BUFFER_SIZE
+#define FLAC_MAX_BLOCK CONFIG_AUDIO_FLAC_MAX_BLOCK_SIZE
+
+// Decoded FLAC frames and ADPCM blocks are only touched by the CPU, they may live in DTCM
+#if DT_NODE_HAS_STATUS(DT_CHOSEN(zephyr_dtcm), okay)
+#define __decode_pcm __dtcm_bss_section
+#else
+#define __decode_pcm
+#endif
+
+#define ADPCM_INDEX_MAX 88
+
+// Subframe types, the order is kept in the low bits
+#define FLAC_SUBFRAME_CONSTANT 0
+#define FLAC_SUBFRAME_VERBATIM 1
+#define FLAC_SUBFRAME_FIXED    8
+#define FLAC_SUBFRAME_LPC      32
+#define FLAC_MAX_FIXED_ORDER   4
+#define FLAC_MAX_LPC_ORDER     32
+
+// Stereo channel assignments, lower values code independent channels
+#define FLAC_LEFT_SIDE  8
+#define FLAC_SIDE_RIGHT 9
+#define FLAC_MID_SIDE   10
+
+/* ----- private static variables and types ----- */
+static int32_t __decode_pcm flac_pcm[2][FLAC_MAX_BLOCK];
+// An ADPCM block split between two read-ahead chunks is put back together here
+static uint8_t __decode_pcm adpcm_buf[BLOCK_SIZE];
+
+static const int16_t ima_step[ADPCM_INDEX_MAX + 1] = {
+	7,     8,     9,     10,    11,    12,    13,    14,    16,    17,    19,    21,    23,
+	25,    28,    31,    34,    37,    41,    45,    50,    55,    60,    66,    73,    80,
+	88,    97,    107,   118,   130,   143,   157,   173,   190,   209,   230,   253,   279,
+	307,   337,   371,   408,   449,   494,   544,   598,   658,   724,   796,   876,   963,
+	1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,  2272,  2499,  2749,  3024,  3327,
+	3660,  4026,  4428,  4871,  5358,  5894,  6484,  7132,  7845,  8630,  9493,  10442, 11487,
+	12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767,
+};
+
+static const int8_t ima_index[16] = {
+	-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8,
+};
+
+/* ----- private function declarations ----- */
+static int32_t decode_read(struct audio_decode *dec, const uint8_t **data, uint32_t size);
+static int adpcm_next_block(struct audio_decode *dec);
+static void adpcm_block(struct audio_decode *dec, const uint8_t *block, int16_t *out,
+			size_t count);
+static int adpcm_frames(struct audio_decode *dec, int16_t *out, size_t frames);
+static void bits_fill(struct audio_decode *dec);
+static inline uint32_t bits_get(struct audio_decode *dec, uint32_t n);
+static inline int32_t bits_get_signed(struct audio_decode *dec, uint32_t n);
+static inline uint32_t bits_unary(struct audio_decode *dec);
+static uint8_t flac_crc8(const uint8_t *data, size_t len);
+static int flac_residual(struct audio_decode *dec, int32_t *dst, uint32_t order,
+			 uint32_t block_size);
+static void flac_fixed(int32_t *s, uint32_t order, uint32_t n);
+static void flac_lpc(int32_t *s, const int32_t *coefs, uint32_t order, uint32_t shift, uint32_t n,
+		     bool wide);
+static int flac_subframe(struct audio_decode *dec, int32_t *dst, uint32_t bps,
+			 uint32_t block_size);
+static void flac_decorrelate(uint32_t assign, uint32_t n);
+static int flac_frame(struct audio_decode *dec);
+static void flac_output(const struct audio_decode_flac *fl, int16_t *out, uint32_t channels,
+			size_t count);
+static int flac_frames(struct audio_decode *dec, int16_t *out, size_t frames);
+
+/* ----- function definitions ----- */
+static int32_t decode_read(struct audio_decode *dec, const uint8_t **data, uint32_t size)
+{
+	uint32_t start = audio_stats_now();
+	int32_t ret;
+
+	// The data is decoded where the read-ahead put it, only refills cost time here
+	ret = wav_read_staged(dec->wav, data, size);
+
+	dec->read_cycles += audio_stats_now() - start;
+	if (ret < 0) {
+		LOG_ERR("Failed to read data: %d", ret);
+		audio_stats_event(AUDIO_EVENT_READ_ERROR);
+	}
+
+	return ret;
+}
+
+/*
+ * Point dec->adpcm.data at the next block. Encoders end the stream with a block
+ * cut after its last word group, which is decoded as far as it goes. Returns the
+ * frames in the block, 0 at the end of the data.
+ */
+static int adpcm_next_block(struct audio_decode *dec)
+{
+	struct audio_decode_adpcm *st = &dec->adpcm;
+	const uint32_t header = 4 * dec->channels;
+	const uint8_t *data;
+	uint32_t len;
+	int32_t n;
+
+	n = decode_read(dec, &data, dec->block_align);
+	if (n <= 0) {
+		return n;
+	}
+	len = n;
+
+	if (len < dec->block_align) {
+		// The read-ahead chunk ends inside the block, or the data does
+		memcpy(adpcm_buf, data, len);
+		while (len < dec->block_align) {
+			n = decode_read(dec, &data, dec->block_align - len);
+			if (n < 0) {
+				return n;
+			} else if (n == 0) {
+				break;
+			}
+			memcpy(&adpcm_buf[len], data, n);
+			len += n;
+		}
+		data = adpcm_buf;
+	}
+
+	st->data = data;
+	st->frame = 0;
+	if (len == dec->block_align) {
+		st->frames = dec->samples_per_block;
+	} else if (len >= header) {
+		st->frames = 1 + (len - header) / header * 8;
+	} else {
+		st->frames = 0;
+	}
+
+	return st->frames;
+}
+
+/*
+ * Decode count frames of one ADPCM block, starting at dec->adpcm.frame. After a
+ * 4-byte header per channel the samples come in 4-byte words of 8, alternating
+ * between the channels, low nibble first.
+ */
+static void adpcm_block(struct audio_decode *dec, const uint8_t *block, int16_t *out,
+			size_t count)
+{
+	struct audio_decode_adpcm *st = &dec->adpcm;
+	const uint32_t ch = dec->channels;
+
+	for (uint32_t c = 0; c < ch; c++) {
+		const uint8_t *data = block + 4 * ch + 4 * c;
+		int32_t pred = st->pred[c];
+		int32_t index = st->index[c];
+		int16_t *o = out + c;
+		uint32_t i = st->frame;
+		const uint32_t end = st->frame + count;
+
+		if (i == 0) {
+			// The header holds the first sample verbatim
+			pred = (int16_t)sys_get_le16(&block[4 * c]);
+			index = MIN(block[4 * c + 2], ADPCM_INDEX_MAX);
+			*o = pred;
+			o += ch;
+			i++;
+		}
+
+		for (; i < end; i++) {
+			uint32_t j = i - 1;
+			uint8_t byte = data[(j >> 3) * 4 * ch + ((j & 7) >> 1)];
+			uint8_t nib = (j & 1) ? (byte >> 4) : (byte & 0x0f);
+			int32_t step = ima_step[index];
+			int32_t diff = step >> 3;
+
+			if (nib & 4) {
+				diff += step;
+			}
+			if (nib & 2) {
+				diff += step >> 1;
+			}
+			if (nib & 1) {
+				diff += step >> 2;
+			}
+			pred = (nib & 8) ? pred - diff : pred + diff;
+			pred = CLAMP(pred, INT16_MIN, INT16_MAX);
+			index = CLAMP(index + ima_index[nib], 0, ADPCM_INDEX_MAX);
+
+			*o = pred;
+			o += ch;
+		}
+
+		st->pred[c] = pred;
+		st->index[c] = index;
+	}
+}
+
+static int adpcm_frames(struct audio_decode *dec, int16_t *out, size_t frames)
+{
+	struct audio_decode_adpcm *st = &dec->adpcm;
+	size_t done = 0;
+
+	while (done < frames) {
+		size_t count;
+
+		if (st->frame == st->frames) {
+			int ret = adpcm_next_block(dec);
+
+			if (ret < 0) {
+				return done > 0 ? done : ret;
+			} else if (ret == 0) {
+				break;
+			}
+		}
+
+		if (st->skip > 0) {
+			// Frames before a seek target still advance the predictor
+			count = MIN(MIN(frames - done, st->skip), st->frames - st->frame);
+			adpcm_block(dec, st->data, out + done * dec->channels, count);
+			st->frame += count;
+			st->skip -= count;
+			continue;
+		}
+
+		count = MIN(frames - done, st->frames - st->frame);
+		adpcm_block(dec, st->data, out + done * dec->channels, count);
+		st->frame += count;
+		done += count;
+	}
+
+	return done;
+}
+
+// Top up the bit cache from the staged data, taking the next chunk when it runs out
+static void bits_fill(struct audio_decode *dec)
+{
+	struct audio_decode_bits *br = &dec->flac.bits;
+
+	while (br->count <= 56) {
+		if (br->pos == br->len) {
+			// Everything that is staged
+			int32_t n = decode_read(dec, &br->data, UINT32_MAX);
+
+			if (n <= 0) {
+				return;
+			}
+			br->pos = 0;
+			br->len = n;
+		}
+
+		if (br->count <= 32 && br->len - br->pos >= 4) {
+			br->cache |= (uint64_t)sys_get_be32(&br->data[br->pos]) << (32 - br->count);
+			br->pos += 4;
+			br->count += 32;
+		} else {
+			br->cache |= (uint64_t)br->data[br->pos++] << (56 - br->count);
+			br->count += 8;
+		}
+	}
+}
+
+// Take n <= 32 bits, past the end of the data this returns 0 and sets the error flag
+static inline uint32_t bits_get(struct audio_decode *dec, uint32_t n)
+{
+	struct audio_decode_bits *br = &dec->flac.bits;
+	uint32_t v;
+
+	if (n == 0) {
+		return 0;
+	}
+
+	if (br->count < n) {
+		bits_fill(dec);
+		if (br->count < n) {
+			br->error = true;
+			br->cache = 0;
+			br->count = 0;
+			return 0;
+		}
+	}
+
+	v = br->cache >> (64 - n);
+	br->cache <<= n;
+	br->count -= n;
+
+	return v;
+}
+
+static inline int32_t bits_get_signed(struct audio_decode *dec, uint32_t n)
+{
+	if (n == 0) {
+		return 0;
+	}
+
+	return (int32_t)(bits_get(dec, n) << (32 - n)) >> (32 - n);
+}
+
+// Count zero bits up to and including the next one bit
+static inline uint32_t bits_unary(struct audio_decode *dec)
+{
+	struct audio_decode_bits *br = &dec->flac.bits;
+	uint32_t q = 0;
+
+	for (;;) {
+		// Bits past count are always zero, so a non-zero cache holds the end
+		if (br->cache != 0) {
+			uint32_t lz = __builtin_clzll(br->cache);
+
+			br->cache = (br->cache << lz) << 1;
+			br->count -= lz + 1;
+
+			return q + lz;
+		}
+
+		q += br->count;
+		br->count = 0;
+		bits_fill(dec);
+		if (br->count == 0) {
+			br->error = true;
+			return 0;
+		}
+	}
+}
+
+static uint8_t flac_crc8(const uint8_t *data, size_t len)
+{
+	uint8_t crc = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		crc ^= data[i];
+		for (int b = 0; b < 8; b++) {
+			crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+		}
+	}
+
+	return crc;
+}
+
+// Rice coded residual, written after the order warm-up samples
+static int flac_residual(struct audio_decode *dec, int32_t *dst, uint32_t order,
+			 uint32_t block_size)
+{
+	uint32_t method = bits_get(dec, 2);
+	uint32_t partition_order = bits_get(dec, 4);
+	uint32_t param_bits = method == 0 ? 4 : 5;
+	uint32_t escape = BIT(param_bits) - 1;
+	uint32_t partitions = BIT(partition_order);
+	uint32_t psize = block_size >> partition_order;
+	uint32_t i = order;
+
+	if (method > 1 || (block_size & (partitions - 1)) != 0 || psize < order) {
+		return -EBADMSG;
+	}
+
+	for (uint32_t p = 0; p < partitions; p++) {
+		uint32_t k = bits_get(dec, param_bits);
+		uint32_t end = (p + 1) * psize;
+
+		if (k == escape) {
+			// Unencoded partition
+			uint32_t nbits = bits_get(dec, 5);
+
+			for (; i < end; i++) {
+				dst[i] = bits_get_signed(dec, nbits);
+			}
+		} else {
+			for (; i < end; i++) {
+				uint32_t q = bits_unary(dec);
+				uint32_t u = (q << k) | bits_get(dec, k);
+
+				dst[i] = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+			}
+		}
+
+		if (dec->flac.bits.error) {
+			return -ENODATA;
+		}
+	}
+
+	return 0;
+}
+
+static void flac_fixed(int32_t *s, uint32_t order, uint32_t n)
+{
+	switch (order) {
+	case 1:
+		for (uint32_t i = 1; i < n; i++) {
+			s[i] += s[i - 1];
+		}
+		break;
+	case 2:
+		for (uint32_t i = 2; i < n; i++) {
+			s[i] += 2 * s[i - 1] - s[i - 2];
+		}
+		break;
+	case 3:
+		for (uint32_t i = 3; i < n; i++) {
+			s[i] += 3 * (s[i - 1] - s[i - 2]) + s[i - 3];
+		}
+		break;
+	case 4:
+		for (uint32_t i = 4; i < n; i++) {
+			s[i] += 4 * (s[i - 1] + s[i - 3]) - 6 * s[i - 2] - s[i - 4];
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+// coefs[0] weighs the most recent sample
+static void flac_lpc(int32_t *s, const int32_t *coefs, uint32_t order, uint32_t shift, uint32_t n,
+		     bool wide)
+{
+	if (wide) {
+		for (uint32_t i = order; i < n; i++) {
+			int64_t acc = 0;
+
+			for (uint32_t j = 0; j < order; j++) {
+				acc += (int64_t)coefs[j] * s[i - 1 - j];
+			}
+			s[i] += (int32_t)(acc >> shift);
+		}
+	} else {
+		for (uint32_t i = order; i < n; i++) {
+			int32_t acc = 0;
+
+			for (uint32_t j = 0; j < order; j++) {
+				acc += coefs[j] * s[i - 1 - j];
+			}
+			s[i] += acc >> shift;
+		}
+	}
+}
+
+static int flac_subframe(struct audio_decode *dec, int32_t *dst, uint32_t bps,
+			 uint32_t block_size)
+{
+	uint32_t hdr = bits_get(dec, 8);
+	uint32_t type = (hdr >> 1) & 0x3f;
+	uint32_t wasted = 0;
+	uint32_t order;
+	int ret = 0;
+
+	if (hdr & 0x80) {
+		return -EBADMSG;
+	}
+
+	if (hdr & 0x01) {
+		// Low bits that are zero in every sample are left out
+		wasted = bits_unary(dec) + 1;
+		if (wasted >= bps) {
+			return -EBADMSG;
+		}
+		bps -= wasted;
+	}
+
+	if (type == FLAC_SUBFRAME_CONSTANT) {
+		int32_t v = bits_get_signed(dec, bps);
+
+		for (uint32_t i = 0; i < block_size; i++) {
+			dst[i] = v;
+		}
+	} else if (type == FLAC_SUBFRAME_VERBATIM) {
+		for (uint32_t i = 0; i < block_size; i++) {
+			dst[i] = bits_get_signed(dec, bps);
+		}
+	} else if (type >= FLAC_SUBFRAME_FIXED &&
+		   type <= FLAC_SUBFRAME_FIXED + FLAC_MAX_FIXED_ORDER) {
+		order = type - FLAC_SUBFRAME_FIXED;
+		if (order > block_size) {
+			return -EBADMSG;
+		}
+
+		for (uint32_t i = 0; i < order; i++) {
+			dst[i] = bits_get_signed(dec, bps);
+		}
+		ret = flac_residual(dec, dst, order, block_size);
+		if (ret == 0) {
+			flac_fixed(dst, order, block_size);
+		}
+	} else if (type >= FLAC_SUBFRAME_LPC) {
+		int32_t coefs[FLAC_MAX_LPC_ORDER];
+		uint32_t precision;
+		int32_t shift;
+
+		order = type - FLAC_SUBFRAME_LPC + 1;
+		if (order > block_size) {
+			return -EBADMSG;
+		}
+
+		for (uint32_t i = 0; i < order; i++) {
+			dst[i] = bits_get_signed(dec, bps);
+		}
+		precision = bits_get(dec, 4) + 1;
+		shift = bits_get_signed(dec, 5);
+		if (precision == 16 || shift < 0) {
+			return -EBADMSG;
+		}
+		for (uint32_t i = 0; i < order; i++) {
+			coefs[i] = bits_get_signed(dec, precision);
+		}
+
+		ret = flac_residual(dec, dst, order, block_size);
+		if (ret == 0) {
+			// A 32-bit sum is enough for 16-bit sources with the usual precision
+			bool wide = bps + precision + (32 - __builtin_clz(order)) > 32;
+
+			flac_lpc(dst, coefs, order, shift, block_size, wide);
+		}
+	} else {
+		return -EBADMSG;
+	}
+
+	if (ret < 0) {
+		return ret;
+	}
+	if (dec->flac.bits.error) {
+		return -ENODATA;
+	}
+
+	if (wasted > 0) {
+		for (uint32_t i = 0; i < block_size; i++) {
+			dst[i] = (int32_t)((uint32_t)dst[i] << wasted);
+		}
+	}
+
+	return 0;
+}
+
+static void flac_decorrelate(uint32_t assign, uint32_t n)
+{
+	int32_t *a = flac_pcm[0];
+	int32_t *b = flac_pcm[1];
+
+	switch (assign) {
+	case FLAC_LEFT_SIDE:
+		for (uint32_t i = 0; i < n; i++) {
+			b[i] = a[i] - b[i];
+		}
+		break;
+	case FLAC_SIDE_RIGHT:
+		for (uint32_t i = 0; i < n; i++) {
+			a[i] += b[i];
+		}
+		break;
+	case FLAC_MID_SIDE:
+		for (uint32_t i = 0; i < n; i++) {
+			int32_t side = b[i];
+			int32_t mid = (int32_t)((uint32_t)a[i] << 1) | (side & 1);
+
+			a[i] = (mid + side) >> 1;
+			b[i] = (mid - side) >> 1;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Decode the next frame into flac_pcm. Returns -EBADMSG for a frame that does not
+ * parse, the next call then searches for the following sync code, and -ENODATA
+ * at the end of the data.
+ */
+static int flac_frame(struct audio_decode *dec)
+{
+	struct audio_decode_flac *fl = &dec->flac;
+	uint8_t hdr[16];
+	size_t n = 0;
+	uint32_t sync = 0;
+	uint32_t block_size;
+	uint32_t bps;
+	uint32_t assign;
+	uint32_t channels;
+	uint32_t code;
+	uint32_t extra;
+	int ret;
+
+	// Frames start on a byte boundary with a 14-bit sync code and a zero bit
+	bits_get(dec, fl->bits.count & 7);
+	do {
+		sync = ((sync << 8) | bits_get(dec, 8)) & 0xffff;
+		if (fl->bits.error) {
+			return -ENODATA;
+		}
+	} while ((sync & 0xfffe) != 0xfff8);
+
+	hdr[n++] = sync >> 8;
+	hdr[n++] = sync & 0xff;
+	hdr[n++] = bits_get(dec, 8); // block size and sample rate codes
+	hdr[n++] = bits_get(dec, 8); // channel assignment and sample size codes
+
+	// Frame or sample number in UTF-8 style, only skipped
+	hdr[n] = bits_get(dec, 8);
+	extra = hdr[n] < 0x80 ? 0 : __builtin_clz(~((uint32_t)hdr[n] << 24)) - 1;
+	n++;
+	if (extra == 0 && hdr[n - 1] >= 0x80) {
+		return -EBADMSG;
+	} else if (extra > 6) {
+		return -EBADMSG;
+	}
+	for (uint32_t i = 0; i < extra; i++) {
+		hdr[n++] = bits_get(dec, 8);
+	}
+
+	code = hdr[2] >> 4;
+	if (code == 6) {
+		hdr[n++] = bits_get(dec, 8);
+		block_size = hdr[n - 1] + 1;
+	} else if (code == 7) {
+		hdr[n++] = bits_get(dec, 8);
+		hdr[n++] = bits_get(dec, 8);
+		block_size = sys_get_be16(&hdr[n - 2]) + 1;
+	} else if (code == 1) {
+		block_size = 192;
+	} else if (code >= 2 && code <= 5) {
+		block_size = 576U << (code - 2);
+	} else if (code >= 8) {
+		block_size = 256U << (code - 8);
+	} else {
+		return -EBADMSG;
+	}
+
+	// The sample rate always comes from STREAMINFO, skip any explicit one
+	code = hdr[2] & 0x0f;
+	if (code == 12) {
+		hdr[n++] = bits_get(dec, 8);
+	} else if (code == 13 || code == 14) {
+		hdr[n++] = bits_get(dec, 8);
+		hdr[n++] = bits_get(dec, 8);
+	} else if (code == 15) {
+		return -EBADMSG;
+	}
+
+	if (bits_get(dec, 8) != flac_crc8(hdr, n)) {
+		return fl->bits.error ? -ENODATA : -EBADMSG;
+	}
+
+	static const uint8_t sample_sizes[8] = {0, 8, 12, 0, 16, 20, 24, 0};
+
+	code = (hdr[3] >> 1) & 0x07;
+	bps = code == 0 ? dec->bits_per_sample : sample_sizes[code];
+	assign = hdr[3] >> 4;
+	channels = assign < FLAC_LEFT_SIDE ? assign + 1 : 2;
+	if (bps == 0 || assign > FLAC_MID_SIDE || channels != dec->channels) {
+		return -EBADMSG;
+	}
+
+	if (block_size > FLAC_MAX_BLOCK) {
+		LOG_ERR("FLAC block of %u frames, at most %u are supported", block_size,
+			FLAC_MAX_BLOCK);
+		return -ENOTSUP;
+	}
+
+	for (uint32_t c = 0; c < channels; c++) {
+		// The side channel needs one bit more than the others
+		bool side = (assign == FLAC_SIDE_RIGHT && c == 0) ||
+			    ((assign == FLAC_LEFT_SIDE || assign == FLAC_MID_SIDE) && c == 1);
+
+		ret = flac_subframe(dec, flac_pcm[c], bps + side, block_size);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+
+	flac_decorrelate(assign, block_size);
+
+	// Pad to a byte and the frame's CRC-16, which is not checked. The header CRC-8
+	// already rejects a false sync.
+	bits_get(dec, fl->bits.count & 7);
+	bits_get(dec, 16);
+	if (fl->bits.error) {
+		return -ENODATA;
+	}
+
+	fl->block_size = block_size;
+	fl->frame = 0;
+	fl->bps = bps;
+
+	return 0;
+}
+
+static void flac_output(const struct audio_decode_flac *fl, int16_t *out, uint32_t channels,
+			size_t count)
+{
+	const int shift = fl->bps - 16;
+
+	for (uint32_t c = 0; c < channels; c++) {
+		const int32_t *src = &flac_pcm[c][fl->frame];
+		int16_t *o = out + c;
+
+		if (shift == 0) {
+			for (size_t i = 0; i < count; i++) {
+				o[i * channels] = src[i];
+			}
+		} else if (shift > 0) {
+			// Round to nearest, the largest samples would round past full scale
+			const int32_t round = 1 << (shift - 1);
+
+			for (size_t i = 0; i < count; i++) {
+				int32_t v = (src[i] + round) >> shift;
+
+				o[i * channels] = MIN(v, INT16_MAX);
+			}
+		} else {
+			for (size_t i = 0; i < count; i++) {
+				o[i * channels] = (int16_t)((uint32_t)src[i] << -shift);
+			}
+		}
+	}
+}
+
+static int flac_frames(struct audio_decode *dec, int16_t *out, size_t frames)
+{
+	struct audio_decode_flac *fl = &dec->flac;
+	size_t done = 0;
+
+	while (done < frames) {
+		size_t count;
+
+		if (fl->frame == fl->block_size) {
+			int ret = flac_frame(dec);
+
+			if (ret == -EBADMSG) {
+				// Corrupt frame, resynchronize on the next one
+				audio_stats_event(AUDIO_EVENT_READ_ERROR);
+				fl->frame = fl->block_size = 0;
+				continue;
+			} else if (ret < 0) {
+				fl->frame = fl->block_size = 0;
+				if (done > 0) {
+					break;
+				}
+				return ret == -ENODATA ? 0 : ret;
+			}
+		}
+
+		count = MIN(frames - done, fl->block_size - fl->frame);
+		flac_output(fl, out + done * dec->channels, dec->channels, count);
+		fl->frame += count;
+		done += count;
+	}
+
+	return done;
+}
+
+bool audio_decode_needed(const WavFormat *format)
+{
+	return format->audio_format == WAVE_FORMAT_IMA_ADPCM ||
+	       format->audio_format == WAVE_FORMAT_FLAC;
+}
+
+int audio_decode_init(struct audio_decode *dec, const WavFormat *format)
+{
+	memset(dec, 0, sizeof(*dec));
+	dec->format = format->audio_format;
+	dec->channels = format->num_channels;
+	dec->block_align = format->block_align;
+	dec->samples_per_block = format->samples_per_block;
+	dec->bits_per_sample = format->bits_per_sample;
+
+	switch (format->audio_format) {
+	case WAVE_FORMAT_IMA_ADPCM:
+		if (format->block_align > BLOCK_SIZE) {
+			LOG_ERR("ADPCM blocks of %u bytes do not fit the %u byte block buffer",
+				format->block_align, BLOCK_SIZE);
+			return -ENOTSUP;
+		}
+		break;
+	case WAVE_FORMAT_FLAC:
+		if (format->samples_per_block > FLAC_MAX_BLOCK) {
+			LOG_ERR("FLAC blocks of up to %u frames, at most %u are supported",
+				format->samples_per_block, FLAC_MAX_BLOCK);
+			return -ENOTSUP;
+		}
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+int audio_decode_frames(struct audio_decode *dec, WavFile *wav, int16_t *out, size_t frames)
+{
+	uint32_t start = audio_stats_now();
+	enum audio_stage stage;
+	int ret;
+
+	dec->wav = wav;
+	dec->read_cycles = 0;
+
+	if (dec->format == WAVE_FORMAT_IMA_ADPCM) {
+		stage = AUDIO_STAGE_DECODE_ADPCM;
+		ret = adpcm_frames(dec, out, frames);
+	} else {
+		stage = AUDIO_STAGE_DECODE_FLAC;
+		ret = flac_frames(dec, out, frames);
+	}
+
+	// Waiting for the card is accounted to fs_read only
+	audio_stats_stage(stage, start + dec->read_cycles);
+	dec->wav = NULL;
+
+	return ret;
+}
+
+int audio_decode_seek(struct audio_decode *dec, WavFile *wav, uint32_t frame)
+{
+	struct audio_decode_adpcm *st = &dec->adpcm;
+	uint32_t block = frame / dec->samples_per_block;
+	int ret;
+
+	if (dec->format != WAVE_FORMAT_IMA_ADPCM) {
+		return -ENOTSUP;
+	}
+
+	ret = wav_seek(wav, MIN((uint64_t)block * dec->block_align, UINT32_MAX));
+	if (ret < 0) {
+		return ret;
+	}
+
+	st->frames = 0;
+	st->frame = 0;
+	st->skip = frame % dec->samples_per_block;
+
+	return 0;
+}
+
+size_t audio_decode_bytes(const struct audio_decode *dec, size_t frames)
+{
+	if (dec->format == WAVE_FORMAT_IMA_ADPCM) {
+		return DIV_ROUND_UP(frames, dec->samples_per_block) * dec->block_align;
+	}
+
+	// Verbatim subframes, plus a frame header's worth of slack
+	return frames * dec->channels * DIV_ROUND_UP(dec->bits_per_sample, 8) + 16;
+}
@@ -0,0 +1,83 @@
+#ifndef AUDIO_DECODE_H_
+#define AUDIO_DECODE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wav_reader.h"
+
+/*
+ * Streaming decoders for compressed tracks, IMA ADPCM in WAV and native FLAC.
+ *
+ * Encoded bytes are decoded in place from the track's read-ahead buffer (see
+ * wav_set_read_buffer), straight into the I2S block as 16-bit samples with the
+ * source's channel count. FLAC keeps one decoded frame in a separate buffer, since
+ * a frame is usually longer than a block. Each codec's cost per block is reported
+ * as its own stage by 'audio stats'.
+ *
+ * One track is decoded at a time, the buffers are shared.
+ */
+
+struct audio_decode_adpcm {
+	int32_t pred[2];
+	int32_t index[2];
+	const uint8_t *data; // block being decoded
+	uint32_t frames;     // frames in that block, fewer in a short last block
+	uint32_t frame;      // next frame in that block
+	uint32_t skip;       // frames to decode and drop after a seek
+};
+
+struct audio_decode_bits {
+	uint64_t cache;      // next bits of the stream, MSB first
+	uint32_t count;      // valid bits in cache
+	const uint8_t *data; // staged bytes being read
+	uint32_t pos;        // next byte in data
+	uint32_t len;        // bytes in data
+	bool error;          // read past the end of the data
+};
+
+struct audio_decode_flac {
+	struct audio_decode_bits bits;
+	uint32_t block_size; // frames in the decoded frame
+	uint32_t frame;      // next frame to output
+	uint8_t bps;         // bits per sample of the decoded frame
+};
+
+struct audio_decode {
+	uint16_t format;
+	uint8_t channels;
+	uint16_t block_align;
+	uint16_t samples_per_block;
+	uint8_t bits_per_sample;
+	WavFile *wav;         // track being read, valid during audio_decode_frames
+	uint32_t read_cycles; // spent in fs_read during the current call
+	union {
+		struct audio_decode_adpcm adpcm;
+		struct audio_decode_flac flac;
+	};
+};
+
+// True for formats that go through a decoder instead of audio_convert
+bool audio_decode_needed(const WavFormat *format);
+
+int audio_decode_init(struct audio_decode *dec, const WavFormat *format);
+
+/*
+ * Decode up to frames frames of wav into out, as 16-bit samples with dec->channels
+ * channels. wav needs a read buffer set with wav_set_read_buffer. Returns the
+ * number of frames, 0 at the end of the track or a negative errno when the stream
+ * cannot be decoded any further.
+ */
+int audio_decode_frames(struct audio_decode *dec, WavFile *wav, int16_t *out, size_t frames);
+
+/*
+ * Continue decoding wav at frame. IMA ADPCM restarts at the block holding frame
+ * and drops the frames before it. FLAC streams cannot seek, -ENOTSUP.
+ */
+int audio_decode_seek(struct audio_decode *dec, WavFile *wav, uint32_t frame);
+
+// Upper bound of the encoded bytes behind frames frames
+size_t audio_decode_bytes(const struct audio_decode *dec, size_t frames);
+
+#endif /* AUDIO_DECODE_H_ */
@@ -0,0 +1,673 @@
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/linker/section_tags.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/barrier.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+
+#include "audio_dsp.h"
+#include "audio_convert.h"
+#include "audio_latency.h"
+#include "audio_stats.h"
+
+#ifdef CONFIG_CMSIS_DSP
+#include <arm_math.h>
+#endif
+
+/* ----- module registers ----- */
+LOG_MODULE_REGISTER(audio_dsp, LOG_LEVEL_INF);
+
+/* ----- definitions ----- */
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define BANDS     AUDIO_DSP_BANDS
+#define LOOKAHEAD CONFIG_AUDIO_LIMITER_LOOKAHEAD
+
+// The limiter gain of a sample is taken over the look-ahead and the sample itself
+#define WINDOW     (LOOKAHEAD + 1)
+#define AVG_SCALE  ((uint32_t)(BIT64(32) / WINDOW))
+#define GAIN_UNITY (1 << 30) // limiter gain, Q30
+// Float division may land a few Q30 steps above the exact gain a peak needs
+#define GAIN_MARGIN (GAIN_UNITY >> 22)
+
+// Frames converted to Q31 at a time
+#define CHUNK_FRAMES 64
+
+// Q15 samples enter the chain as Q31 below the headroom
+#define IN_SHIFT (16 - AUDIO_DSP_HEADROOM_BITS)
+
+// Coefficients are Q(31 - POST_SHIFT), so shelves and peaks may reach 8
+#define POST_SHIFT 3
+
+#define MIN_FREQ    10
+#define MAX_GAIN    120 // 0.1 dB
+#define MIN_Q       10  // 0.01
+#define MAX_Q       2000
+#define MAX_RELEASE 5000 // ms
+
+// The chain only runs on the CPU, so its buffers may live in DTCM
+#if DT_NODE_HAS_STATUS(DT_CHOSEN(zephyr_dtcm), okay)
+#define __dsp_data __dtcm_bss_section
+#else
+#define __dsp_data
+#endif
+
+BUILD_ASSERT(AUDIO_OUT_CHANNELS == 2, "The DSP chain works on stereo frames");
+
+/* ----- private static variables and types ----- */
+struct dsp_settings {
+	int32_t coefs[BANDS][5]; // b0, b1, b2, -a1, -a2 in the CMSIS-DSP order
+	uint8_t stages;          // bands up to the last enabled one, the rest are bypassed
+	bool limiter;
+	int32_t threshold;    // peak level in the internal Q31 scale
+	int32_t release_step; // Q30 gain recovered per frame
+};
+
+struct dsp_limiter {
+	int32_t delay[AUDIO_OUT_CHANNELS][LOOKAHEAD];
+	uint32_t pos; // oldest frame of the delay, written next
+	uint32_t time;
+
+	// Sliding minimum of the gain each frame needs, as a monotonic queue
+	int32_t min_gain[WINDOW];
+	uint32_t min_time[WINDOW];
+	uint32_t min_head;
+	uint32_t min_count;
+
+	// Released gains of the window, their mean is applied
+	int32_t held[WINDOW];
+	uint32_t held_pos;
+	int32_t last;
+	uint64_t sum;
+};
+
+/*
+ * Settings published by the controls. dsp_seq is odd while they are written, the
+ * audio thread only takes a copy that was read between the same even values.
+ */
+static struct dsp_settings dsp_shared;
+static atomic_t dsp_seq;
+
+// Owned by the controls, under dsp_lock
+static K_MUTEX_DEFINE(dsp_lock);
+static struct dsp_settings dsp_next;
+static struct audio_dsp_band dsp_bands[BANDS];
+static int16_t dsp_threshold = -10;
+static uint32_t dsp_release_ms = 50;
+static uint32_t dsp_rate;
+
+// Owned by the audio thread
+static struct dsp_settings dsp_live;
+static struct dsp_settings dsp_taken;
+static atomic_val_t dsp_seen;
+static int32_t __dsp_data biquad_state[AUDIO_OUT_CHANNELS][BANDS * 4];
+static int32_t __dsp_data work[AUDIO_OUT_CHANNELS][CHUNK_FRAMES];
+static struct dsp_limiter __dsp_data limiter;
+
+static const char *const filter_names[] = {
+	[AUDIO_DSP_OFF] = "off",
+	[AUDIO_DSP_PEAK] = "peak",
+	[AUDIO_DSP_LOWSHELF] = "lowshelf",
+	[AUDIO_DSP_HIGHSHELF] = "highshelf",
+	[AUDIO_DSP_HIGHPASS] = "hp",
+	[AUDIO_DSP_LOWPASS] = "lp",
+};
+
+/* ----- private function declarations ----- */
+static int dsp_design(const struct audio_dsp_band *p, int32_t coefs[5]);
+static void dsp_publish(void);
+static void dsp_adopt(void);
+static void dsp_biquad(int32_t *state, uint8_t stages, int32_t *buf, size_t frames);
+static void dsp_limiter_reset(void);
+static void dsp_limiter_run(size_t frames);
+
+/* ----- function definitions ----- */
+
+// RBJ cookbook biquad for p, normalized and quantized for the DF1 cascade
+static int dsp_design(const struct audio_dsp_band *p, int32_t coefs[5])
+{
+	const double w0 = 2.0 * M_PI * p->freq / dsp_rate;
+	const double cw = cos(w0);
+	const double alpha = sin(w0) / (2.0 * p->q / 100.0);
+	const double A = pow(10.0, p->gain / 400.0);
+	const double sa = 2.0 * sqrt(A) * alpha;
+	double b[3];
+	double a[3];
+
+	switch (p->type) {
+	case AUDIO_DSP_PEAK:
+		b[0] = 1.0 + alpha * A;
+		b[1] = -2.0 * cw;
+		b[2] = 1.0 - alpha * A;
+		a[0] = 1.0 + alpha / A;
+		a[1] = -2.0 * cw;
+		a[2] = 1.0 - alpha / A;
+		break;
+	case AUDIO_DSP_LOWSHELF:
+		b[0] = A * ((A + 1.0) - (A - 1.0) * cw + sa);
+		b[1] = 2.0 * A * ((A - 1.0) - (A + 1.0) * cw);
+		b[2] = A * ((A + 1.0) - (A - 1.0) * cw - sa);
+		a[0] = (A + 1.0) + (A - 1.0) * cw + sa;
+		a[1] = -2.0 * ((A - 1.0) + (A + 1.0) * cw);
+		a[2] = (A + 1.0) + (A - 1.0) * cw - sa;
+		break;
+	case AUDIO_DSP_HIGHSHELF:
+		b[0] = A * ((A + 1.0) + (A - 1.0) * cw + sa);
+		b[1] = -2.0 * A * ((A - 1.0) + (A + 1.0) * cw);
+		b[2] = A * ((A + 1.0) + (A - 1.0) * cw - sa);
+		a[0] = (A + 1.0) - (A - 1.0) * cw + sa;
+		a[1] = 2.0 * ((A - 1.0) - (A + 1.0) * cw);
+		a[2] = (A + 1.0) - (A - 1.0) * cw - sa;
+		break;
+	case AUDIO_DSP_HIGHPASS:
+		b[0] = (1.0 + cw) / 2.0;
+		b[1] = -(1.0 + cw);
+		b[2] = b[0];
+		a[0] = 1.0 + alpha;
+		a[1] = -2.0 * cw;
+		a[2] = 1.0 - alpha;
+		break;
+	case AUDIO_DSP_LOWPASS:
+		b[0] = (1.0 - cw) / 2.0;
+		b[1] = 1.0 - cw;
+		b[2] = b[0];
+		a[0] = 1.0 + alpha;
+		a[1] = -2.0 * cw;
+		a[2] = 1.0 - alpha;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	const double c[5] = {b[0] / a[0], b[1] / a[0], b[2] / a[0], -a[1] / a[0], -a[2] / a[0]};
+
+	for (int i = 0; i < 5; i++) {
+		double q = round(c[i] * (double)BIT(31 - POST_SHIFT));
+
+		coefs[i] = (int32_t)CLAMP(q, INT32_MIN, INT32_MAX);
+	}
+
+	return 0;
+}
+
+// Copy dsp_next to the audio thread, with dsp_lock held
+static void dsp_publish(void)
+{
+	dsp_next.stages = 0;
+	for (int i = 0; i < BANDS; i++) {
+		if (dsp_bands[i].type != AUDIO_DSP_OFF) {
+			dsp_next.stages = i + 1;
+		}
+	}
+
+	atomic_inc(&dsp_seq);
+	barrier_dmem_fence_full();
+	dsp_shared = dsp_next;
+	barrier_dmem_fence_full();
+	atomic_inc(&dsp_seq);
+}
+
+// Take published settings at a block boundary, a copy torn by a control waits a block
+static void dsp_adopt(void)
+{
+	atomic_val_t seq = atomic_get(&dsp_seq);
+
+	if (seq == dsp_seen || (seq & 1)) {
+		return;
+	}
+
+	dsp_taken = dsp_shared;
+	barrier_dmem_fence_full();
+	if (atomic_get(&dsp_seq) != seq) {
+		return;
+	}
+
+	// Bands past the cascade restart from silence when they are enabled again
+	for (int ch = 0; ch < AUDIO_OUT_CHANNELS; ch++) {
+		memset(&biquad_state[ch][dsp_taken.stages * 4], 0,
+		       (BANDS - dsp_taken.stages) * 4 * sizeof(int32_t));
+	}
+
+	if (dsp_taken.limiter != dsp_live.limiter) {
+		dsp_limiter_reset();
+	}
+
+	dsp_live = dsp_taken;
+	dsp_seen = seq;
+}
+
+// Direct form I cascade in place, the state is x[n-1], x[n-2], y[n-1], y[n-2] per band
+static void dsp_biquad(int32_t *state, uint8_t stages, int32_t *buf, size_t frames)
+{
+#ifdef CONFIG_CMSIS_DSP
+	arm_biquad_casd_df1_inst_q31 inst = {
+		.numStages = stages,
+		.pState = state,
+		.pCoeffs = &dsp_live.coefs[0][0],
+		.postShift = POST_SHIFT,
+	};
+
+	arm_biquad_cascade_df1_q31(&inst, buf, buf, frames);
+#else
+	for (uint8_t s = 0; s < stages; s++) {
+		const int32_t *c = dsp_live.coefs[s];
+		int32_t *st = &state[s * 4];
+		int32_t x1 = st[0];
+		int32_t x2 = st[1];
+		int32_t y1 = st[2];
+		int32_t y2 = st[3];
+
+		for (size_t i = 0; i < frames; i++) {
+			int64_t acc = (int64_t)c[0] * buf[i] + (int64_t)c[1] * x1 +
+				      (int64_t)c[2] * x2 + (int64_t)c[3] * y1 + (int64_t)c[4] * y2;
+
+			x2 = x1;
+			x1 = buf[i];
+			y2 = y1;
+			y1 = (int32_t)(acc >> (31 - POST_SHIFT));
+			buf[i] = y1;
+		}
+
+		st[0] = x1;
+		st[1] = x2;
+		st[2] = y1;
+		st[3] = y2;
+	}
+#endif
+}
+
+static void dsp_limiter_reset(void)
+{
+	memset(&limiter, 0, sizeof(limiter));
+	for (int i = 0; i < WINDOW; i++) {
+		limiter.held[i] = GAIN_UNITY;
+	}
+	limiter.last = GAIN_UNITY;
+	limiter.sum = (uint64_t)WINDOW * GAIN_UNITY;
+}
+
+/*
+ * Each frame needs the gain that brings its louder channel down to the threshold.
+ * The minimum of that over the window, released slowly, is averaged over the
+ * window again and applied to the frame leaving the delay. Every gain in the
+ * average already covers that frame, so the output never exceeds the threshold,
+ * and the average turns each gain step into a ramp over the look-ahead.
+ */
+static void dsp_limiter_run(size_t frames)
+{
+	struct dsp_limiter *lim = &limiter;
+
+	for (size_t i = 0; i < frames; i++) {
+		int32_t l = work[0][i];
+		int32_t r = work[1][i];
+		uint32_t peak = MAX((uint32_t)(l < 0 ? -(int64_t)l : l),
+				    (uint32_t)(r < 0 ? -(int64_t)r : r));
+		int32_t need = GAIN_UNITY;
+
+		if (peak > (uint32_t)dsp_live.threshold) {
+			need = (int32_t)((float)dsp_live.threshold / (float)peak * GAIN_UNITY) -
+			       GAIN_MARGIN;
+		}
+
+		// Drop the gain that left the window, then those that can no longer be the
+		// minimum. The queue then has room for the new one, it never holds more than
+		// the window.
+		if (lim->min_count > 0 && lim->time - lim->min_time[lim->min_head] >= WINDOW) {
+			lim->min_head = (lim->min_head + 1) % WINDOW;
+			lim->min_count--;
+		}
+		while (lim->min_count > 0 &&
+		       lim->min_gain[(lim->min_head + lim->min_count - 1) % WINDOW] >= need) {
+			lim->min_count--;
+		}
+		uint32_t tail = (lim->min_head + lim->min_count) % WINDOW;
+
+		lim->min_gain[tail] = need;
+		lim->min_time[tail] = lim->time;
+		lim->min_count++;
+
+		int32_t held = MIN(lim->min_gain[lim->min_head], lim->last + dsp_live.release_step);
+
+		lim->last = held;
+		lim->sum = lim->sum - lim->held[lim->held_pos] + held;
+		lim->held[lim->held_pos] = held;
+		lim->held_pos = (lim->held_pos + 1) % WINDOW;
+
+		int32_t gain = (int32_t)((lim->sum * AVG_SCALE) >> 32);
+
+		work[0][i] = (int32_t)(((int64_t)lim->delay[0][lim->pos] * gain) >> 30);
+		work[1][i] = (int32_t)(((int64_t)lim->delay[1][lim->pos] * gain) >> 30);
+		lim->delay[0][lim->pos] = l;
+		lim->delay[1][lim->pos] = r;
+		lim->pos = (lim->pos + 1) % LOOKAHEAD;
+		lim->time++;
+	}
+}
+
+int audio_dsp_init(uint32_t sample_rate)
+{
+	k_mutex_lock(&dsp_lock, K_FOREVER);
+	dsp_rate = sample_rate;
+	memset(dsp_bands, 0, sizeof(dsp_bands));
+	memset(&dsp_next, 0, sizeof(dsp_next));
+	for (int i = 0; i < BANDS; i++) {
+		dsp_next.coefs[i][0] = BIT(31 - POST_SHIFT);
+	}
+	dsp_publish();
+	k_mutex_unlock(&dsp_lock);
+
+	return 0;
+}
+
+int audio_dsp_set_band(int band, const struct audio_dsp_band *params)
+{
+	// Bypassed bands in the cascade pass samples through unchanged
+	int32_t coefs[5] = {BIT(31 - POST_SHIFT), 0, 0, 0, 0};
+	int ret = 0;
+
+	if (band < 0 || band >= BANDS) {
+		return -EINVAL;
+	}
+
+	k_mutex_lock(&dsp_lock, K_FOREVER);
+
+	if (params->type != AUDIO_DSP_OFF) {
+		if (params->freq < MIN_FREQ || params->freq > dsp_rate * 45 / 100 ||
+		    params->q < MIN_Q || params->q > MAX_Q || abs(params->gain) > MAX_GAIN) {
+			ret = -EINVAL;
+		} else {
+			ret = dsp_design(params, coefs);
+		}
+	}
+
+	if (ret == 0) {
+		dsp_bands[band] = *params;
+		memcpy(dsp_next.coefs[band], coefs, sizeof(coefs));
+		dsp_publish();
+	}
+
+	k_mutex_unlock(&dsp_lock);
+
+	return ret;
+}
+
+void audio_dsp_get_band(int band, struct audio_dsp_band *params)
+{
+	k_mutex_lock(&dsp_lock, K_FOREVER);
+	*params = dsp_bands[band];
+	k_mutex_unlock(&dsp_lock);
+}
+
+int audio_dsp_set_limiter(bool on, int16_t threshold, uint32_t release_ms)
+{
+	if (threshold < -300 || threshold > 0 || release_ms == 0 || release_ms > MAX_RELEASE) {
+		return -EINVAL;
+	}
+
+	k_mutex_lock(&dsp_lock, K_FOREVER);
+
+	uint32_t release_frames = MAX((uint64_t)dsp_rate * release_ms / MSEC_PER_SEC, 1);
+
+	dsp_threshold = threshold;
+	dsp_release_ms = release_ms;
+	dsp_next.limiter = on;
+	dsp_next.threshold =
+		(int32_t)((INT32_MAX >> AUDIO_DSP_HEADROOM_BITS) * pow(10.0, threshold / 200.0));
+	dsp_next.release_step = MAX(GAIN_UNITY / release_frames, 1);
+	dsp_publish();
+
+	k_mutex_unlock(&dsp_lock);
+
+	return 0;
+}
+
+void audio_dsp_get_limiter(bool *on, int16_t *threshold, uint32_t *release_ms)
+{
+	k_mutex_lock(&dsp_lock, K_FOREVER);
+	*on = dsp_next.limiter;
+	*threshold = dsp_threshold;
+	*release_ms = dsp_release_ms;
+	k_mutex_unlock(&dsp_lock);
+}
+
+bool audio_dsp_active(void)
+{
+	return dsp_live.stages > 0 || dsp_live.limiter || atomic_get(&dsp_seq) != dsp_seen;
+}
+
+void audio_dsp_process(int16_t *block, size_t frames)
+{
+	uint32_t eq_cycles = 0;
+	uint32_t limiter_cycles = 0;
+
+	dsp_adopt();
+	if (dsp_live.stages == 0 && !dsp_live.limiter) {
+		return;
+	}
+
+	for (size_t done = 0; done < frames;) {
+		size_t n = MIN(frames - done, CHUNK_FRAMES);
+		int16_t *pcm = &block[done * AUDIO_OUT_CHANNELS];
+		uint32_t start = audio_stats_now();
+
+		for (size_t i = 0; i < n; i++) {
+			work[0][i] = pcm[2 * i] * (1 << IN_SHIFT);
+			work[1][i] = pcm[2 * i + 1] * (1 << IN_SHIFT);
+		}
+
+		for (int ch = 0; ch < AUDIO_OUT_CHANNELS && dsp_live.stages > 0; ch++) {
+			dsp_biquad(biquad_state[ch], dsp_live.stages, work[ch], n);
+		}
+		eq_cycles += audio_stats_now() - start;
+
+		if (dsp_live.limiter) {
+			start = audio_stats_now();
+			dsp_limiter_run(n);
+			limiter_cycles += audio_stats_now() - start;
+		}
+
+		start = audio_stats_now();
+		for (size_t i = 0; i < n; i++) {
+			for (int ch = 0; ch < AUDIO_OUT_CHANNELS; ch++) {
+				int64_t v = (int64_t)work[ch][i] + (1 << (IN_SHIFT - 1));
+
+				v >>= IN_SHIFT;
+				pcm[2 * i + ch] = (int16_t)CLAMP(v, INT16_MIN, INT16_MAX);
+			}
+		}
+		eq_cycles += audio_stats_now() - start;
+
+		done += n;
+	}
+
+	// One call per block, so the stage maximum is the cost against the block deadline
+	audio_stats_stage(AUDIO_STAGE_EQ, audio_stats_now() - eq_cycles);
+	if (dsp_live.limiter) {
+		audio_stats_stage(AUDIO_STAGE_LIMITER, audio_stats_now() - limiter_cycles);
+	}
+}
+
+// Parse a decimal such as -2.5 into an integer scaled by 10^decimals
+static int dsp_parse_fixed(const char *str, int decimals, int32_t *value)
+{
+	bool negative = str[0] == '-';
+	int32_t scale = 1;
+	int32_t frac = 0;
+	char *end;
+	long whole;
+
+	for (int i = 0; i < decimals; i++) {
+		scale *= 10;
+	}
+
+	whole = strtol(str, &end, 10);
+	if (end == str) {
+		return -EINVAL;
+	}
+
+	if (*end == '.') {
+		end++;
+		for (int32_t digit = scale / 10; isdigit((unsigned char)*end); end++, digit /= 10) {
+			frac += (*end - '0') * digit;
+		}
+	}
+
+	if (*end != '\0' || whole > INT16_MAX || whole < INT16_MIN) {
+		return -EINVAL;
+	}
+
+	*value = whole * scale + (negative ? -frac : frac);
+
+	return 0;
+}
+
+static int cmd_dsp(const struct shell *shell, size_t argc, char **argv)
+{
+	static const enum audio_stage stages[] = {AUDIO_STAGE_EQ, AUDIO_STAGE_LIMITER};
+	const struct audio_latency *lat = audio_latency_get();
+	struct audio_dsp_band band;
+
+	for (int i = 0; i < BANDS; i++) {
+		audio_dsp_get_band(i, &band);
+		if (band.type == AUDIO_DSP_OFF) {
+			shell_print(shell, "Band %d: off", i);
+		} else if (band.type == AUDIO_DSP_HIGHPASS || band.type == AUDIO_DSP_LOWPASS) {
+			shell_print(shell, "Band %d: %s %u Hz, Q %u.%02u", i,
+				    filter_names[band.type], band.freq, band.q / 100, band.q % 100);
+		} else {
+			shell_print(shell, "Band %d: %s %u Hz, %c%d.%d dB, Q %u.%02u", i,
+				    filter_names[band.type], band.freq, band.gain < 0 ? '-' : '+',
+				    abs(band.gain) / 10, abs(band.gain) % 10, band.q / 100,
+				    band.q % 100);
+		}
+	}
+
+	k_mutex_lock(&dsp_lock, K_FOREVER);
+	if (dsp_next.limiter) {
+		shell_print(shell, "Limiter: %s%d.%d dBFS, %u ms release, %u frames look-ahead",
+			    dsp_threshold < 0 ? "-" : "", abs(dsp_threshold) / 10,
+			    abs(dsp_threshold) % 10, dsp_release_ms, LOOKAHEAD);
+	} else {
+		shell_print(shell, "Limiter: off");
+	}
+	k_mutex_unlock(&dsp_lock);
+
+	// Budget against one block of the current latency mode
+	for (int i = 0; i < ARRAY_SIZE(stages); i++) {
+		struct audio_stage_summary s;
+
+		audio_stats_stage_get(stages[i], &s);
+		shell_print(shell, "%-8s %6u us avg, %6u us max per block (%u%% of %u us)",
+			    i == 0 ? "eq" : "limiter",
+			    s.calls ? (uint32_t)(s.total_us / s.calls) : 0, s.max_us,
+			    lat->block_us ? s.max_us * 100 / lat->block_us : 0, lat->block_us);
+	}
+
+	return 0;
+}
+
+static int cmd_dsp_eq(const struct shell *shell, size_t argc, char **argv)
+{
+	struct audio_dsp_band band = {.q = 71};
+	int band_id = strtol(argv[1], NULL, 10);
+	int32_t value;
+	int arg = 3;
+	int ret;
+
+	for (band.type = 0; band.type < ARRAY_SIZE(filter_names); band.type++) {
+		if (strcmp(argv[2], filter_names[band.type]) == 0) {
+			break;
+		}
+	}
+
+	if (band.type == ARRAY_SIZE(filter_names)) {
+		shell_error(shell, "Unknown filter %s", argv[2]);
+		return -EINVAL;
+	}
+
+	if (band.type != AUDIO_DSP_OFF) {
+		bool has_gain = band.type != AUDIO_DSP_HIGHPASS && band.type != AUDIO_DSP_LOWPASS;
+
+		if (argc < (has_gain ? 5 : 4)) {
+			shell_error(shell, "Usage: eq <band> %s <freq_hz>%s [q]", argv[2],
+				    has_gain ? " <gain_db>" : "");
+			return -EINVAL;
+		}
+
+		band.freq = strtoul(argv[arg++], NULL, 10);
+		if (has_gain) {
+			if (dsp_parse_fixed(argv[arg++], 1, &value) < 0) {
+				return -EINVAL;
+			}
+			band.gain = CLAMP(value, INT16_MIN, INT16_MAX);
+		}
+		if (arg < argc) {
+			if (dsp_parse_fixed(argv[arg++], 2, &value) < 0 || value <= 0) {
+				return -EINVAL;
+			}
+			band.q = MIN(value, UINT16_MAX);
+		}
+	}
+
+	ret = audio_dsp_set_band(band_id, &band);
+	if (ret < 0) {
+		shell_error(shell,
+			    "Band %d must be below %d, 10 Hz to 0.45 fs, +-12 dB, Q 0.1 to 20",
+			    band_id, BANDS);
+	}
+
+	return ret;
+}
+
+static int cmd_dsp_limiter(const struct shell *shell, size_t argc, char **argv)
+{
+	int32_t threshold;
+	uint32_t release_ms;
+	int ret;
+
+	k_mutex_lock(&dsp_lock, K_FOREVER);
+	threshold = dsp_threshold;
+	release_ms = dsp_release_ms;
+	k_mutex_unlock(&dsp_lock);
+
+	if (strcmp(argv[1], "off") == 0) {
+		return audio_dsp_set_limiter(false, threshold, release_ms);
+	}
+
+	if (dsp_parse_fixed(argv[1], 1, &threshold) < 0) {
+		return -EINVAL;
+	}
+	if (argc > 2) {
+		release_ms = strtoul(argv[2], NULL, 10);
+	}
+
+	ret = audio_dsp_set_limiter(true, CLAMP(threshold, INT16_MIN, INT16_MAX), release_ms);
+	if (ret < 0) {
+		shell_error(shell, "Threshold must be -30 to 0 dBFS, release 1 to %u ms",
+			    MAX_RELEASE);
+	}
+
+	return ret;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	dsp_cmds,
+	SHELL_CMD_ARG(eq, NULL,
+		      "<band> off|hp|lp <freq_hz> [q], or <band> peak|lowshelf|highshelf "
+		      "<freq_hz> <gain_db> [q]",
+		      cmd_dsp_eq, 3, 3),
+	SHELL_CMD_ARG(limiter, NULL, "<threshold_dbfs> [release_ms], or off", cmd_dsp_limiter,
+		      2, 1),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_SUBCMD_ADD((audio), dsp, &dsp_cmds, "Show the EQ bands, limiter and their cost per block",
+		 cmd_dsp, 1, 0);
@@ -0,0 +1,67 @@
+#ifndef AUDIO_DSP_H_
+#define AUDIO_DSP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Output processing for speaker tuning: up to CONFIG_AUDIO_DSP_BANDS cascaded
+ * biquads followed by a look-ahead peak limiter, run on every block just before
+ * it is written to I2S.
+ *
+ * Samples are processed in Q31 with AUDIO_DSP_HEADROOM_BITS of headroom above
+ * full scale, so EQ boosts do not wrap before the limiter brings them back. The
+ * biquads are direct form I (arm_biquad_cascade_df1_q31 with CMSIS-DSP). Their
+ * state is the recent input and output, which stays valid when coefficients
+ * change, so bands can be retuned while the stream runs without a click.
+ *
+ * Controls may be called from any thread. They publish complete settings that the
+ * audio thread picks up at the start of its next block, it never waits for them.
+ */
+
+#define AUDIO_DSP_BANDS CONFIG_AUDIO_DSP_BANDS
+
+#define AUDIO_DSP_HEADROOM_BITS 3
+
+enum audio_dsp_filter {
+	AUDIO_DSP_OFF,
+	AUDIO_DSP_PEAK,
+	AUDIO_DSP_LOWSHELF,
+	AUDIO_DSP_HIGHSHELF,
+	AUDIO_DSP_HIGHPASS,
+	AUDIO_DSP_LOWPASS,
+};
+
+struct audio_dsp_band {
+	enum audio_dsp_filter type;
+	uint32_t freq; // centre or corner frequency in Hz
+	int16_t gain;  // 0.1 dB, peak and shelf filters only
+	uint16_t q;    // 0.01
+};
+
+// Sample rate all bands are designed for, clears the chain
+int audio_dsp_init(uint32_t sample_rate);
+
+/*
+ * Design band for params, or bypass it with AUDIO_DSP_OFF. -EINVAL for a
+ * frequency outside 10 Hz to 0.45 times the sample rate, a gain beyond 12 dB or
+ * a Q outside 0.1 to 20.
+ */
+int audio_dsp_set_band(int band, const struct audio_dsp_band *params);
+void audio_dsp_get_band(int band, struct audio_dsp_band *params);
+
+/*
+ * Hold peaks at threshold (0.1 dBFS, -300 to 0) with release_ms to recover,
+ * turning the limiter on or off restarts its look-ahead delay.
+ */
+int audio_dsp_set_limiter(bool on, int16_t threshold, uint32_t release_ms);
+void audio_dsp_get_limiter(bool *on, int16_t *threshold, uint32_t *release_ms);
+
+// True when a stage is enabled or a change is pending, called by the audio thread
+bool audio_dsp_active(void);
+
+// Run the chain over frames 16-bit stereo frames of block, called by the audio thread
+void audio_dsp_process(int16_t *block, size_t frames);
+
+#endif /* AUDIO_DSP_H_ */
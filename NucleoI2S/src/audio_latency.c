@@ -0,0 +1,181 @@
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+
+#include "audio_latency.h"
+#include "audio_mem.h"
+#include "audio_convert.h"
+
+/* ----- module registers ----- */
+LOG_MODULE_REGISTER(audio_latency, LOG_LEVEL_INF);
+
+/* ----- definitions ----- */
+
+// Blocks the I2S driver queues ahead of the one being transmitted
+#ifdef CONFIG_I2S_STM32_TX_BLOCK_COUNT
+#define I2S_TX_QUEUE_DEPTH CONFIG_I2S_STM32_TX_BLOCK_COUNT
+#elif defined(CONFIG_I2S_SINK_SIM_TX_BLOCK_COUNT)
+#define I2S_TX_QUEUE_DEPTH CONFIG_I2S_SINK_SIM_TX_BLOCK_COUNT
+#else
+#define I2S_TX_QUEUE_DEPTH 4
+#endif
+
+// How long a new stream waits for the previous one to drain its blocks
+#define APPLY_WAIT_MS  1000
+#define APPLY_POLL_MS  10
+
+#define BLOCK_US_MIN 1000
+#define BLOCK_US_MAX 200000
+
+// 25 ms blocks, the fixed configuration this module replaced
+#define LATENCY_DEFAULT {.block_us = 25000, .blocks = 27, .prefill = 3}
+
+/* ----- private static variables and types ----- */
+struct latency_preset {
+	const char *name;
+	struct audio_latency lat;
+};
+
+static const struct latency_preset presets[] = {
+	// Interactive cues, the whole slab holds 8 ms
+	{"low", {.block_us = 2000, .blocks = 4, .prefill = 2}},
+	{"default", LATENCY_DEFAULT},
+	// Slow cards, 600 ms of read-ahead
+	{"robust", {.block_us = 100000, .blocks = 6, .prefill = 3}},
+};
+
+/*
+ * The reader copies samples into these blocks from its staging buffer and
+ * i2s_write hands them to the I2S DMA as they are, so they live in the DMA region
+ * and are cache-line aligned.
+ */
+static uint8_t __audio_dma __aligned(AUDIO_DMA_ALIGN) pool[CONFIG_AUDIO_BUFFER_POOL_SIZE];
+
+struct k_mem_slab audio_slab;
+
+static struct audio_latency latency = LATENCY_DEFAULT;
+static uint32_t latency_rate = 44100;
+
+/* ----- private function declarations ----- */
+static size_t latency_block_size(const struct audio_latency *lat, uint32_t sample_rate);
+
+/* ----- function definitions ----- */
+static size_t latency_block_size(const struct audio_latency *lat, uint32_t sample_rate)
+{
+	uint32_t frames = DIV_ROUND_CLOSEST((uint64_t)sample_rate * lat->block_us, USEC_PER_SEC);
+
+	return frames * AUDIO_OUT_FRAME_BYTES;
+}
+
+int audio_latency_set(const struct audio_latency *lat)
+{
+	if (lat->block_us < BLOCK_US_MIN || lat->block_us > BLOCK_US_MAX || lat->blocks < 2 ||
+	    lat->prefill < 1 || lat->prefill > lat->blocks) {
+		return -EINVAL;
+	}
+
+	// Prefilled blocks must all fit the driver queue before the stream is started
+	if (lat->prefill > I2S_TX_QUEUE_DEPTH) {
+		return -EINVAL;
+	}
+
+	if ((size_t)lat->blocks * AUDIO_DMA_SIZE(latency_block_size(lat, latency_rate)) >
+	    sizeof(pool)) {
+		return -ENOMEM;
+	}
+
+	latency = *lat;
+
+	return 0;
+}
+
+const struct audio_latency *audio_latency_get(void)
+{
+	return &latency;
+}
+
+int audio_latency_apply(uint32_t sample_rate, size_t *block_size)
+{
+	size_t size = latency_block_size(&latency, sample_rate);
+	int ret;
+
+	if ((size_t)latency.blocks * AUDIO_DMA_SIZE(size) > sizeof(pool)) {
+		return -ENOMEM;
+	}
+
+	// A drained stream returns its last blocks from the I2S interrupt
+	for (int waited = 0; k_mem_slab_num_used_get(&audio_slab) > 0; waited += APPLY_POLL_MS) {
+		if (waited >= APPLY_WAIT_MS) {
+			return -EBUSY;
+		}
+		k_msleep(APPLY_POLL_MS);
+	}
+
+	ret = k_mem_slab_init(&audio_slab, pool, AUDIO_DMA_SIZE(size), latency.blocks);
+	if (ret < 0) {
+		return ret;
+	}
+
+	latency_rate = sample_rate;
+	*block_size = size;
+
+	return 0;
+}
+
+static int cmd_latency(const struct shell *shell, size_t argc, char **argv)
+{
+	struct audio_latency lat = latency;
+	int ret;
+
+	if (argc == 2) {
+		ret = -ENOENT;
+		for (size_t i = 0; i < ARRAY_SIZE(presets); i++) {
+			if (strcmp(argv[1], presets[i].name) == 0) {
+				lat = presets[i].lat;
+				ret = 0;
+			}
+		}
+		if (ret < 0) {
+			shell_error(shell, "Unknown mode %s", argv[1]);
+			return ret;
+		}
+	} else if (argc > 2) {
+		lat.block_us = strtoul(argv[1], NULL, 10);
+		lat.blocks = strtoul(argv[2], NULL, 10);
+		lat.prefill = argc > 3 ? strtoul(argv[3], NULL, 10) : MIN(lat.blocks, 3);
+	}
+
+	if (argc > 1) {
+		ret = audio_latency_set(&lat);
+		if (ret < 0) {
+			shell_error(shell, "Invalid configuration: %d", ret);
+			return ret;
+		}
+	}
+
+	size_t size = latency_block_size(&latency, latency_rate);
+	uint32_t block_us = (uint64_t)size / AUDIO_OUT_FRAME_BYTES * USEC_PER_SEC / latency_rate;
+	uint32_t queued = MIN(latency.blocks - 1, I2S_TX_QUEUE_DEPTH);
+
+	shell_print(shell, "Block %u us (%zu bytes), %u blocks, prefill %u", block_us, size,
+		    latency.blocks, latency.prefill);
+	// A new block waits behind the full driver queue and the block on the wire
+	shell_print(shell, "Output latency %u us, buffered %u us", (queued + 1) * block_us,
+		    latency.blocks * block_us);
+	shell_print(shell, "Memory %zu of %zu bytes", latency.blocks * AUDIO_DMA_SIZE(size),
+		    sizeof(pool));
+	if (argc > 1) {
+		shell_print(shell, "Takes effect at the next stream start");
+	}
+
+	return 0;
+}
+
+SHELL_SUBCMD_ADD((audio), latency, NULL,
+		 "Show or set the output buffering: [low|default|robust] or "
+		 "<block_us> <blocks> [prefill]",
+		 cmd_latency, 1, 3);
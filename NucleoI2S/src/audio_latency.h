@@ -0,0 +1,38 @@
+#ifndef AUDIO_LATENCY_H_
+#define AUDIO_LATENCY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zephyr/kernel.h>
+
+/*
+ * Block size and buffer depth of the output stream.
+ *
+ * The I2S blocks come from audio_slab, which is rebuilt over a static DMA pool of
+ * CONFIG_AUDIO_BUFFER_POOL_SIZE bytes whenever a stream starts, so short blocks
+ * for interactive cues and long, deep buffers for slow cards can be chosen at
+ * run time without reflashing.
+ */
+
+struct audio_latency {
+	uint32_t block_us; // duration of one I2S block
+	uint16_t blocks;   // blocks in audio_slab
+	uint16_t prefill;  // blocks queued before the I2S stream is started
+};
+
+// Blocks shared by the reader, the tone source and the I2S driver
+extern struct k_mem_slab audio_slab;
+
+// Select the configuration for the next stream start, -ENOMEM if it does not fit the pool
+int audio_latency_set(const struct audio_latency *lat);
+const struct audio_latency *audio_latency_get(void);
+
+/*
+ * Rebuild audio_slab for the current configuration at sample_rate and return the
+ * block size in bytes through block_size. Waits for blocks of the previous stream
+ * to be returned and fails with -EBUSY if they are not.
+ */
+int audio_latency_apply(uint32_t sample_rate, size_t *block_size);
+
+#endif /* AUDIO_LATENCY_H_ */
@@ -0,0 +1,61 @@
+#ifndef AUDIO_MEM_H_
+#define AUDIO_MEM_H_
+
+#include <zephyr/kernel.h>
+#include <zephyr/cache.h>
+#include <zephyr/linker/section_tags.h>
+
+/*
+ * Placement and cache maintenance for buffers shared with the SDMMC and I2S DMA.
+ *
+ * When a nocache region is available (CONFIG_DT_DEFINED_NOCACHE or the arch level
+ * CONFIG_NOCACHE_MEMORY) DMA buffers are placed there and no maintenance is
+ * needed. Otherwise buffers live in cached SRAM, are aligned to a full cache line
+ * and must be cleaned/invalidated around every DMA transfer with the helpers below.
+ */
+
+#define AUDIO_DMA_ALIGN 32
+
+#if defined(CONFIG_DT_DEFINED_NOCACHE)
+#define __audio_dma         __attribute__((__section__(CONFIG_DT_DEFINED_NOCACHE_NAME)))
+#define AUDIO_DMA_NOCACHE   1
+#elif defined(CONFIG_NOCACHE_MEMORY)
+#define __audio_dma         __nocache
+#define AUDIO_DMA_NOCACHE   1
+#else
+#define __audio_dma
+#define AUDIO_DMA_NOCACHE   0
+#endif
+
+// Size of a DMA buffer rounded up so that it never shares a cache line
+#define AUDIO_DMA_SIZE(size) ROUND_UP(size, AUDIO_DMA_ALIGN)
+
+BUILD_ASSERT(!IS_ENABLED(CONFIG_DCACHE) || AUDIO_DMA_ALIGN >= CONFIG_DCACHE_LINE_SIZE,
+	     "AUDIO_DMA_ALIGN must cover a full D-cache line");
+
+// Call before a DMA (or a driver that may use DMA) writes into buf
+static inline void audio_mem_dma_write_prepare(void *buf, size_t size)
+{
+	if (!AUDIO_DMA_NOCACHE) {
+		// Write back and drop lines so a later eviction cannot overwrite DMA data
+		sys_cache_data_flush_and_invd_range(buf, AUDIO_DMA_SIZE(size));
+	}
+}
+
+// Call after a DMA wrote into buf and before the CPU reads it
+static inline void audio_mem_dma_write_complete(void *buf, size_t size)
+{
+	if (!AUDIO_DMA_NOCACHE) {
+		sys_cache_data_invd_range(buf, AUDIO_DMA_SIZE(size));
+	}
+}
+
+// Call after the CPU wrote into buf and before a DMA reads it
+static inline void audio_mem_dma_read_prepare(void *buf, size_t size)
+{
+	if (!AUDIO_DMA_NOCACHE) {
+		sys_cache_data_flush_range(buf, AUDIO_DMA_SIZE(size));
+	}
+}
+
+#endif /* AUDIO_MEM_H_ */
@@ -0,0 +1,249 @@
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/shell/shell.h>
+
+#include "audio_mixer.h"
+#include "audio_convert.h"
+#include "audio_simd.h"
+
+/* ----- definitions ----- */
+
+// Frames rendered per source call, the scratch buffer is the only copy
+#define MIX_CHUNK_FRAMES 64
+
+// Gain is kept with 16 extra fractional bits so slow ramps do not stall
+#define GAIN_SHIFT 16
+
+enum stream_state {
+	STREAM_IDLE,
+	STREAM_CLAIMED, // being set up by audio_mixer_start
+	STREAM_ACTIVE,
+	STREAM_STOPPING,
+};
+
+/* ----- private static variables and types ----- */
+struct mixer_stream {
+	atomic_t state;
+	atomic_t target; // Q15 gain requested by the controls
+	audio_mixer_fill_t fill;
+	void *ctx;
+
+	// Owned by the audio thread
+	int32_t gain; // Q15 << GAIN_SHIFT
+	int32_t step;
+	int32_t ramp_to;
+	uint32_t ramp_left;
+};
+
+static struct mixer_stream streams[CONFIG_AUDIO_MIXER_STREAMS];
+static int16_t scratch[MIX_CHUNK_FRAMES * AUDIO_OUT_CHANNELS];
+
+/* ----- private function declarations ----- */
+static void mix_chunk(struct mixer_stream *s, uint32_t *out, const uint32_t *in, size_t frames);
+static inline uint32_t mix_scale(uint32_t in, int32_t gain);
+static inline uint32_t mix_add(uint32_t a, uint32_t b);
+
+/* ----- function definitions ----- */
+int audio_mixer_start(audio_mixer_fill_t fill, void *ctx, int16_t gain)
+{
+	for (int id = 0; id < CONFIG_AUDIO_MIXER_STREAMS; id++) {
+		struct mixer_stream *s = &streams[id];
+
+		if (!atomic_cas(&s->state, STREAM_IDLE, STREAM_CLAIMED)) {
+			continue;
+		}
+
+		s->fill = fill;
+		s->ctx = ctx;
+		s->gain = 0;
+		s->ramp_to = 0;
+		s->ramp_left = 0;
+		atomic_set(&s->target, MAX(gain, 0));
+		atomic_set(&s->state, STREAM_ACTIVE);
+
+		return id;
+	}
+
+	return -ENOSPC;
+}
+
+int audio_mixer_stop(int id)
+{
+	if (id < 0 || id >= CONFIG_AUDIO_MIXER_STREAMS) {
+		return -EINVAL;
+	}
+
+	if (!atomic_cas(&streams[id].state, STREAM_ACTIVE, STREAM_STOPPING)) {
+		return -EALREADY;
+	}
+
+	return 0;
+}
+
+int audio_mixer_set_gain(int id, int16_t gain)
+{
+	if (id < 0 || id >= CONFIG_AUDIO_MIXER_STREAMS) {
+		return -EINVAL;
+	}
+
+	atomic_set(&streams[id].target, MAX(gain, 0));
+
+	return 0;
+}
+
+bool audio_mixer_active(void)
+{
+	for (int id = 0; id < CONFIG_AUDIO_MIXER_STREAMS; id++) {
+		atomic_val_t state = atomic_get(&streams[id].state);
+
+		if (state == STREAM_ACTIVE || state == STREAM_STOPPING) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool audio_mixer_playing(int id, const void *ctx)
+{
+	atomic_val_t state;
+
+	if (id < 0 || id >= CONFIG_AUDIO_MIXER_STREAMS) {
+		return false;
+	}
+
+	state = atomic_get(&streams[id].state);
+
+	return (state == STREAM_ACTIVE || state == STREAM_STOPPING) && streams[id].ctx == ctx;
+}
+
+// Scale both samples of a packed stereo frame by a Q15 gain
+static inline uint32_t mix_scale(uint32_t in, int32_t gain)
+{
+#if AUDIO_SIMD
+	return __PKHBT(__SMULBB(in, gain) >> 15, __SMULTB(in, gain) >> 15, 16);
+#else
+	int32_t l = ((int16_t)in * gain) >> 15;
+	int32_t r = ((int16_t)(in >> 16) * gain) >> 15;
+
+	return (uint16_t)l | ((uint32_t)r << 16);
+#endif
+}
+
+// Saturating add of two packed stereo frames
+static inline uint32_t mix_add(uint32_t a, uint32_t b)
+{
+#if AUDIO_SIMD
+	return __QADD16(a, b);
+#else
+	int32_t l = CLAMP((int16_t)a + (int16_t)b, INT16_MIN, INT16_MAX);
+	int32_t r = CLAMP((int16_t)(a >> 16) + (int16_t)(b >> 16), INT16_MIN, INT16_MAX);
+
+	return (uint16_t)l | ((uint32_t)r << 16);
+#endif
+}
+
+static void mix_chunk(struct mixer_stream *s, uint32_t *out, const uint32_t *in, size_t frames)
+{
+	size_t i = 0;
+
+	// Ramp frame by frame, then finish the chunk at a constant gain
+	for (; i < frames && s->ramp_left > 0; i++) {
+		s->gain += s->step;
+		if (--s->ramp_left == 0) {
+			s->gain = s->ramp_to;
+		}
+		out[i] = mix_add(out[i], mix_scale(in[i], s->gain >> GAIN_SHIFT));
+	}
+
+	int32_t gain = s->gain >> GAIN_SHIFT;
+
+	if (gain == AUDIO_MIXER_UNITY) {
+		for (; i < frames; i++) {
+			out[i] = mix_add(out[i], in[i]);
+		}
+	} else if (gain != 0) {
+		for (; i < frames; i++) {
+			out[i] = mix_add(out[i], mix_scale(in[i], gain));
+		}
+	}
+}
+
+void audio_mixer_mix(int16_t *block, size_t frames)
+{
+	for (int id = 0; id < CONFIG_AUDIO_MIXER_STREAMS; id++) {
+		struct mixer_stream *s = &streams[id];
+		atomic_val_t state = atomic_get(&s->state);
+		bool ended = false;
+
+		if (state != STREAM_ACTIVE && state != STREAM_STOPPING) {
+			continue;
+		}
+
+		// Start a ramp towards the requested gain, or to silence when stopping
+		int32_t target = state == STREAM_STOPPING ? 0 : atomic_get(&s->target);
+
+		target <<= GAIN_SHIFT;
+		if (target != s->ramp_to) {
+			s->ramp_to = target;
+			s->ramp_left = AUDIO_MIXER_RAMP_FRAMES;
+			s->step = (target - s->gain) / AUDIO_MIXER_RAMP_FRAMES;
+		}
+
+		for (size_t done = 0; done < frames && !ended;) {
+			size_t n = MIN(frames - done, MIX_CHUNK_FRAMES);
+			size_t got = s->fill(s->ctx, scratch, n);
+
+			if (got < n) {
+				memset(&scratch[got * AUDIO_OUT_CHANNELS], 0,
+				       (n - got) * AUDIO_OUT_FRAME_BYTES);
+				ended = true;
+			}
+
+			mix_chunk(s, (uint32_t *)&block[done * AUDIO_OUT_CHANNELS],
+				  (const uint32_t *)scratch, n);
+			done += n;
+		}
+
+		if (ended || (state == STREAM_STOPPING && s->ramp_left == 0)) {
+			atomic_set(&s->state, STREAM_IDLE);
+		}
+	}
+}
+
+static int cmd_mix(const struct shell *shell, size_t argc, char **argv)
+{
+	static const char *const state_names[] = {"idle", "setup", "active", "stopping"};
+
+	for (int id = 0; id < CONFIG_AUDIO_MIXER_STREAMS; id++) {
+		const struct mixer_stream *s = &streams[id];
+
+		shell_print(shell, "%d: %s, gain %d%%", id, state_names[atomic_get(&s->state)],
+			    (int)(atomic_get(&s->target) * 100 / AUDIO_MIXER_UNITY));
+	}
+
+	return 0;
+}
+
+static int cmd_mix_gain(const struct shell *shell, size_t argc, char **argv)
+{
+	long pct = CLAMP(strtol(argv[2], NULL, 10), 0, 100);
+
+	return audio_mixer_set_gain(strtol(argv[1], NULL, 10), pct * AUDIO_MIXER_UNITY / 100);
+}
+
+static int cmd_mix_stop(const struct shell *shell, size_t argc, char **argv)
+{
+	return audio_mixer_stop(strtol(argv[1], NULL, 10));
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	mix_cmds, SHELL_CMD_ARG(gain, NULL, "<id> <gain_pct>", cmd_mix_gain, 3, 0),
+	SHELL_CMD_ARG(stop, NULL, "<id>", cmd_mix_stop, 2, 0), SHELL_SUBCMD_SET_END);
+
+SHELL_SUBCMD_ADD((audio), mix, &mix_cmds, "List mixer streams, change gain or stop them",
+		 cmd_mix, 1, 0);
@@ -0,0 +1,47 @@
+#ifndef AUDIO_MIXER_H_
+#define AUDIO_MIXER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Overlay mixer for 16-bit stereo.
+ *
+ * Up to CONFIG_AUDIO_MIXER_STREAMS sources are rendered in short chunks, scaled by
+ * their own Q15 gain and summed into the output block with saturating packed adds
+ * (QADD16). Each active stream costs one render and one multiply-add per frame,
+ * so the mixing time grows linearly with the number of active streams.
+ *
+ * Gain changes, starts and stops ramp over AUDIO_MIXER_RAMP_FRAMES so they do not
+ * click. The controls are lock-free and may be called from any thread while the
+ * audio thread mixes.
+ */
+
+#define AUDIO_MIXER_RAMP_FRAMES 256
+
+#define AUDIO_MIXER_UNITY INT16_MAX
+
+/*
+ * Render up to frames 16-bit stereo frames into buf. Returning fewer frames ends
+ * the stream after they were mixed.
+ */
+typedef size_t (*audio_mixer_fill_t)(void *ctx, int16_t *buf, size_t frames);
+
+// Fade a new stream in to gain, returns its id or -ENOSPC
+int audio_mixer_start(audio_mixer_fill_t fill, void *ctx, int16_t gain);
+
+// Fade a stream out and release it
+int audio_mixer_stop(int id);
+
+int audio_mixer_set_gain(int id, int16_t gain);
+
+bool audio_mixer_active(void);
+
+// True while stream id still renders from ctx, including its fade out
+bool audio_mixer_playing(int id, const void *ctx);
+
+// Mix all active streams into frames stereo frames of block, called by the audio thread
+void audio_mixer_mix(int16_t *block, size_t frames);
+
+#endif /* AUDIO_MIXER_H_ */
@@ -0,0 +1,624 @@
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "audio_reader.h"
+#include "audio_mem.h"
+#include "audio_convert.h"
+#include "audio_decode.h"
+#include "audio_resample.h"
+#include "audio_stats.h"
+#include "playlist.h"
+
+/* ----- module registers ----- */
+LOG_MODULE_REGISTER(audio_reader, LOG_LEVEL_INF);
+
+/* ----- definitions ----- */
+
+/*
+ * Upper bound on how long the reader blocks on the slab or the queue before it
+ * re-checks for a stop request. This is not a polling period, the waits return
+ * as soon as a block or a queue slot becomes available.
+ */
+#define READER_WAIT_MS 100
+
+// Open the next track once the current one has less than this many blocks left
+#define PREOPEN_BLOCKS 2
+
+// Values of reader_skip, ENDED is set by the reader when it leaves at the end of the playlist
+#define READER_SKIP_NEXT   1
+#define READER_SKIP_RELOAD 2
+#define READER_SKIP_ENDED  3
+
+/* ----- private static variables and types ----- */
+struct reader_item {
+	void *block;
+	size_t size;
+};
+
+struct reader_pos {
+	uint32_t pos;
+	enum audio_pos_unit unit;
+};
+
+K_MSGQ_DEFINE(reader_queue, sizeof(struct reader_item), CONFIG_AUDIO_PREFETCH_DEPTH, 4);
+
+static K_THREAD_STACK_DEFINE(reader_thread_stack, CONFIG_AUDIO_READER_STACK_SIZE);
+static struct k_thread reader_thread_data;
+
+static atomic_t reader_running;
+static atomic_t reader_held; // slab blocks not handed to the writer yet
+static atomic_t reader_skip;
+static struct k_mem_slab *reader_slab;
+static size_t reader_block_size;
+static uint32_t reader_out_rate;
+
+// The playing track and the one opened ahead of it
+static WavFile tracks[2];
+static int track_cur;
+static struct audio_convert reader_cv;
+static struct audio_decode reader_dec;
+
+// Sector aligned read-ahead of the playing track, see wav_set_read_buffer
+static uint8_t __audio_dma __aligned(AUDIO_DMA_ALIGN) reader_stage[CONFIG_AUDIO_READ_CHUNK_SIZE];
+BUILD_ASSERT(CONFIG_AUDIO_READ_CHUNK_SIZE % WAV_SECTOR_SIZE == 0,
+	     "AUDIO_READ_CHUNK_SIZE must be a multiple of the sector size");
+static bool reader_compressed; // current track goes through reader_dec
+static struct audio_resample reader_rs;
+static uint32_t reader_in_rate; // source rate reader_rs is set up for, 0 if none
+static uint32_t reader_pos;     // next source frame of the current track
+static uint32_t reader_loop_start;
+static uint32_t reader_loop_end; // 0 when the current track does not loop
+
+// Seek and loop requests, taken by the reader thread before each block
+static K_MUTEX_DEFINE(reader_ctl_lock);
+static bool reader_seek_pending;
+static struct reader_pos reader_seek_req;
+static bool reader_loop_changed;
+static bool reader_loop_on;
+static struct reader_pos reader_loop_req[2];
+
+/* ----- private function declarations ----- */
+static void reader_thread(void *arg1, void *arg2, void *arg3);
+static void reader_block_free(void *block);
+static bool reader_queue_put(struct reader_item *item);
+static void reader_queue_flush(void);
+static int reader_open_next(void);
+static int reader_switch_track(void);
+static int reader_resolve(const WavFile *wav, const struct reader_pos *p, uint32_t *frame);
+static int reader_seek(uint32_t frame);
+static void reader_loop_update(void);
+static bool reader_take_skip(void);
+static void reader_take_requests(void);
+static size_t reader_loop_limit(size_t frames);
+static size_t reader_fill_decoded(WavFile *wav, int16_t *out, size_t room);
+static size_t reader_fill(int16_t *block);
+
+/* ----- function definitions ----- */
+static void reader_block_free(void *block)
+{
+	k_mem_slab_free(reader_slab, block);
+	atomic_dec(&reader_held);
+}
+
+static bool reader_queue_put(struct reader_item *item)
+{
+	while (atomic_get(&reader_running)) {
+		if (k_msgq_put(&reader_queue, item, K_MSEC(READER_WAIT_MS)) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void reader_queue_flush(void)
+{
+	struct reader_item item;
+
+	while (k_msgq_get(&reader_queue, &item, K_NO_WAIT) == 0) {
+		if (item.block != NULL) {
+			reader_block_free(item.block);
+		}
+	}
+}
+
+// Open the first playable playlist entry as the next track
+static int reader_open_next(void)
+{
+	WavFile *next = &tracks[track_cur ^ 1];
+	char name[PLAYLIST_NAME_MAX];
+
+	while (!next->is_open && playlist_pop(name, sizeof(name)) == 0) {
+		if (read_wav_file(name, next) < 0) {
+			LOG_WRN("Skipping %s", name);
+		} else {
+			LOG_INF("Next track: %s", name);
+		}
+	}
+
+	return next->is_open ? 0 : -ENOENT;
+}
+
+// Close the current track and continue with the next one, -ENOENT at the end of the playlist
+static int reader_switch_track(void)
+{
+	WavFile *wav;
+	int ret;
+
+	close_wav_file(&tracks[track_cur]);
+
+	for (;;) {
+		reader_open_next();
+		track_cur ^= 1;
+		wav = &tracks[track_cur];
+		if (!wav->is_open) {
+			return -ENOENT;
+		}
+		wav_set_read_buffer(wav, reader_stage, sizeof(reader_stage));
+
+		reader_compressed = audio_decode_needed(&wav->format);
+		if (reader_compressed) {
+			ret = audio_decode_init(&reader_dec, &wav->format);
+		} else {
+			ret = audio_convert_init(&reader_cv, &wav->format);
+		}
+		if (ret == 0 && wav->format.sample_rate != reader_in_rate) {
+			// Tracks at the same rate keep the filter history and join seamlessly
+			ret = audio_resample_init(&reader_rs, wav->format.sample_rate,
+						  reader_out_rate);
+			reader_in_rate = ret == 0 ? wav->format.sample_rate : 0;
+		}
+		if (ret == 0) {
+			reader_pos = 0;
+			reader_loop_update();
+			return 0;
+		}
+
+		close_wav_file(wav);
+	}
+}
+
+static int reader_resolve(const WavFile *wav, const struct reader_pos *p, uint32_t *frame)
+{
+	switch (p->unit) {
+	case AUDIO_POS_MS:
+		*frame = MIN((uint64_t)p->pos * wav->format.sample_rate / MSEC_PER_SEC, UINT32_MAX);
+		return 0;
+	case AUDIO_POS_FRAMES:
+		*frame = p->pos;
+		return 0;
+	case AUDIO_POS_CUE:
+		if (p->pos < 1 || p->pos > wav->cue_count) {
+			return -ENOENT;
+		}
+		*frame = wav->cues[p->pos - 1];
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int reader_seek(uint32_t frame)
+{
+	WavFile *wav = &tracks[track_cur];
+	int ret;
+
+	if (reader_compressed) {
+		ret = audio_decode_seek(&reader_dec, wav, frame);
+	} else {
+		ret = wav_seek(wav, MIN((uint64_t)frame * reader_cv.frame_bytes, UINT32_MAX));
+	}
+	if (ret == 0) {
+		reader_pos = frame;
+	}
+
+	return ret;
+}
+
+// Resolve the loop against the current track
+static void reader_loop_update(void)
+{
+	const WavFile *wav = &tracks[track_cur];
+	struct reader_pos req[2];
+	uint32_t start;
+	uint32_t end;
+	bool on;
+
+	k_mutex_lock(&reader_ctl_lock, K_FOREVER);
+	on = reader_loop_on;
+	memcpy(req, reader_loop_req, sizeof(req));
+	k_mutex_unlock(&reader_ctl_lock);
+
+	reader_loop_end = 0;
+	if (!on) {
+		return;
+	}
+
+	if (reader_resolve(wav, &req[0], &start) < 0 || reader_resolve(wav, &req[1], &end) < 0 ||
+	    start >= end) {
+		LOG_WRN("Loop does not fit this track, playing through");
+		return;
+	}
+
+	reader_loop_start = start;
+	reader_loop_end = end;
+}
+
+/*
+ * Act on a skip request, returns false when the reader should end instead. Done
+ * here, between blocks, so no block of the old track is queued after the flush.
+ */
+static bool reader_take_skip(void)
+{
+	atomic_val_t skip;
+
+	// Leave at the end of the playlist, unless a skip has just brought more tracks
+	if (!tracks[track_cur].is_open && atomic_cas(&reader_skip, 0, READER_SKIP_ENDED)) {
+		return false;
+	}
+
+	skip = atomic_clear(&reader_skip);
+	if (skip == 0) {
+		return true;
+	}
+
+	// Drop what was read ahead of the old track so the switch is heard at once, the
+	// resampler history belongs to it too
+	reader_queue_flush();
+	audio_resample_reset(&reader_rs);
+
+	if (skip == READER_SKIP_RELOAD) {
+		// The pre-opened track came from the replaced playlist
+		close_wav_file(&tracks[track_cur ^ 1]);
+	}
+	reader_switch_track();
+
+	return true;
+}
+
+static void reader_take_requests(void)
+{
+	struct reader_pos seek;
+	bool seek_pending;
+	bool loop_changed;
+	uint32_t frame;
+	int ret;
+
+	k_mutex_lock(&reader_ctl_lock, K_FOREVER);
+	seek_pending = reader_seek_pending;
+	seek = reader_seek_req;
+	loop_changed = reader_loop_changed;
+	reader_seek_pending = false;
+	reader_loop_changed = false;
+	k_mutex_unlock(&reader_ctl_lock);
+
+	if (loop_changed) {
+		reader_loop_update();
+	}
+
+	if (seek_pending) {
+		ret = reader_resolve(&tracks[track_cur], &seek, &frame);
+		if (ret == 0) {
+			ret = reader_seek(frame);
+		}
+		if (ret < 0) {
+			LOG_WRN("Cannot seek: %d", ret);
+			return;
+		}
+
+		// Drop what was read ahead of the old position, so the jump is heard at once.
+		// Done here, between blocks, so no block filled before the seek is queued
+		// after the flush. The resampler history belongs to the old position too.
+		reader_queue_flush();
+		audio_resample_reset(&reader_rs);
+	}
+}
+
+// Limit a read to the loop end, seeking back to the loop start once it is reached
+static size_t reader_loop_limit(size_t frames)
+{
+	if (reader_loop_end == 0) {
+		return frames;
+	}
+
+	if (reader_pos >= reader_loop_end) {
+		int ret = reader_seek(reader_loop_start);
+
+		if (ret < 0) {
+			LOG_WRN("Cannot loop this track: %d", ret);
+			reader_loop_end = 0;
+			return frames;
+		}
+	}
+
+	return MIN(frames, reader_loop_end - reader_pos);
+}
+
+/*
+ * Fill part of a block from a compressed track. The decoder writes 16-bit frames
+ * straight into the block, mono is then spread to stereo in place. Returns the
+ * number of stereo frames added, 0 once the track has ended.
+ */
+static size_t reader_fill_decoded(WavFile *wav, int16_t *out, size_t room)
+{
+	// Decoded frames must fit the block before they are resampled
+	size_t frames = reader_loop_limit(MIN(room, audio_resample_max_input(&reader_rs, room)));
+	uint32_t start;
+	int n;
+
+	if (wav->data_remaining < PREOPEN_BLOCKS * audio_decode_bytes(&reader_dec, frames)) {
+		reader_open_next();
+	}
+
+	n = audio_decode_frames(&reader_dec, wav, out, frames);
+	if (n < 0) {
+		LOG_ERR("Failed to decode: %d", n);
+	}
+	if (n <= 0) {
+		reader_switch_track();
+		return 0;
+	}
+	reader_pos += n;
+
+	if (reader_dec.channels == 1) {
+		start = audio_stats_now();
+		audio_convert_mono_to_stereo(out, n);
+		audio_stats_stage(AUDIO_STAGE_CONVERT, start);
+	}
+
+	start = audio_stats_now();
+	n = audio_resample_block(&reader_rs, out, n, room);
+	audio_stats_stage(AUDIO_STAGE_RESAMPLE, start);
+
+	return n;
+}
+
+/*
+ * Fill a block with converted frames. When the current track ends part way, the
+ * rest of the block is filled from the next track, so there is no gap between
+ * them. Returns the number of stereo frames at the start of block.
+ */
+static size_t reader_fill(int16_t *block)
+{
+	size_t capacity = reader_block_size / AUDIO_OUT_FRAME_BYTES;
+	size_t filled = 0;
+	uint32_t start;
+
+	while (filled < capacity && tracks[track_cur].is_open) {
+		WavFile *wav = &tracks[track_cur];
+		int16_t *out = block + filled * AUDIO_OUT_CHANNELS;
+		size_t room = capacity - filled;
+		size_t frames;
+
+		if (reader_compressed) {
+			if (audio_resample_max_input(&reader_rs, room) == 0) {
+				break;
+			}
+			filled += reader_fill_decoded(wav, out, room);
+			continue;
+		}
+
+		frames = MIN(audio_convert_max_frames(&reader_cv, room * AUDIO_OUT_FRAME_BYTES),
+			     audio_resample_max_input(&reader_rs, room));
+
+		if (frames == 0) {
+			// Too little room left for the resampler, send the block short
+			break;
+		}
+		frames = reader_loop_limit(frames);
+
+		// Parse the next header while this track still has blocks to play
+		if (wav->data_remaining < PREOPEN_BLOCKS * frames * reader_cv.frame_bytes) {
+			reader_open_next();
+		}
+
+		// Copy raw frames from the staging buffer to the free part of the block and
+		// convert them in place
+		int32_t num_read = read_data(wav, out, frames * reader_cv.frame_bytes);
+		if (num_read < 0) {
+			LOG_ERR("Failed to read data: %d", num_read);
+			audio_stats_event(AUDIO_EVENT_READ_ERROR);
+		}
+		if (num_read < reader_cv.frame_bytes) {
+			reader_switch_track();
+			continue;
+		}
+		reader_pos += num_read / reader_cv.frame_bytes;
+
+		start = audio_stats_now();
+		audio_convert_block(&reader_cv, out, num_read / reader_cv.frame_bytes);
+		audio_stats_stage(AUDIO_STAGE_CONVERT, start);
+
+		start = audio_stats_now();
+		filled += audio_resample_block(&reader_rs, out, num_read / reader_cv.frame_bytes,
+					       room);
+		audio_stats_stage(AUDIO_STAGE_RESAMPLE, start);
+	}
+
+	return filled;
+}
+
+static void reader_thread(void *arg1, void *arg2, void *arg3)
+{
+	struct reader_item item;
+	uint32_t start;
+	int ret;
+
+	while (atomic_get(&reader_running)) {
+		if (!reader_take_skip()) {
+			break;
+		}
+		if (!tracks[track_cur].is_open) {
+			// A skip past the last track, the next pass ends the reader
+			continue;
+		}
+		reader_take_requests();
+
+		start = audio_stats_now();
+		ret = k_mem_slab_alloc(reader_slab, &item.block, K_MSEC(READER_WAIT_MS));
+		audio_stats_stage(AUDIO_STAGE_SLAB_WAIT, start);
+		if (ret == -EAGAIN) {
+			continue;
+		} else if (ret < 0) {
+			LOG_ERR("Failed to allocate block: %d", ret);
+			break;
+		}
+		atomic_inc(&reader_held);
+		audio_stats_slab(reader_slab);
+
+		start = audio_stats_now();
+		item.size = reader_fill(item.block) * AUDIO_OUT_FRAME_BYTES;
+		audio_stats_stage(AUDIO_STAGE_REFILL, start);
+		if (item.size == 0) {
+			// End of the playlist, or the resampler kept these few frames as history
+			reader_block_free(item.block);
+			continue;
+		}
+
+		// Converted samples were written by the CPU, clean them for the I2S DMA
+		audio_mem_dma_read_prepare(item.block, item.size);
+
+		if (!reader_queue_put(&item)) {
+			reader_block_free(item.block);
+			break;
+		}
+	}
+
+	// Tell the writer that no more blocks will follow
+	item.block = NULL;
+	item.size = 0;
+	reader_queue_put(&item);
+}
+
+int audio_reader_start(struct k_mem_slab *slab, size_t block_size, uint32_t sample_rate)
+{
+	int ret;
+
+	if (!atomic_cas(&reader_running, 0, 1)) {
+		return -EALREADY;
+	}
+
+	reader_slab = slab;
+	reader_block_size = block_size;
+	reader_out_rate = sample_rate;
+	reader_in_rate = 0;
+	atomic_clear(&reader_skip);
+	k_msgq_purge(&reader_queue);
+
+	ret = reader_switch_track();
+	if (ret < 0) {
+		atomic_clear(&reader_running);
+		return ret;
+	}
+
+	k_thread_create(&reader_thread_data, reader_thread_stack,
+			K_THREAD_STACK_SIZEOF(reader_thread_stack), reader_thread, NULL, NULL, NULL,
+			CONFIG_AUDIO_READER_THREAD_PRIORITY, 0, K_NO_WAIT);
+	k_thread_name_set(&reader_thread_data, "audio_reader");
+
+	return 0;
+}
+
+void audio_reader_stop(void)
+{
+	if (reader_slab == NULL) {
+		return;
+	}
+
+	atomic_set(&reader_running, 0);
+
+	// Free queued blocks so a reader waiting on the slab or the queue can exit
+	reader_queue_flush();
+	k_thread_join(&reader_thread_data, K_FOREVER);
+	reader_queue_flush();
+
+	close_wav_file(&tracks[0]);
+	close_wav_file(&tracks[1]);
+}
+
+int audio_reader_skip(bool reload)
+{
+	atomic_val_t skip = reload ? READER_SKIP_RELOAD : READER_SKIP_NEXT;
+	atomic_val_t cur;
+
+	if (!atomic_get(&reader_running)) {
+		return -ENODEV;
+	}
+
+	// The reader takes the request before its next block, unless it has already ended
+	do {
+		cur = atomic_get(&reader_skip);
+		if (cur == READER_SKIP_ENDED) {
+			return -ENODEV;
+		}
+	} while (!atomic_cas(&reader_skip, cur, MAX(cur, skip)));
+
+	return 0;
+}
+
+int audio_reader_seek(uint32_t pos, enum audio_pos_unit unit)
+{
+	if (!atomic_get(&reader_running)) {
+		return -ENODEV;
+	}
+
+	k_mutex_lock(&reader_ctl_lock, K_FOREVER);
+	reader_seek_req.pos = pos;
+	reader_seek_req.unit = unit;
+	reader_seek_pending = true;
+	k_mutex_unlock(&reader_ctl_lock);
+
+	return 0;
+}
+
+int audio_reader_loop(uint32_t start, uint32_t end, enum audio_pos_unit unit)
+{
+	if (start >= end) {
+		return -EINVAL;
+	}
+
+	k_mutex_lock(&reader_ctl_lock, K_FOREVER);
+	reader_loop_req[0].pos = start;
+	reader_loop_req[0].unit = unit;
+	reader_loop_req[1].pos = end;
+	reader_loop_req[1].unit = unit;
+	reader_loop_on = true;
+	reader_loop_changed = true;
+	k_mutex_unlock(&reader_ctl_lock);
+
+	return 0;
+}
+
+void audio_reader_loop_clear(void)
+{
+	k_mutex_lock(&reader_ctl_lock, K_FOREVER);
+	reader_loop_on = false;
+	reader_loop_changed = true;
+	k_mutex_unlock(&reader_ctl_lock);
+}
+
+int audio_reader_get(void **block, size_t *size, k_timeout_t timeout)
+{
+	struct reader_item item;
+	int ret;
+
+	ret = k_msgq_get(&reader_queue, &item, timeout);
+	if (ret < 0) {
+		return ret;
+	}
+
+	*block = item.block;
+	*size = item.size;
+	if (item.block != NULL) {
+		atomic_dec(&reader_held);
+	}
+
+	return 0;
+}
+
+uint32_t audio_reader_held(void)
+{
+	return atomic_get(&reader_held);
+}
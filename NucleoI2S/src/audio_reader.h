@@ -0,0 +1,71 @@
+#ifndef AUDIO_READER_H_
+#define AUDIO_READER_H_
+
+#include <zephyr/kernel.h>
+
+/*
+ * SD-card prefetch stage.
+ *
+ * A dedicated thread allocates blocks from the I2S block slab, fills them from the
+ * playlist, converts them to 16-bit stereo at the bus sample rate in place and
+ * hands them to the I2S writer through a bounded queue of
+ * CONFIG_AUDIO_PREFETCH_DEPTH entries. A slow fs_read only delays the reader; the
+ * writer keeps draining blocks that were read ahead.
+ *
+ * The next track is opened before the current one ends and a block that spans the
+ * end of a track is completed from the next one, so tracks play back to back.
+ */
+
+/*
+ * Start playing the playlist, blocks of block_size bytes are taken from slab and
+ * resampled to sample_rate. Blocks of sources wider than 16-bit stereo or at a
+ * lower sample rate may come back shorter than block_size. Returns -ENOENT if no
+ * playlist entry could be opened.
+ */
+int audio_reader_start(struct k_mem_slab *slab, size_t block_size, uint32_t sample_rate);
+
+// Stop the prefetch thread and return every queued block to the slab
+void audio_reader_stop(void);
+
+/*
+ * Drop the rest of the current track and what was read ahead of it. With reload
+ * the track already opened ahead is dropped too and playback continues from the
+ * head of the playlist. The reader thread acts on it before its next block.
+ * Returns -ENODEV when the reader is stopped or has already reached the end of
+ * the playlist, the stream then ends and must be started again.
+ */
+int audio_reader_skip(bool reload);
+
+// Units of seek and loop positions
+enum audio_pos_unit {
+	AUDIO_POS_MS,
+	AUDIO_POS_FRAMES, // source frames, sample accurate
+	AUDIO_POS_CUE,    // cue point of the WAV file, counting from 1
+};
+
+/*
+ * Continue the current track at pos and drop what was read ahead, so the jump is
+ * heard at once. The position is resolved by the reader thread against the track
+ * playing then, failures are only logged. Returns -ENODEV when not playing.
+ */
+int audio_reader_seek(uint32_t pos, enum audio_pos_unit unit);
+
+/*
+ * Repeat frames [start, end) of each track until cleared, tracks the loop does not
+ * fit play through. At the loop end the reader seeks back within the same block;
+ * blocks are read ahead of the writer, so the wrap plays without a gap. Returns
+ * -EINVAL when end does not follow start.
+ */
+int audio_reader_loop(uint32_t start, uint32_t end, enum audio_pos_unit unit);
+void audio_reader_loop_clear(void);
+
+/*
+ * Get the next filled block. At the end of the playlist *block is set to NULL and *size to 0.
+ * Ownership of the block passes to the caller (normally straight into i2s_write).
+ */
+int audio_reader_get(void **block, size_t *size, k_timeout_t timeout);
+
+// Slab blocks the reader holds, being filled or queued for the writer
+uint32_t audio_reader_held(void);
+
+#endif /* AUDIO_READER_H_ */
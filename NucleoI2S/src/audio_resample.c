@@ -0,0 +1,251 @@
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+
+#include "audio_resample.h"
+#include "audio_convert.h"
+
+#ifdef CONFIG_CMSIS_DSP
+#include <arm_math.h>
+#endif
+
+/* ----- module registers ----- */
+LOG_MODULE_REGISTER(audio_resample, LOG_LEVEL_INF);
+
+/* ----- definitions ----- */
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define TAPS         CONFIG_AUDIO_RESAMPLE_TAPS
+#define CHUNK_FRAMES AUDIO_RESAMPLE_CHUNK_FRAMES
+
+// Passband edge as a fraction of the lower of the two Nyquist frequencies
+#define CUTOFF_RATIO 0.90f
+
+BUILD_ASSERT(TAPS % 4 == 0, "AUDIO_RESAMPLE_TAPS must be a multiple of 4");
+BUILD_ASSERT(AUDIO_OUT_CHANNELS == 2, "The resampler works on stereo frames");
+
+/* ----- private static variables and types ----- */
+
+// Ratio of the most recent conversion, shown by 'audio resample'
+static struct {
+	uint16_t up;
+	uint16_t down;
+} resample_stats;
+
+/* ----- private function declarations ----- */
+static uint32_t resample_gcd(uint32_t a, uint32_t b);
+static void resample_design(int16_t *coefs, uint16_t up, uint16_t down);
+static inline int16_t resample_dot(const int16_t *coefs, const int16_t *x);
+
+/* ----- function definitions ----- */
+static uint32_t resample_gcd(uint32_t a, uint32_t b)
+{
+	while (b != 0) {
+		uint32_t t = a % b;
+
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+/*
+ * Blackman windowed-sinc prototype at up times the input rate, split into up
+ * branches. Every branch is normalized to unity DC gain so the interpolation
+ * phase does not modulate the level.
+ */
+static void resample_design(int16_t *coefs, uint16_t up, uint16_t down)
+{
+	const uint32_t len = (uint32_t)up * TAPS;
+	const float fc = CUTOFF_RATIO * 0.5f / MAX(up, down);
+	const float center = (len - 1) / 2.0f;
+
+	for (uint32_t p = 0; p < up; p++) {
+		float taps[TAPS];
+		float sum = 0.0f;
+
+		for (uint32_t k = 0; k < TAPS; k++) {
+			uint32_t n = p + k * up;
+			float x = 2.0f * fc * ((float)n - center);
+			float sinc = (x == 0.0f) ? 1.0f : sinf(M_PI * x) / (M_PI * x);
+			float w = 0.42f - 0.5f * cosf(2.0f * M_PI * n / (len - 1)) +
+				  0.08f * cosf(4.0f * M_PI * n / (len - 1));
+
+			taps[k] = sinc * w;
+			sum += taps[k];
+		}
+
+		// Time reversed so a branch is a plain dot product with the history
+		for (uint32_t k = 0; k < TAPS; k++) {
+			float q = roundf(taps[k] / sum * 32768.0f);
+
+			coefs[p * TAPS + (TAPS - 1 - k)] = (int16_t)CLAMP(q, INT16_MIN, INT16_MAX);
+		}
+	}
+}
+
+static inline int16_t resample_dot(const int16_t *coefs, const int16_t *x)
+{
+	int64_t acc;
+
+#ifdef CONFIG_CMSIS_DSP
+	arm_dot_prod_q15(coefs, x, TAPS, &acc);
+#else
+	acc = 0;
+	for (size_t k = 0; k < TAPS; k++) {
+		acc += (int32_t)coefs[k] * x[k];
+	}
+#endif
+
+	acc = (acc + (1 << 14)) >> 15;
+
+	return (int16_t)CLAMP(acc, INT16_MIN, INT16_MAX);
+}
+
+int audio_resample_init(struct audio_resample *rs, uint32_t in_rate, uint32_t out_rate)
+{
+	uint32_t g;
+	uint32_t up;
+	uint32_t down;
+
+	if (in_rate == 0 || out_rate == 0) {
+		return -EINVAL;
+	}
+
+	g = resample_gcd(in_rate, out_rate);
+	up = out_rate / g;
+	down = in_rate / g;
+
+	audio_resample_reset(rs);
+	rs->bypass = (up == down);
+
+	resample_stats.up = up;
+	resample_stats.down = down;
+
+	if (rs->bypass) {
+		return 0;
+	}
+
+	if (up > CONFIG_AUDIO_RESAMPLE_MAX_PHASES || down > UINT16_MAX) {
+		LOG_ERR("Unsupported ratio %u/%u (%u Hz -> %u Hz)", up, down, in_rate, out_rate);
+		return -ENOTSUP;
+	}
+
+	if (rs->coefs == NULL || rs->up != up || rs->down != down) {
+		k_free(rs->coefs);
+		rs->coefs = k_malloc(up * TAPS * sizeof(int16_t));
+		if (rs->coefs == NULL) {
+			LOG_ERR("No memory for %u polyphase branches", up);
+			return -ENOMEM;
+		}
+
+		resample_design(rs->coefs, up, down);
+	}
+
+	rs->up = up;
+	rs->down = down;
+	LOG_INF("Resampling %u Hz -> %u Hz (%u/%u, %u taps per branch)", in_rate, out_rate, up,
+		down, TAPS);
+
+	return 0;
+}
+
+void audio_resample_reset(struct audio_resample *rs)
+{
+	rs->phase = 0;
+	rs->pos = TAPS - 1;
+	memset(rs->hist, 0, sizeof(rs->hist));
+}
+
+void audio_resample_free(struct audio_resample *rs)
+{
+	k_free(rs->coefs);
+	rs->coefs = NULL;
+}
+
+size_t audio_resample_max_input(const struct audio_resample *rs, size_t out_frames)
+{
+	if (rs->bypass) {
+		return out_frames;
+	}
+
+	// One output more than in * up / down can come from the carried phase, and the
+	// input shares the block with the output
+	return out_frames > 1 ? MIN(((out_frames - 1) * rs->down) / rs->up, out_frames) : 0;
+}
+
+size_t audio_resample_block(struct audio_resample *rs, int16_t *block, size_t in_frames,
+			    size_t capacity)
+{
+	const int16_t *in = block;
+	size_t produced = 0;
+
+	if (rs->bypass) {
+		return in_frames;
+	}
+
+	/*
+	 * Outputs are written from the start of the block while the input is consumed
+	 * ahead of them. Upsampling produces more frames than it consumes, so move the
+	 * input to the end of the block first.
+	 */
+	if (rs->up > rs->down) {
+		in = block + (capacity - in_frames) * AUDIO_OUT_CHANNELS;
+		memmove((int16_t *)in, block, in_frames * AUDIO_OUT_FRAME_BYTES);
+	}
+
+	while (in_frames > 0) {
+		size_t chunk = MIN(in_frames, CHUNK_FRAMES);
+
+		for (size_t i = 0; i < chunk; i++) {
+			rs->hist[0][TAPS - 1 + i] = in[2 * i];
+			rs->hist[1][TAPS - 1 + i] = in[2 * i + 1];
+		}
+		in += chunk * AUDIO_OUT_CHANNELS;
+		in_frames -= chunk;
+
+		while (rs->pos < TAPS - 1 + chunk) {
+			const int16_t *coefs = &rs->coefs[rs->phase * TAPS];
+			size_t first = rs->pos - (TAPS - 1);
+
+			block[2 * produced] = resample_dot(coefs, &rs->hist[0][first]);
+			block[2 * produced + 1] = resample_dot(coefs, &rs->hist[1][first]);
+			produced++;
+
+			rs->phase += rs->down;
+			rs->pos += rs->phase / rs->up;
+			rs->phase %= rs->up;
+		}
+
+		// Keep the newest TAPS - 1 samples as history for the next chunk
+		memmove(rs->hist[0], &rs->hist[0][chunk], (TAPS - 1) * sizeof(int16_t));
+		memmove(rs->hist[1], &rs->hist[1][chunk], (TAPS - 1) * sizeof(int16_t));
+		rs->pos -= chunk;
+	}
+
+	return produced;
+}
+
+static int cmd_resample(const struct shell *shell, size_t argc, char **argv)
+{
+	if (resample_stats.up == resample_stats.down) {
+		shell_print(shell, "Sample-rate converter bypassed");
+		return 0;
+	}
+
+	// The cycle cost per block is reported by 'audio stats'
+	shell_print(shell, "Ratio %u/%u, %u taps per branch", resample_stats.up,
+		    resample_stats.down, TAPS);
+
+	return 0;
+}
+
+SHELL_SUBCMD_ADD((audio), resample, NULL, "Show the sample-rate converter ratio", cmd_resample,
+		 1, 0);
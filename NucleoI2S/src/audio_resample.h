@@ -0,0 +1,53 @@
+#ifndef AUDIO_RESAMPLE_H_
+#define AUDIO_RESAMPLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Streaming rational sample-rate converter for 16-bit stereo.
+ *
+ * The input is upsampled by up and decimated by down through a polyphase
+ * FIR bank of CONFIG_AUDIO_RESAMPLE_TAPS taps per phase, so only the output
+ * samples are ever computed. Filter history and phase are carried across calls,
+ * so blocks of any size can be fed back to back.
+ */
+
+// Input frames moved into the filter history per pass
+#define AUDIO_RESAMPLE_CHUNK_FRAMES 128
+
+struct audio_resample {
+	uint16_t up;
+	uint16_t down;
+	uint16_t phase; // polyphase branch of the next output sample
+	uint16_t pos;   // history index of the newest input sample of the next output
+	bool bypass;
+	int16_t *coefs; // up branches of CONFIG_AUDIO_RESAMPLE_TAPS time-reversed taps
+	int16_t hist[2][CONFIG_AUDIO_RESAMPLE_TAPS - 1 + AUDIO_RESAMPLE_CHUNK_FRAMES];
+};
+
+/*
+ * Set up conversion from in_rate to out_rate and clear the filter history. The
+ * coefficient table is allocated from the system heap and reused while the ratio
+ * stays the same. An rs that was never initialized must be zeroed.
+ */
+int audio_resample_init(struct audio_resample *rs, uint32_t in_rate, uint32_t out_rate);
+
+// Clear the filter history, for input that does not continue the previous block
+void audio_resample_reset(struct audio_resample *rs);
+
+void audio_resample_free(struct audio_resample *rs);
+
+// Largest input frame count that, resampled in place, fits in a block of out_frames
+size_t audio_resample_max_input(const struct audio_resample *rs, size_t out_frames);
+
+/*
+ * Resample in_frames stereo frames at the start of block in place. block must
+ * hold capacity frames and in_frames must not exceed audio_resample_max_input().
+ * Returns the number of output frames at the start of block.
+ */
+size_t audio_resample_block(struct audio_resample *rs, int16_t *block, size_t in_frames,
+			    size_t capacity);
+
+#endif /* AUDIO_RESAMPLE_H_ */
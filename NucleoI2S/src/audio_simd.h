@@ -0,0 +1,21 @@
+#ifndef AUDIO_SIMD_H_
+#define AUDIO_SIMD_H_
+
+/*
+ * Packed 16-bit SIMD (QADD16, PKHBT, SMLAD, ...) is available on cores with the
+ * DSP extension, such as the Cortex-M7. Other targets, such as native_sim, use
+ * the scalar reference kernels, except in test builds that define
+ * AUDIO_SIMD_EMULATE, where the intrinsics are emulated in C so the packed
+ * kernels can be checked on the host.
+ */
+#if defined(CONFIG_CPU_CORTEX_M) && defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+#include <cmsis_core.h>
+#define AUDIO_SIMD 1
+#elif defined(AUDIO_SIMD_EMULATE)
+#include "audio_simd_emul.h"
+#define AUDIO_SIMD 1
+#else
+#define AUDIO_SIMD 0
+#endif
+
+#endif /* AUDIO_SIMD_H_ */
@@ -0,0 +1,316 @@
+#include <zephyr/kernel.h>
+#include <zephyr/init.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+
+#include "audio_stats.h"
+
+/* ----- module registers ----- */
+LOG_MODULE_REGISTER(audio_stats, LOG_LEVEL_INF);
+
+/* ----- definitions ----- */
+// SysTick and the DWT counter both run at the core clock on Cortex-M
+#define CYCLES_PER_US (sys_clock_hw_cycles_per_sec() / USEC_PER_SEC)
+
+/* ----- private static variables and types ----- */
+struct stage_stats {
+	atomic_t calls;
+	atomic_t cycles_last;
+	atomic_t cycles_max;
+	atomic_t total_lo; // cycle total, low word
+	atomic_t total_hi; // carries out of total_lo
+};
+
+// How 'audio stats' reports a stage
+enum stage_kind {
+	STAGE_BLOCKED, // a thread waiting for a buffer, no CPU time
+	STAGE_IO,      // card access, mostly spent waiting for the card
+	STAGE_CPU,
+	STAGE_BLOCK,   // whole reader block, covers I/O and CPU stages
+	STAGE_KIND_COUNT,
+};
+
+static struct stage_stats stages[AUDIO_STAGE_COUNT];
+static atomic_t events[AUDIO_EVENT_COUNT];
+static atomic_t read_hist[AUDIO_STATS_READ_BUCKETS];
+static atomic_t slab_used_min = ATOMIC_INIT(-1);
+static atomic_t slab_used_max;
+static int64_t stats_since;
+#ifdef CONFIG_SCHED_THREAD_USAGE_ALL
+static k_thread_runtime_stats_t cpu_since;
+#endif
+
+static const char *const stage_names[AUDIO_STAGE_COUNT] = {
+	[AUDIO_STAGE_SLAB_WAIT] = "slab wait",
+	[AUDIO_STAGE_OPEN] = "open",
+	[AUDIO_STAGE_READ] = "fs_read",
+	[AUDIO_STAGE_REFILL] = "refill",
+	[AUDIO_STAGE_CONVERT] = "convert",
+	[AUDIO_STAGE_DECODE_ADPCM] = "adpcm",
+	[AUDIO_STAGE_DECODE_FLAC] = "flac",
+	[AUDIO_STAGE_RESAMPLE] = "resample",
+	[AUDIO_STAGE_TONE] = "tone",
+	[AUDIO_STAGE_MIX] = "mix",
+	[AUDIO_STAGE_EQ] = "eq",
+	[AUDIO_STAGE_LIMITER] = "limiter",
+	[AUDIO_STAGE_I2S_WAIT] = "i2s_write",
+	[AUDIO_STAGE_CAPTURE_WRITE] = "fs_write",
+};
+
+static const uint8_t stage_kinds[AUDIO_STAGE_COUNT] = {
+	[AUDIO_STAGE_SLAB_WAIT] = STAGE_BLOCKED,
+	[AUDIO_STAGE_OPEN] = STAGE_IO,
+	[AUDIO_STAGE_READ] = STAGE_IO,
+	[AUDIO_STAGE_REFILL] = STAGE_BLOCK,
+	[AUDIO_STAGE_CONVERT] = STAGE_CPU,
+	[AUDIO_STAGE_DECODE_ADPCM] = STAGE_CPU,
+	[AUDIO_STAGE_DECODE_FLAC] = STAGE_CPU,
+	[AUDIO_STAGE_RESAMPLE] = STAGE_CPU,
+	[AUDIO_STAGE_TONE] = STAGE_CPU,
+	[AUDIO_STAGE_MIX] = STAGE_CPU,
+	[AUDIO_STAGE_EQ] = STAGE_CPU,
+	[AUDIO_STAGE_LIMITER] = STAGE_CPU,
+	[AUDIO_STAGE_I2S_WAIT] = STAGE_BLOCKED,
+	[AUDIO_STAGE_CAPTURE_WRITE] = STAGE_IO,
+};
+
+// Heading and share column of each kind
+static const char *const kind_names[STAGE_KIND_COUNT][2] = {
+	[STAGE_BLOCKED] = {"Blocked", "time %"},
+	[STAGE_IO] = {"Card I/O", "time %"},
+	[STAGE_CPU] = {"CPU", "cpu %"},
+	[STAGE_BLOCK] = {"Reader blocks (I/O and CPU)", "time %"},
+};
+
+static const char *const event_names[AUDIO_EVENT_COUNT] = {
+	[AUDIO_EVENT_UNDERRUN] = "I2S underruns",
+	[AUDIO_EVENT_I2S_ERROR] = "I2S errors",
+	[AUDIO_EVENT_LATE_BLOCK] = "Late blocks",
+	[AUDIO_EVENT_READ_ERROR] = "Read errors",
+	[AUDIO_EVENT_CAPTURE_DROP] = "Capture drops",
+};
+
+/* ----- private function declarations ----- */
+static void stats_update_max(atomic_t *target, uint32_t value);
+static void stats_update_min(atomic_t *target, uint32_t value);
+static uint64_t stats_total_get(const struct stage_stats *s);
+
+/* ----- function definitions ----- */
+static void stats_update_max(atomic_t *target, uint32_t value)
+{
+	atomic_val_t old;
+
+	do {
+		old = atomic_get(target);
+		if (value <= (uint32_t)old) {
+			return;
+		}
+	} while (!atomic_cas(target, old, value));
+}
+
+// -1 reads as UINT32_MAX, so an unset minimum is always replaced
+static void stats_update_min(atomic_t *target, uint32_t value)
+{
+	atomic_val_t old;
+
+	do {
+		old = atomic_get(target);
+		if (value >= (uint32_t)old) {
+			return;
+		}
+	} while (!atomic_cas(target, old, value));
+}
+
+/*
+ * The loop catches a carry landing between the two reads. A read between the low
+ * word wrapping and its carry landing still comes out 2^32 cycles short, for that
+ * read only, which is fine for totals that are only displayed.
+ */
+static uint64_t stats_total_get(const struct stage_stats *s)
+{
+	uint32_t hi;
+	uint32_t lo;
+
+	do {
+		hi = atomic_get(&s->total_hi);
+		lo = atomic_get(&s->total_lo);
+	} while (hi != (uint32_t)atomic_get(&s->total_hi));
+
+	return (uint64_t)hi << 32 | lo;
+}
+
+void audio_stats_stage(enum audio_stage stage, uint32_t start)
+{
+	struct stage_stats *s = &stages[stage];
+	uint32_t cycles = audio_stats_now() - start;
+
+	atomic_inc(&s->calls);
+	atomic_set(&s->cycles_last, cycles);
+	stats_update_max(&s->cycles_max, cycles);
+	if ((uint32_t)atomic_add(&s->total_lo, cycles) > UINT32_MAX - cycles) {
+		atomic_inc(&s->total_hi);
+	}
+
+	if (stage == AUDIO_STAGE_READ) {
+		uint32_t us = cycles / CYCLES_PER_US;
+		int bucket = us < 128 ? 0 : 32 - __builtin_clz(us) - 7;
+
+		atomic_inc(&read_hist[MIN(bucket, AUDIO_STATS_READ_BUCKETS - 1)]);
+	}
+}
+
+void audio_stats_event(enum audio_event event)
+{
+	atomic_inc(&events[event]);
+}
+
+void audio_stats_slab(struct k_mem_slab *slab)
+{
+	uint32_t used = k_mem_slab_num_used_get(slab);
+
+	stats_update_min(&slab_used_min, used);
+	stats_update_max(&slab_used_max, used);
+}
+
+void audio_stats_stage_get(enum audio_stage stage, struct audio_stage_summary *summary)
+{
+	const struct stage_stats *s = &stages[stage];
+
+	summary->calls = atomic_get(&s->calls);
+	summary->max_us = (uint32_t)atomic_get(&s->cycles_max) / CYCLES_PER_US;
+	summary->total_us = stats_total_get(s) / CYCLES_PER_US;
+}
+
+uint32_t audio_stats_event_count(enum audio_event event)
+{
+	return atomic_get(&events[event]);
+}
+
+void audio_stats_reset(void)
+{
+	for (int i = 0; i < AUDIO_STAGE_COUNT; i++) {
+		atomic_clear(&stages[i].calls);
+		atomic_clear(&stages[i].cycles_last);
+		atomic_clear(&stages[i].cycles_max);
+		atomic_clear(&stages[i].total_lo);
+		atomic_clear(&stages[i].total_hi);
+	}
+	for (int i = 0; i < AUDIO_EVENT_COUNT; i++) {
+		atomic_clear(&events[i]);
+	}
+	for (int i = 0; i < AUDIO_STATS_READ_BUCKETS; i++) {
+		atomic_clear(&read_hist[i]);
+	}
+	atomic_set(&slab_used_min, -1);
+	atomic_clear(&slab_used_max);
+	stats_since = k_uptime_get();
+#ifdef CONFIG_SCHED_THREAD_USAGE_ALL
+	k_thread_runtime_stats_all_get(&cpu_since);
+#endif
+}
+
+int audio_stats_cpu_idle(void)
+{
+#ifdef CONFIG_SCHED_THREAD_USAGE_ALL
+	k_thread_runtime_stats_t now;
+	uint64_t total;
+
+	k_thread_runtime_stats_all_get(&now);
+	total = now.execution_cycles - cpu_since.execution_cycles;
+
+	return total ? (int)((now.idle_cycles - cpu_since.idle_cycles) * 10000 / total) : 0;
+#else
+	return -ENOTSUP;
+#endif
+}
+
+static int audio_stats_init(void)
+{
+#ifdef CONFIG_CPU_CORTEX_M_HAS_DWT
+	// Start the DWT cycle counter, it is normally only enabled by a debugger
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+#ifdef CONFIG_CPU_CORTEX_M7
+	DWT->LAR = 0xC5ACCE55;
+#endif
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+	audio_stats_reset();
+
+	return 0;
+}
+
+SYS_INIT(audio_stats_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+
+static int cmd_stats(const struct shell *shell, size_t argc, char **argv)
+{
+	uint64_t elapsed_us = (k_uptime_get() - stats_since) * USEC_PER_MSEC;
+	uint32_t used_min = atomic_get(&slab_used_min);
+	int idle = audio_stats_cpu_idle();
+
+	shell_print(shell, "Over the last %u ms:", (uint32_t)(elapsed_us / USEC_PER_MSEC));
+	for (int kind = 0; kind < STAGE_KIND_COUNT; kind++) {
+		shell_print(shell, "%s:", kind_names[kind][0]);
+		shell_print(shell, "  %-10s %8s %9s %9s %9s %6s", "stage", "calls", "last us",
+			    "avg us", "max us", kind_names[kind][1]);
+
+		for (int i = 0; i < AUDIO_STAGE_COUNT; i++) {
+			const struct stage_stats *s = &stages[i];
+			uint32_t calls = atomic_get(&s->calls);
+			uint64_t total_us = stats_total_get(s) / CYCLES_PER_US;
+			uint32_t share = elapsed_us ? total_us * 10000 / elapsed_us : 0;
+
+			if (stage_kinds[i] != kind) {
+				continue;
+			}
+
+			shell_print(shell, "  %-10s %8u %9u %9u %9u %3u.%02u", stage_names[i],
+				    calls, (uint32_t)atomic_get(&s->cycles_last) / CYCLES_PER_US,
+				    calls ? (uint32_t)(total_us / calls) : 0,
+				    (uint32_t)atomic_get(&s->cycles_max) / CYCLES_PER_US,
+				    share / 100, share % 100);
+		}
+	}
+
+	if (idle >= 0) {
+		shell_print(shell, "CPU idle: %d.%02d %%", idle / 100, idle % 100);
+	}
+
+	shell_print(shell, "Slab blocks in use: min %d, max %u",
+		    used_min == UINT32_MAX ? -1 : (int)used_min,
+		    (uint32_t)atomic_get(&slab_used_max));
+
+	for (int i = 0; i < AUDIO_EVENT_COUNT; i++) {
+		shell_print(shell, "%s: %u", event_names[i], (uint32_t)atomic_get(&events[i]));
+	}
+
+	shell_print(shell, "fs_read latency:");
+	for (int i = 0; i < AUDIO_STATS_READ_BUCKETS; i++) {
+		if (i < AUDIO_STATS_READ_BUCKETS - 1) {
+			shell_print(shell, "  < %6u us: %u", 128U << i,
+				    (uint32_t)atomic_get(&read_hist[i]));
+		} else {
+			shell_print(shell, "  >=%6u us: %u", 64U << i,
+				    (uint32_t)atomic_get(&read_hist[i]));
+		}
+	}
+
+	return 0;
+}
+
+static int cmd_stats_reset(const struct shell *shell, size_t argc, char **argv)
+{
+	audio_stats_reset();
+	shell_print(shell, "Statistics cleared");
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(stats_cmds,
+			       SHELL_CMD(reset, NULL, "Clear all statistics", cmd_stats_reset),
+			       SHELL_SUBCMD_SET_END);
+
+SHELL_SUBCMD_ADD((audio), stats, &stats_cmds,
+		 "Show underruns, slab watermarks, fs_read latency, blocked and CPU time per "
+		 "stage and CPU idle time",
+		 cmd_stats, 1, 0);
@@ -0,0 +1,91 @@
+#ifndef AUDIO_STATS_H_
+#define AUDIO_STATS_H_
+
+#include <stdint.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+
+#ifdef CONFIG_CPU_CORTEX_M_HAS_DWT
+#include <cmsis_core.h>
+#elif defined(CONFIG_NATIVE_LIBRARY)
+#include "host_clock.h"
+#endif
+
+/*
+ * Always-on pipeline instrumentation, reported by 'audio stats'.
+ *
+ * Every update is a handful of atomic operations, so the hooks stay in release
+ * builds. A stage may be timed from several threads, the reader and the shell both
+ * open and read files. Its 64-bit cycle total is kept as two atomic_t words, the
+ * high one counting the carries out of the low one.
+ */
+
+enum audio_stage {
+	AUDIO_STAGE_SLAB_WAIT, // reader blocked in k_mem_slab_alloc
+	AUDIO_STAGE_OPEN,      // read_wav_file up to the first sample
+	AUDIO_STAGE_READ,      // one fs_read of sample data
+	AUDIO_STAGE_REFILL,    // read, convert and resample of one output block
+	AUDIO_STAGE_CONVERT,
+	AUDIO_STAGE_DECODE_ADPCM, // decode of one block, reads excluded
+	AUDIO_STAGE_DECODE_FLAC,
+	AUDIO_STAGE_RESAMPLE,
+	AUDIO_STAGE_TONE,
+	AUDIO_STAGE_MIX,
+	AUDIO_STAGE_EQ,      // Q31 conversion and biquads of one block
+	AUDIO_STAGE_LIMITER,
+	AUDIO_STAGE_I2S_WAIT, // writer blocked in i2s_write
+	AUDIO_STAGE_CAPTURE_WRITE, // fs_write of one captured block
+	AUDIO_STAGE_COUNT,
+};
+
+enum audio_event {
+	AUDIO_EVENT_UNDERRUN,   // I2S TX queue ran dry and the driver stopped
+	AUDIO_EVENT_I2S_ERROR,  // any other failed i2s_write or trigger
+	AUDIO_EVENT_LATE_BLOCK, // the writer had to wait for the reader
+	AUDIO_EVENT_READ_ERROR,
+	AUDIO_EVENT_CAPTURE_DROP, // captured block lost to an RX overrun or a full queue
+	AUDIO_EVENT_COUNT,
+};
+
+// fs_read latency buckets, bucket n counts reads below 2^(n + 7) us
+#define AUDIO_STATS_READ_BUCKETS 10
+
+// Cycle counter used for all stage timings
+static inline uint32_t audio_stats_now(void)
+{
+#ifdef CONFIG_CPU_CORTEX_M_HAS_DWT
+	return DWT->CYCCNT;
+#elif defined(CONFIG_NATIVE_LIBRARY)
+	// Simulated time stands still while code runs, measure on the host
+	return host_clock_us() * (sys_clock_hw_cycles_per_sec() / USEC_PER_SEC);
+#else
+	return k_cycle_get_32();
+#endif
+}
+
+// Account the cycles from start until now to stage
+void audio_stats_stage(enum audio_stage stage, uint32_t start);
+void audio_stats_event(enum audio_event event);
+
+// Sample the number of blocks in use for the slab watermarks
+void audio_stats_slab(struct k_mem_slab *slab);
+
+void audio_stats_reset(void);
+
+struct audio_stage_summary {
+	uint32_t calls;
+	uint32_t max_us;
+	uint64_t total_us;
+};
+
+void audio_stats_stage_get(enum audio_stage stage, struct audio_stage_summary *summary);
+uint32_t audio_stats_event_count(enum audio_event event);
+
+/*
+ * Share of CPU time spent in the idle thread since the last reset, in hundredths
+ * of a percent. -ENOTSUP without CONFIG_SCHED_THREAD_USAGE_ALL.
+ */
+int audio_stats_cpu_idle(void);
+
+#endif /* AUDIO_STATS_H_ */
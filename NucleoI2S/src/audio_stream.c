@@ -0,0 +1,479 @@
+#include <errno.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/i2s.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+
+#include "audio_stream.h"
+#include "audio_capture.h"
+#include "audio_convert.h"
+#include "audio_dsp.h"
+#include "audio_latency.h"
+#include "audio_mem.h"
+#include "audio_mixer.h"
+#include "audio_reader.h"
+#include "audio_stats.h"
+#include "tone_gen.h"
+
+/* ----- module registers ----- */
+LOG_MODULE_REGISTER(audio_stream, LOG_LEVEL_INF);
+
+/* ----- definitions ----- */
+/*
+ * Upper bound on how long the engine waits for a block before it re-checks for a
+ * stop request, the waits return as soon as a block is ready.
+ */
+#define STREAM_WAIT_MS 100
+
+// Values of stream_stop
+#define STOP_NONE 0
+#define STOP_FADE 1
+#define STOP_NOW  2
+
+// Fade gain in Q16, full scale is 1 << 16
+#define FADE_UNITY BIT(16)
+
+/* ----- private static variables and types ----- */
+static K_THREAD_STACK_DEFINE(stream_thread_stack, CONFIG_AUDIO_WRITER_STACK_SIZE);
+static struct k_thread stream_thread_data;
+static bool stream_thread_live; // created and not joined yet
+
+static const struct device *stream_dev;
+static struct i2s_config stream_cfg;
+static size_t stream_block_size; // bytes per I2S block of the running stream
+static const struct shell *stream_shell;
+static enum audio_stream_source stream_source;
+
+static atomic_t stream_state = ATOMIC_INIT(AUDIO_STREAM_IDLE);
+static atomic_t stream_stop;
+static atomic_t stream_ending; // a silence stream found the mixer idle
+
+static uint32_t fade_gain; // Q16, ramps down to 0 while draining
+static uint32_t fade_step;
+
+static const char *const state_names[] = {
+	[AUDIO_STREAM_IDLE] = "idle",
+	[AUDIO_STREAM_PREFILL] = "prefill",
+	[AUDIO_STREAM_RUNNING] = "running",
+	[AUDIO_STREAM_DRAINING] = "draining",
+};
+
+static const char *const source_names[] = {
+	[AUDIO_SOURCE_PLAYLIST] = "playlist",
+	[AUDIO_SOURCE_TONE] = "tone",
+	[AUDIO_SOURCE_SILENCE] = "silence",
+};
+
+/* ----- private function declarations ----- */
+static void stream_set_state(enum audio_stream_state state);
+static int stream_generate(void **block, size_t *size);
+static bool stream_silence_end(void);
+static int stream_block_get(void **block, size_t *size);
+static void stream_fade(int16_t *block, size_t frames);
+static bool stream_trigger(enum i2s_dir dir, enum i2s_trigger_cmd cmd);
+static void stream_drain_wait(void);
+static void stream_thread(void *arg1, void *arg2, void *arg3);
+
+/* ----- function definitions ----- */
+static void stream_set_state(enum audio_stream_state state)
+{
+	atomic_set(&stream_state, state);
+	LOG_DBG("State %s", state_names[state]);
+}
+
+// Block of the tone generator, or silence for the mixer to play over
+static int stream_generate(void **block, size_t *size)
+{
+	uint32_t start = audio_stats_now();
+	int ret;
+
+	ret = k_mem_slab_alloc(&audio_slab, block, K_MSEC(STREAM_WAIT_MS));
+	audio_stats_stage(AUDIO_STAGE_SLAB_WAIT, start);
+	if (ret < 0) {
+		return ret == -ENOMEM ? -EAGAIN : ret;
+	}
+
+	if (stream_source == AUDIO_SOURCE_TONE) {
+		start = audio_stats_now();
+		tone_gen_fill(*block, stream_block_size / AUDIO_OUT_FRAME_BYTES);
+		audio_stats_stage(AUDIO_STAGE_TONE, start);
+	} else {
+		memset(*block, 0, stream_block_size);
+	}
+	audio_mem_dma_read_prepare(*block, stream_block_size);
+	*size = stream_block_size;
+
+	return 0;
+}
+
+/*
+ * True when a silence stream should end. A trigger starts its mixer stream before
+ * it starts the engine, which joins this one first while stream_ending is set.
+ * Setting it before looking at the mixer again means a trigger either sees it and
+ * starts the next stream, or its mixer stream is seen here and this one keeps running.
+ */
+static bool stream_silence_end(void)
+{
+	if (audio_mixer_active()) {
+		return false;
+	}
+
+	atomic_set(&stream_ending, 1);
+	if (audio_mixer_active()) {
+		atomic_clear(&stream_ending);
+		return false;
+	}
+
+	return true;
+}
+
+// Next block of the source, -EAGAIN when none came in time, *block NULL at the end
+static int stream_block_get(void **block, size_t *size)
+{
+	int ret;
+
+	if (stream_source == AUDIO_SOURCE_SILENCE && stream_silence_end()) {
+		*block = NULL;
+		*size = 0;
+		return 0;
+	}
+	if (stream_source != AUDIO_SOURCE_PLAYLIST) {
+		return stream_generate(block, size);
+	}
+
+	ret = audio_reader_get(block, size, K_NO_WAIT);
+	if (ret == -ENOMSG) {
+		// Once running, every wait here eats into the I2S queue
+		if (atomic_get(&stream_state) != AUDIO_STREAM_PREFILL) {
+			audio_stats_event(AUDIO_EVENT_LATE_BLOCK);
+		}
+		ret = audio_reader_get(block, size, K_MSEC(STREAM_WAIT_MS));
+	}
+
+	return ret == -ENOMSG ? -EAGAIN : ret;
+}
+
+// Apply the next part of the fade out, frames past its end are silenced
+static void stream_fade(int16_t *block, size_t frames)
+{
+	for (size_t i = 0; i < frames * AUDIO_OUT_CHANNELS; i += AUDIO_OUT_CHANNELS) {
+		block[i] = (block[i] * (int32_t)fade_gain) >> 16;
+		block[i + 1] = (block[i + 1] * (int32_t)fade_gain) >> 16;
+		fade_gain = fade_gain > fade_step ? fade_gain - fade_step : 0;
+	}
+}
+
+static bool stream_trigger(enum i2s_dir dir, enum i2s_trigger_cmd cmd)
+{
+	int ret = i2s_trigger(stream_dev, dir, cmd);
+
+	if (ret < 0) {
+		audio_stats_event(AUDIO_EVENT_I2S_ERROR);
+		LOG_ERR("I2S trigger %d failed: %d", cmd, ret);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Wait for the driver to play out and return the queued blocks. The slab drains
+ * one block per period, so this sleeps a period at a time rather than spinning.
+ */
+static void stream_drain_wait(void)
+{
+	const struct audio_latency *lat = audio_latency_get();
+
+	for (int i = 0; i <= lat->blocks && k_mem_slab_num_used_get(&audio_slab) > 0; i++) {
+		k_sleep(K_USEC(lat->block_us));
+	}
+}
+
+/*
+ * The engine. PREFILL queues blocks with the I2S stream stopped and starts it once
+ * enough are queued, RUNNING then writes one block per TX completion: i2s_write
+ * only returns when the driver freed a queue slot, so the thread sleeps for most
+ * of each block period. A fade stop moves to DRAINING, which ramps the next blocks
+ * down before the queue is played out. An underrun goes back to PREFILL.
+ */
+static void stream_thread(void *arg1, void *arg2, void *arg3)
+{
+	const struct shell *shell = stream_shell;
+	uint32_t queued = 0;
+	bool end_of_stream = false;
+	int ret;
+
+	// Blocks and the I2S stream are sized for the latency mode chosen last
+	ret = audio_latency_apply(stream_cfg.frame_clk_freq, &stream_block_size);
+	if (ret < 0) {
+		shell_print(shell, "Failed to set up audio buffers: %d", ret);
+		stream_set_state(AUDIO_STREAM_IDLE);
+		return;
+	}
+
+	stream_cfg.block_size = stream_block_size;
+	ret = i2s_configure(stream_dev, I2S_DIR_TX, &stream_cfg);
+	if (ret < 0) {
+		shell_print(shell, "Failed to configure I2S stream: %d", ret);
+		stream_set_state(AUDIO_STREAM_IDLE);
+		return;
+	}
+
+	// File reads happen on the prefetch thread, this thread only feeds I2S
+	if (stream_source == AUDIO_SOURCE_PLAYLIST) {
+		ret = audio_reader_start(&audio_slab, stream_block_size, stream_cfg.frame_clk_freq);
+		if (ret < 0) {
+			shell_print(shell, "Failed to start SD reader: %d", ret);
+			stream_set_state(AUDIO_STREAM_IDLE);
+			return;
+		}
+	}
+
+	fade_gain = FADE_UNITY;
+	fade_step = MAX(FADE_UNITY / MAX(stream_cfg.frame_clk_freq * CONFIG_AUDIO_FADE_OUT_MS /
+						 MSEC_PER_SEC,
+					 1U),
+			1U);
+
+	for (;;) {
+		enum audio_stream_state state = atomic_get(&stream_state);
+		atomic_val_t stop = atomic_get(&stream_stop);
+		void *block;
+		size_t size;
+
+		if (stop == STOP_NOW || (stop == STOP_FADE && state == AUDIO_STREAM_PREFILL)) {
+			// Nothing audible to fade
+			break;
+		} else if (stop == STOP_FADE && state == AUDIO_STREAM_RUNNING) {
+			stream_set_state(AUDIO_STREAM_DRAINING);
+			state = AUDIO_STREAM_DRAINING;
+		}
+
+		ret = stream_block_get(&block, &size);
+		if (ret == -EAGAIN) {
+			continue;
+		} else if (ret < 0 || block == NULL) {
+			if (stream_source != AUDIO_SOURCE_SILENCE) {
+				shell_print(shell, "Reached end of %s or error while reading data",
+					    source_names[stream_source]);
+			}
+			end_of_stream = true;
+			break;
+		}
+
+		audio_stats_slab(&audio_slab);
+
+		// Overlay tones and cues on whatever the source produced, then tune for the speaker
+		bool mix = audio_mixer_active();
+		bool dsp = audio_dsp_active();
+		uint32_t start = audio_stats_now();
+
+		if (mix) {
+			audio_mixer_mix(block, size / AUDIO_OUT_FRAME_BYTES);
+			audio_stats_stage(AUDIO_STAGE_MIX, start);
+		}
+		if (dsp) {
+			audio_dsp_process(block, size / AUDIO_OUT_FRAME_BYTES);
+		}
+		if (state == AUDIO_STREAM_DRAINING) {
+			stream_fade(block, size / AUDIO_OUT_FRAME_BYTES);
+		}
+		if (mix || dsp || state == AUDIO_STREAM_DRAINING) {
+			audio_mem_dma_read_prepare(block, size);
+		}
+
+		start = audio_stats_now();
+		ret = i2s_write(stream_dev, block, size);
+		if (ret == -EIO && state != AUDIO_STREAM_PREFILL) {
+			// The TX queue ran dry and the driver stopped, prefill and start again
+			audio_stats_event(AUDIO_EVENT_UNDERRUN);
+			if (stream_trigger(I2S_DIR_TX, I2S_TRIGGER_PREPARE)) {
+				state = AUDIO_STREAM_PREFILL;
+				stream_set_state(state);
+				queued = 0;
+				ret = i2s_write(stream_dev, block, size);
+			}
+		}
+		audio_stats_stage(AUDIO_STAGE_I2S_WAIT, start);
+		if (ret < 0) {
+			audio_stats_event(AUDIO_EVENT_I2S_ERROR);
+			shell_print(shell, "Failed to write data: %d", ret);
+			k_mem_slab_free(&audio_slab, block);
+			break;
+		}
+
+		if (state == AUDIO_STREAM_PREFILL && ++queued >= audio_latency_get()->prefill) {
+			// A loopback capture starts with the first played sample
+			bool joint = audio_capture_joint_pending();
+
+			if (joint && stream_trigger(I2S_DIR_BOTH, I2S_TRIGGER_START)) {
+				audio_capture_joint_started();
+			} else {
+				if (joint) {
+					// Release the capture threads and keep playing
+					shell_print(shell,
+						    "I2S cannot start RX with TX, capture stopped");
+					audio_capture_stop();
+				}
+				if (!stream_trigger(I2S_DIR_TX, I2S_TRIGGER_START)) {
+					break;
+				}
+			}
+			stream_set_state(AUDIO_STREAM_RUNNING);
+		}
+
+		if (state == AUDIO_STREAM_DRAINING && fade_gain == 0) {
+			end_of_stream = true;
+			break;
+		}
+	}
+
+	if (end_of_stream && queued > 0 && atomic_get(&stream_state) == AUDIO_STREAM_PREFILL) {
+		// The source ended within the prefill, start anyway so that it is heard
+		if (stream_trigger(I2S_DIR_TX, I2S_TRIGGER_START)) {
+			stream_set_state(AUDIO_STREAM_RUNNING);
+		}
+	}
+
+	// Play the tail out, or discard it when stopping at once or nothing was started
+	if (end_of_stream && atomic_get(&stream_state) != AUDIO_STREAM_PREFILL) {
+		stream_set_state(AUDIO_STREAM_DRAINING);
+		if (stream_source == AUDIO_SOURCE_PLAYLIST) {
+			audio_reader_stop();
+		}
+		if (stream_trigger(I2S_DIR_TX, I2S_TRIGGER_DRAIN)) {
+			stream_drain_wait();
+		}
+	} else {
+		stream_trigger(I2S_DIR_TX, I2S_TRIGGER_DROP);
+		if (stream_source == AUDIO_SOURCE_PLAYLIST) {
+			audio_reader_stop();
+		}
+	}
+
+	stream_set_state(AUDIO_STREAM_IDLE);
+	atomic_clear(&stream_ending);
+	shell_print(shell, "thread closing down");
+}
+
+void audio_stream_init(const struct device *dev, const struct i2s_config *cfg)
+{
+	stream_dev = dev;
+	stream_cfg = *cfg;
+}
+
+int audio_stream_start(const struct shell *shell, enum audio_stream_source source)
+{
+	if (stream_dev == NULL) {
+		return -ENODEV;
+	}
+
+	// An ending silence stream may have missed the caller's mixer stream, join it and
+	// start anew
+	if (source == AUDIO_SOURCE_SILENCE && atomic_get(&stream_ending)) {
+		audio_stream_wait(K_FOREVER);
+	}
+
+	// A recording owns the I2S peripheral, only a loopback capture waits for playback
+	if (audio_capture_active() && !audio_capture_joint_pending()) {
+		return -EBUSY;
+	}
+
+	if (!atomic_cas(&stream_state, AUDIO_STREAM_IDLE, AUDIO_STREAM_PREFILL)) {
+		return -EBUSY;
+	}
+
+	// The previous engine has set IDLE and is about to return, reap it first
+	if (stream_thread_live) {
+		k_thread_join(&stream_thread_data, K_FOREVER);
+	}
+
+	stream_shell = shell;
+	stream_source = source;
+	atomic_set(&stream_stop, STOP_NONE);
+
+	k_thread_create(&stream_thread_data, stream_thread_stack,
+			K_THREAD_STACK_SIZEOF(stream_thread_stack), stream_thread, NULL, NULL, NULL,
+			CONFIG_AUDIO_WRITER_THREAD_PRIORITY, 0, K_NO_WAIT);
+	k_thread_name_set(&stream_thread_data, "audio_stream");
+	stream_thread_live = true;
+
+	return 0;
+}
+
+int audio_stream_play(const struct shell *shell)
+{
+	return audio_stream_start(shell, AUDIO_SOURCE_PLAYLIST);
+}
+
+int audio_stream_stop(bool fade)
+{
+	int ret;
+
+	if (!stream_thread_live) {
+		return -EALREADY;
+	}
+
+	atomic_set(&stream_stop, fade ? STOP_FADE : STOP_NOW);
+	ret = k_thread_join(&stream_thread_data, K_FOREVER);
+	stream_thread_live = false;
+
+	return ret;
+}
+
+int audio_stream_wait(k_timeout_t timeout)
+{
+	int ret;
+
+	if (!stream_thread_live) {
+		return 0;
+	}
+
+	ret = k_thread_join(&stream_thread_data, timeout);
+	if (ret == 0) {
+		stream_thread_live = false;
+	}
+
+	return ret;
+}
+
+enum audio_stream_state audio_stream_state_get(void)
+{
+	return atomic_get(&stream_state);
+}
+
+enum audio_stream_source audio_stream_source_get(void)
+{
+	return stream_source;
+}
+
+uint32_t audio_stream_queued(void)
+{
+	uint32_t used = k_mem_slab_num_used_get(&audio_slab);
+	uint32_t held = 1;
+
+	if (stream_source == AUDIO_SOURCE_PLAYLIST) {
+		held += audio_reader_held();
+	}
+
+	return used > held ? used - held : 0;
+}
+
+static int cmd_status(const struct shell *shell, size_t argc, char **argv)
+{
+	enum audio_stream_state state = audio_stream_state_get();
+	const struct audio_latency *lat = audio_latency_get();
+
+	shell_print(shell, "Stream: %s", state_names[state]);
+	if (state != AUDIO_STREAM_IDLE) {
+		shell_print(shell, "Source: %s", source_names[stream_source]);
+		shell_print(shell, "Blocks: %u of %u us, %u in use", lat->blocks, lat->block_us,
+			    k_mem_slab_num_used_get(&audio_slab));
+	}
+
+	return 0;
+}
+
+SHELL_SUBCMD_ADD((audio), status, NULL, "Show the stream state", cmd_status, 1, 0);
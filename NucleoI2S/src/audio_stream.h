@@ -0,0 +1,68 @@
+#ifndef AUDIO_STREAM_H_
+#define AUDIO_STREAM_H_
+
+#include <stdbool.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/i2s.h>
+#include <zephyr/shell/shell.h>
+
+/*
+ * The I2S playback engine.
+ *
+ * One thread per stream moves blocks from the source (the playlist reader, the
+ * tone generator or silence) through the mixer into the I2S TX queue. It blocks in i2s_write
+ * until the driver completes a block, so the CPU idles between blocks; 'audio
+ * stats' shows how much. The thread is joined on stop and before the next start.
+ */
+
+enum audio_stream_state {
+	AUDIO_STREAM_IDLE,
+	AUDIO_STREAM_PREFILL,  // queueing blocks before the I2S stream is started
+	AUDIO_STREAM_RUNNING,  // one block written per block played
+	AUDIO_STREAM_DRAINING, // fading out or playing out the queued tail
+};
+
+enum audio_stream_source {
+	AUDIO_SOURCE_PLAYLIST,
+	AUDIO_SOURCE_TONE,
+	AUDIO_SOURCE_SILENCE, // runs the mixer alone and ends once it is idle
+};
+
+// Use dev with the stream settings of cfg, the block size is set per stream
+void audio_stream_init(const struct device *dev, const struct i2s_config *cfg);
+
+/*
+ * Start a stream from source, -EBUSY while a stream is running. A silence stream
+ * that found the mixer idle and is ending is waited for, so a mixer stream started
+ * before this call is always heard.
+ */
+int audio_stream_start(const struct shell *shell, enum audio_stream_source source);
+
+// Play the queued tracks, -EBUSY while a stream is running
+int audio_stream_play(const struct shell *shell);
+
+/*
+ * Stop the stream and join its thread. With fade the output ramps down over
+ * CONFIG_AUDIO_FADE_OUT_MS and the queued blocks play out first, otherwise they
+ * are dropped. Returns -EALREADY when no stream was started.
+ */
+int audio_stream_stop(bool fade);
+
+// Wait for the stream to end on its own or after a stop
+int audio_stream_wait(k_timeout_t timeout);
+
+enum audio_stream_state audio_stream_state_get(void);
+
+// Source of the running or last stream
+enum audio_stream_source audio_stream_source_get(void);
+
+/*
+ * Blocks written to I2S that the driver has not played out yet, called by the
+ * audio thread while it mixes. Blocks read ahead and the one being mixed are not
+ * counted, the block playing counts in full.
+ */
+uint32_t audio_stream_queued(void);
+
+#endif /* AUDIO_STREAM_H_ */
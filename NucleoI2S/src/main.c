@@ -2,221 +2,305 @@
 #include <zephyr/sys/printk.h>
 #include <zephyr/drivers/i2s.h>
 #include <zephyr/shell/shell.h>
-#include <zephyr/drivers/i2c.h>
-#include <math.h>
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 #include "wav_reader.h"
+#include "wav_index.h"
+#include "audio_reader.h"
+#include "audio_mem.h"
+#include "audio_convert.h"
+#include "audio_cache.h"
+#include "audio_dsp.h"
+#include "tone_gen.h"
+#include "playlist.h"
+#include "audio_latency.h"
+#include "aic3120.h"
+#include "audio_capture.h"
+#include "audio_stream.h"
+#include "audio_bench.h"
 
 /* ----- definitions ----- */
-#ifndef M_PI
-#define M_PI 3.14159265358979323846
-#endif
-
-#define AIC3120_I2C_ADDR                                                                           \
-	0x18 // Replace with your actual I2C address
-	     //
 #define SAMPLE_FREQUENCY   44100
 #define SINE_FREQ          440   // Frequency of the sine wave (440 Hz, A4)
 #define AMPLITUDE          32767 // Amplitude for 16-bit audio (max value)
+#define DEFAULT_TRACK      "lambadio.wav"
 #define SAMPLE_BIT_WIDTH   (16U)
 #define BYTES_PER_SAMPLE   sizeof(int16_t)
 #define NUMBER_OF_CHANNELS (2U)
 
-/* Such block length provides an echo with the delay of 100 ms. */
-#define SAMPLES_PER_BLOCK ((SAMPLE_FREQUENCY / 40) * NUMBER_OF_CHANNELS)
-#define INITIAL_BLOCKS    2
-#define TIMEOUT           (2000U)
-
-#define BLOCK_SIZE  (BYTES_PER_SAMPLE * SAMPLES_PER_BLOCK)
-#define BLOCK_COUNT (INITIAL_BLOCKS + 25)
-K_MEM_SLAB_DEFINE_STATIC(mem_slab, BLOCK_SIZE, BLOCK_COUNT, 4);
+BUILD_ASSERT(BYTES_PER_SAMPLE * NUMBER_OF_CHANNELS == AUDIO_OUT_FRAME_BYTES,
+	     "The conversion stage outputs 16-bit stereo");
 
 /* ----- private static variables ----- */
 static const struct device *dev_i2s;
 static struct i2s_config i2s_cfg;
-static bool stream_started = false;
-
-static K_THREAD_STACK_DEFINE(tone_thread_stack, 4096); // Adjust stack size as needed
-static struct k_thread tone_thread_data;
-
-/* ----- private function declarations ----- */
-void aic3120Init();
-static bool configure_tx_streams(const struct device *dev_i2s, struct i2s_config *config);
-static bool trigger_command(const struct device *dev_i2s, enum i2s_trigger_cmd cmd);
 
 /* ----- function definitions ----- */
-static void generate_sine_wave(int16_t *buffer, size_t samples_per_block, int sample_rate,
-			       int frequency, int channels)
+static int cmd_start_tone(const struct shell *shell, size_t argc, char **argv)
 {
-	static float phase = 0.0f;
-	float phase_increment = 2.0f * M_PI * frequency / sample_rate;
+	bool tone = argc > 1 && strcmp(argv[1], "tone") == 0;
+	int ret;
 
-	for (size_t i = 0; i < samples_per_block / channels; i++) {
-		int16_t sample_value = (int16_t)(AMPLITUDE * sinf(phase));
+	if (audio_stream_state_get() != AUDIO_STREAM_IDLE) {
+		shell_print(shell, "Tone already started");
+		return 0;
+	}
 
-		for (int ch = 0; ch < channels; ch++) {
-			buffer[i * channels + ch] = sample_value;
-		}
+	if (tone && !tone_gen_active()) {
+		tone_gen_set(0, SINE_FREQ, AMPLITUDE);
+	} else if (!tone && playlist_count() == 0) {
+		playlist_add(DEFAULT_TRACK);
+	}
 
-		phase += phase_increment;
-		if (phase >= 2.0f * M_PI) {
-			phase -= 2.0f * M_PI;
-		}
+	shell_print(shell, "Starting %s...", tone ? "tone" : "file");
+	ret = audio_stream_start(shell, tone ? AUDIO_SOURCE_TONE : AUDIO_SOURCE_PLAYLIST);
+	if (ret < 0) {
+		shell_error(shell, "Failed to start playback: %d", ret);
 	}
+
+	return ret;
 }
 
-static bool configure_tx_streams(const struct device *dev_i2s, struct i2s_config *config)
+// Files are given by name or as #<id> from 'audio files'
+static int queue_files(const struct shell *shell, size_t argc, char **argv)
 {
-	int ret;
+	char name[PLAYLIST_NAME_MAX];
+
+	for (size_t i = 1; i < argc; i++) {
+		const char *file = argv[i];
+		char *end;
+		long id;
+		int ret;
+
+		if (file[0] == '#') {
+			id = strtol(&file[1], &end, 10);
+			if (end == &file[1] || *end != '\0' || id < 0 || id > INT_MAX) {
+				shell_error(shell, "Invalid file ID %s", file);
+				return -EINVAL;
+			}
 
-	ret = i2s_configure(dev_i2s, I2S_DIR_TX, config);
-	if (ret < 0) {
-		printf("Failed to configure I2S stream\n");
-		return false;
+			ret = wav_index_name(id, name, sizeof(name));
+			if (ret < 0) {
+				shell_error(shell, "No file %s: %d", file, ret);
+				return ret;
+			}
+			file = name;
+		}
+
+		ret = playlist_add(file);
+		if (ret < 0) {
+			shell_error(shell, "Cannot queue %s: %d", argv[i], ret);
+			return ret;
+		}
 	}
 
-	return true;
+	return 0;
 }
 
-static bool trigger_command(const struct device *dev_i2s, enum i2s_trigger_cmd cmd)
+static int cmd_play(const struct shell *shell, size_t argc, char **argv)
 {
+	bool running = audio_stream_state_get() != AUDIO_STREAM_IDLE;
 	int ret;
 
-	ret = i2s_trigger(dev_i2s, I2S_DIR_TX, cmd);
+	if (running && audio_stream_source_get() != AUDIO_SOURCE_PLAYLIST) {
+		shell_error(shell, "%s playing, stop it first",
+			    audio_stream_source_get() == AUDIO_SOURCE_TONE ? "Tone" : "Effect");
+		return -EBUSY;
+	}
+
+	playlist_clear();
+	ret = queue_files(shell, argc, argv);
 	if (ret < 0) {
-		printk("Failed to trigger command %d on TX: %d\n", cmd, ret);
-		return false;
+		return ret;
 	}
 
-	return true;
-}
+	// A running stream switches over without restarting I2S
+	if (running) {
+		if (audio_reader_skip(true) == 0) {
+			return 0;
+		}
+		// The reader is past the end of the old playlist, start over once it has played out
+		audio_stream_wait(K_FOREVER);
+	}
 
-#define PRE_FILL_BUFFERS 3 // Number of buffers to pre-fill before starting
+	return audio_stream_play(shell);
+}
 
-void tone_thread(void *arg1, void *arg2, void *arg3)
+static int cmd_queue(const struct shell *shell, size_t argc, char **argv)
 {
-	struct shell *shell = (struct shell *)arg1; // Pass shell pointer to thread
-	int ret;
-
-	bool trigger_stream = true;
-	uint8_t buffer[BLOCK_SIZE]; // Buffer for file data
-	uint32_t bytes_read;
-
-	int pre_filled_buffers = 0;
+	char name[PLAYLIST_NAME_MAX];
 
-	// Pre-fill multiple buffers before starting the I2S stream
-	while (pre_filled_buffers < PRE_FILL_BUFFERS && stream_started) {
-		void *mem_block;
-		int16_t *buffer;
-		uint32_t block_size = BLOCK_SIZE;
-
-		ret = k_mem_slab_alloc(&mem_slab, &mem_block, K_FOREVER);
-		if (ret < 0) {
-			shell_print(shell, "Failed to allocate TX block");
-			break;
-		}
+	if (argc > 1) {
+		return queue_files(shell, argc, argv);
+	}
 
-		buffer = (int16_t *)mem_block;
-		int32_t num_read = read_data(buffer, block_size);
-		if (num_read < 0) {
-			shell_print(shell, "Reached end of file or error while reading data");
-			k_mem_slab_free(&mem_slab, &mem_block);
-			break;
-		}
+	for (int i = 0; playlist_peek(i, name, sizeof(name)) == 0; i++) {
+		shell_print(shell, "%d: %s", i + 1, name);
+	}
 
-		ret = i2s_write(dev_i2s, mem_block, block_size);
-		if (ret < 0) {
-			shell_print(shell, "Failed to write data: %d", ret);
-			k_mem_slab_free(&mem_slab, &mem_block);
-			break;
-		}
+	return 0;
+}
 
-		pre_filled_buffers++;
+static int cmd_next(const struct shell *shell, size_t argc, char **argv)
+{
+	if (audio_stream_state_get() == AUDIO_STREAM_IDLE ||
+	    audio_stream_source_get() != AUDIO_SOURCE_PLAYLIST) {
+		shell_print(shell, "No playlist playing");
+		return 0;
 	}
 
-	while (stream_started) {
-		void *mem_block;
-		int16_t *buffer;
-		uint32_t block_size = BLOCK_SIZE;
+	if (audio_reader_skip(false) < 0) {
+		shell_print(shell, "No next track");
+	}
 
-		ret = k_mem_slab_alloc(&mem_slab, &mem_block, K_FOREVER);
-		if (ret < 0) {
-			shell_print(shell, "Failed to allocate TX block");
-			break;
-		}
+	return 0;
+}
 
-		buffer = (int16_t *)mem_block;
-		int32_t num_read = read_data(buffer, block_size);
+static const char *const pos_units[] = {
+	[AUDIO_POS_MS] = "ms",
+	[AUDIO_POS_FRAMES] = "frames",
+	[AUDIO_POS_CUE] = "cue",
+};
 
-		ret = i2s_write(dev_i2s, mem_block, block_size);
-		if (ret < 0) {
-			shell_print(shell, "Failed to write data: %d", ret);
-			break;
+// Take the optional unit in front of the positions, milliseconds when there is none
+static enum audio_pos_unit parse_pos_unit(size_t *argc, char ***argv)
+{
+	for (int i = 0; i < ARRAY_SIZE(pos_units); i++) {
+		if (*argc > 1 && strcmp((*argv)[1], pos_units[i]) == 0) {
+			(*argc)--;
+			(*argv)++;
+			return i;
 		}
+	}
 
-		if (trigger_stream) {
-			ret = i2s_trigger(dev_i2s, I2S_DIR_TX, I2S_TRIGGER_START);
-			if (ret < 0) {
-				shell_print(shell, "Failed to start I2S stream: %d", ret);
-				break;
-			}
-			trigger_stream =
-				false; // Set false only after stream is triggered successfully
-		}
+	return AUDIO_POS_MS;
+}
+
+static int cmd_seek(const struct shell *shell, size_t argc, char **argv)
+{
+	enum audio_pos_unit unit = parse_pos_unit(&argc, &argv);
 
-		// Add a short sleep to yield control back to the OS
+	if (argc != 2) {
+		shell_error(shell, "Usage: seek [ms|frames|cue] <position>");
+		return -EINVAL;
 	}
 
-	if (!trigger_command(dev_i2s, I2S_TRIGGER_DROP)) {
-		printk("Send I2S trigger DRAIN failed: %d", ret);
+	if (audio_stream_state_get() == AUDIO_STREAM_IDLE ||
+	    audio_stream_source_get() != AUDIO_SOURCE_PLAYLIST) {
+		shell_print(shell, "No playlist playing");
 		return 0;
 	}
-	shell_print(shell, "thread closing down");
+
+	return audio_reader_seek(strtoul(argv[1], NULL, 10), unit);
 }
 
-static int cmd_start_tone(const struct shell *shell, size_t argc, char **argv)
+static int cmd_loop(const struct shell *shell, size_t argc, char **argv)
 {
-	if (stream_started) {
-		shell_print(shell, "Tone already started");
+	enum audio_pos_unit unit;
+	int ret;
+
+	if (argc == 2 && strcmp(argv[1], "off") == 0) {
+		audio_reader_loop_clear();
 		return 0;
 	}
 
-	shell_print(shell, "Starting tone...");
-	stream_started = true;
+	unit = parse_pos_unit(&argc, &argv);
+	if (argc != 3) {
+		shell_error(shell, "Usage: loop [ms|frames|cue] <start> <end>, or loop off");
+		return -EINVAL;
+	}
 
-	// Create a new thread to handle tone generation
-	k_thread_create(&tone_thread_data, tone_thread_stack,
-			K_THREAD_STACK_SIZEOF(tone_thread_stack), tone_thread, (void *)shell, NULL,
-			NULL, 0, 0, K_NO_WAIT);
+	ret = audio_reader_loop(strtoul(argv[1], NULL, 10), strtoul(argv[2], NULL, 10), unit);
+	if (ret < 0) {
+		shell_error(shell, "The loop end must follow its start");
+	}
 
-	return 0;
+	return ret;
 }
 
-// Add a command to stop the tone generation
+// Fade out, play the queued blocks and wait for the engine to exit
 static int cmd_stop_tone(const struct shell *shell, size_t argc, char **argv)
 {
-	if (!stream_started) {
+	if (audio_stream_state_get() == AUDIO_STREAM_IDLE) {
 		shell_print(shell, "Tone not started");
 		return 0;
 	}
 
 	shell_print(shell, "Stopping tone...");
-	stream_started = false; // Signal the thread to stop
-
-	// You may need to handle joining the thread or cleanup if necessary
 
-	return 0;
+	return audio_stream_stop(true);
 }
 
 /* Shell command definitions */
-SHELL_CMD_ARG_REGISTER(start_tone, NULL, "Start sine wave tone", cmd_start_tone, 1, 0);
+SHELL_SUBCMD_SET_CREATE(audio_cmds, (audio));
+SHELL_CMD_REGISTER(audio, &audio_cmds, "Audio pipeline commands", NULL);
+SHELL_CMD_ARG_REGISTER(start_tone, NULL, "Start playback [file|tone]", cmd_start_tone, 1, 1);
 SHELL_CMD_ARG_REGISTER(stop_tone, NULL, "Stop sine wave tone", cmd_stop_tone, 1, 0);
+SHELL_CMD_ARG_REGISTER(play, NULL,
+		       "Play files now, replacing the queue: <file|#id> [file|#id...]", cmd_play,
+		       2, 8);
+SHELL_CMD_ARG_REGISTER(queue, NULL,
+		       "Queue files after the current track, or list the queue: [file|#id...]",
+		       cmd_queue, 1, 8);
+SHELL_CMD_ARG_REGISTER(next, NULL, "Skip to the next queued track", cmd_next, 1, 0);
+SHELL_CMD_ARG_REGISTER(seek, NULL, "Jump within the current track: [ms|frames|cue] <position>",
+		       cmd_seek, 2, 1);
+SHELL_CMD_ARG_REGISTER(loop, NULL,
+		       "Repeat part of each track: [ms|frames|cue] <start> <end>, or off",
+		       cmd_loop, 2, 2);
+
+static int cmd_loopback(const struct shell *shell, size_t argc, char **argv)
+{
+	uint32_t seconds = argc > 2 ? strtoul(argv[2], NULL, 10) : CONFIG_AUDIO_CAPTURE_MAX_SECONDS;
+	int ret;
+
+	if (audio_stream_state_get() != AUDIO_STREAM_IDLE) {
+		shell_error(shell, "Playback already running");
+		return -EBUSY;
+	}
+
+	// Capture what the playlist plays, both directions start on the same frame
+	ret = audio_capture_start(argv[1], seconds, true);
+	if (ret == -ENOTSUP) {
+		shell_error(shell, "Loopback needs a full-duplex I2S driver, see "
+				   "CONFIG_AUDIO_I2S_FULL_DUPLEX");
+		return ret;
+	} else if (ret < 0) {
+		shell_error(shell, "Failed to start capture: %d", ret);
+		return ret;
+	}
+
+	if (playlist_count() == 0) {
+		playlist_add(DEFAULT_TRACK);
+	}
+
+	ret = audio_stream_play(shell);
+	if (ret < 0) {
+		audio_capture_stop();
+	}
+
+	return ret;
+}
+
+SHELL_SUBCMD_ADD((audio), loopback, NULL,
+		 "Play the queue and record I2S RX together with a full-duplex driver: "
+		 "<file> [seconds], finish with 'audio record stop'",
+		 cmd_loopback, 2, 1);
 
 void main(void)
 {
-	lsdir();
-	const char *fp = "lambadio.wav";
-	read_wav_file(fp);
+	int ret;
+
+	// Mount and index the card once, so the first play command only opens the file
+	ret = wav_storage_init();
+	if (ret < 0) {
+		printk("No SD card: %d\n", ret);
+	}
+
+	tone_gen_init(SAMPLE_FREQUENCY);
+	audio_dsp_init(SAMPLE_FREQUENCY);
+	audio_cache_init(SAMPLE_FREQUENCY);
 	dev_i2s = DEVICE_DT_GET(DT_NODELABEL(i2s2));
 
 	if (!device_is_ready(dev_i2s)) {
@@ -224,89 +308,35 @@ void main(void)
 		return;
 	}
 
-	aic3120Init();          // Initialize the codec
-	stream_started = false; // Ensure the stream is initially stopped
+	// -ENODEV on boards without the codec, such as native_sim
+	ret = aic3120_init();
+	if (ret < 0 && ret != -ENODEV) {
+		printk("Failed to initialize the codec\n");
+	}
 
 	i2s_cfg.word_size = 16U;
 	i2s_cfg.channels = 2U;
 	i2s_cfg.format = I2S_FMT_DATA_FORMAT_I2S;
 	i2s_cfg.frame_clk_freq = SAMPLE_FREQUENCY;
-	i2s_cfg.block_size = BLOCK_SIZE;
 	i2s_cfg.timeout = SYS_FOREVER_MS;
 	i2s_cfg.options = I2S_OPT_FRAME_CLK_MASTER | I2S_OPT_BIT_CLK_MASTER;
-	i2s_cfg.mem_slab = &mem_slab;
+	i2s_cfg.mem_slab = &audio_slab;
 
-	if (!configure_tx_streams(dev_i2s, &i2s_cfg)) {
-		printk("Failed to configure I2S stream\n");
-	}
+	// Block size and slab are set up per stream, see audio_latency
+	audio_stream_init(dev_i2s, &i2s_cfg);
+
+	// Capture shares the clock and format, with its own blocks
+	audio_capture_init(dev_i2s, &i2s_cfg);
+
+	// Convert the effects once, so their first trigger does not wait for the card
+	audio_cache_load_list(CONFIG_AUDIO_CACHE_PRELOAD);
 
 	k_msleep(1000); // Delay before starting
 
 	printk("Shell initialized. Use 'start_tone' to start the tone and 'stop_tone' to stop "
 	       "it.\n");
-}
 
-static int i2c_writeRegisterByte(const struct device *i2c_dev, uint8_t reg, uint8_t value)
-{
-	uint8_t data[2] = {reg, value};
-	int ret = i2c_write(i2c_dev, data, sizeof(data), AIC3120_I2C_ADDR);
-
-	// Error handling
-	if (ret < 0) {
-		printk("Failed to write to register 0x%02X: %d\n", reg, ret);
-		return ret; // Return the error code
+	if (IS_ENABLED(CONFIG_AUDIO_BENCH_AUTORUN)) {
+		audio_bench_autorun();
 	}
-
-	// printk("Wrote to register 0x%02X: 0x%02X\n", reg, value); // Log successful writes
-	return 0; // Return success
-}
-
-void aic3120Init()
-{
-	// Initialize I2C device
-	const struct device *i2c_dev;
-	i2c_dev = DEVICE_DT_GET(DT_NODELABEL(i2c1));
-	if (!i2c_dev) {
-		printk("Failed to get I2C device");
-		return;
-	}
-
-	// 1. Define starting point:
-	i2c_writeRegisterByte(i2c_dev, 0, 0x00); // Set register page to 0
-	i2c_writeRegisterByte(i2c_dev, 1, 0x01); // Initiate SW reset
-
-	// 2. Program clock settings
-	i2c_writeRegisterByte(i2c_dev, 4, 0x03);  // PLL_clkin = MCLK
-	i2c_writeRegisterByte(i2c_dev, 6, 0x08);  // J = 8
-	i2c_writeRegisterByte(i2c_dev, 7, 0x00);  // D = 0000
-	i2c_writeRegisterByte(i2c_dev, 8, 0x00);  // D(7:0) = 0
-	i2c_writeRegisterByte(i2c_dev, 5, 0x91);  // Power up PLL, P=1, R=1
-						  //
-	i2c_writeRegisterByte(i2c_dev, 11, 0x88); // Program and power up NDAC
-	i2c_writeRegisterByte(i2c_dev, 12, 0x82); // Program and power up MDAC
-	i2c_writeRegisterByte(i2c_dev, 13, 0x00); // DOSR = 128
-	i2c_writeRegisterByte(i2c_dev, 14, 0x80); // DOSR(7:0) = 128
-	i2c_writeRegisterByte(i2c_dev, 27, 0x00); // Program I2S word length and master mode
-	i2c_writeRegisterByte(i2c_dev, 60, 0x10); // Select DAC DSP Processing Block PRB_P16
-	i2c_writeRegisterByte(i2c_dev, 0, 0x08);
-	i2c_writeRegisterByte(i2c_dev, 1, 0x04);
-	i2c_writeRegisterByte(i2c_dev, 0, 0x80);
-
-	// 3. Program analog blocks
-	i2c_writeRegisterByte(i2c_dev, 0, 0x01);  // Set register page to 1
-	i2c_writeRegisterByte(i2c_dev, 31, 0x04); // Program common-mode voltage
-	i2c_writeRegisterByte(i2c_dev, 33, 0x4e); // Program headphone-specific depop settings
-	i2c_writeRegisterByte(i2c_dev, 35, 0x40); // Route DAC output to HPOUT
-	i2c_writeRegisterByte(i2c_dev, 40, 0x06); // Unmute HPOUT, set gain = 0 dB
-	i2c_writeRegisterByte(i2c_dev, 42, 0x1c); // Unmute Class-D, set gain = 18 dB
-	i2c_writeRegisterByte(i2c_dev, 31, 0x82); // HPOUT powered up
-	i2c_writeRegisterByte(i2c_dev, 32, 0xc6); // Power-up Class-D drivers
-	i2c_writeRegisterByte(i2c_dev, 36, 0x92); // Set HPOUT output analog volume
-	i2c_writeRegisterByte(i2c_dev, 38, 0x92); // Set Class-D output analog volume
-
-	// 5. Power up DAC
-	i2c_writeRegisterByte(i2c_dev, 0, 0x00);  // Power up DAC
-	i2c_writeRegisterByte(i2c_dev, 63, 0x94); // Power up DAC channels and set digital gain
-	i2c_writeRegisterByte(i2c_dev, 65, 0xd4); // DAC gain = -22 dB
-	i2c_writeRegisterByte(i2c_dev, 64, 0x04); // Unmute DAC
 }
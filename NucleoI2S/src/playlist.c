@@ -0,0 +1,81 @@
+#include <errno.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+
+#include "playlist.h"
+
+/* ----- private static variables and types ----- */
+static char entries[CONFIG_AUDIO_PLAYLIST_LENGTH][PLAYLIST_NAME_MAX];
+static int head;
+static int count;
+
+// Taken by the shell and the reader thread, never from an ISR
+static K_MUTEX_DEFINE(playlist_lock);
+
+/* ----- function definitions ----- */
+int playlist_add(const char *name)
+{
+	int ret = 0;
+
+	if (strlen(name) >= PLAYLIST_NAME_MAX) {
+		return -ENAMETOOLONG;
+	}
+
+	k_mutex_lock(&playlist_lock, K_FOREVER);
+	if (count == CONFIG_AUDIO_PLAYLIST_LENGTH) {
+		ret = -ENOSPC;
+	} else {
+		strcpy(entries[(head + count) % CONFIG_AUDIO_PLAYLIST_LENGTH], name);
+		count++;
+	}
+	k_mutex_unlock(&playlist_lock);
+
+	return ret;
+}
+
+void playlist_clear(void)
+{
+	k_mutex_lock(&playlist_lock, K_FOREVER);
+	head = 0;
+	count = 0;
+	k_mutex_unlock(&playlist_lock);
+}
+
+int playlist_pop(char *name, size_t len)
+{
+	int ret;
+
+	// Zephyr mutexes nest, so the peek and the removal are one step
+	k_mutex_lock(&playlist_lock, K_FOREVER);
+	ret = playlist_peek(0, name, len);
+	if (ret == 0) {
+		head = (head + 1) % CONFIG_AUDIO_PLAYLIST_LENGTH;
+		count--;
+	}
+	k_mutex_unlock(&playlist_lock);
+
+	return ret;
+}
+
+int playlist_count(void)
+{
+	return count;
+}
+
+int playlist_peek(int index, char *name, size_t len)
+{
+	int ret = 0;
+
+	k_mutex_lock(&playlist_lock, K_FOREVER);
+	if (index < 0 || index >= count) {
+		ret = -ENOENT;
+	} else {
+		strncpy(name, entries[(head + index) % CONFIG_AUDIO_PLAYLIST_LENGTH], len - 1);
+		name[len - 1] = '\0';
+	}
+	k_mutex_unlock(&playlist_lock);
+
+	return ret;
+}
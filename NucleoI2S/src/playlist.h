@@ -0,0 +1,26 @@
+#ifndef PLAYLIST_H_
+#define PLAYLIST_H_
+
+#include <stddef.h>
+
+/*
+ * Queue of WAV files to play back to back. File names are relative to the SD
+ * card mount point. The audio reader pops the next entry while the current track
+ * is still playing.
+ */
+
+#define PLAYLIST_NAME_MAX 32
+
+// Append a file, returns -ENOSPC when the queue is full
+int playlist_add(const char *name);
+void playlist_clear(void);
+
+// Remove the next file from the queue, returns -ENOENT when the queue is empty
+int playlist_pop(char *name, size_t len);
+
+int playlist_count(void);
+
+// Copy the name of entry index without removing it
+int playlist_peek(int index, char *name, size_t len);
+
+#endif /* PLAYLIST_H_ */
@@ -0,0 +1,371 @@
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+
+#include "tone_gen.h"
+#include "audio_simd.h"
+#include "audio_mixer.h"
+
+/* ----- module registers ----- */
+LOG_MODULE_REGISTER(tone_gen, LOG_LEVEL_INF);
+
+/* ----- definitions ----- */
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Sine table of 2^LUT_BITS entries plus a guard entry for the interpolation
+#define LUT_BITS  10
+#define LUT_SIZE  (1 << LUT_BITS)
+#define FRAC_BITS 15
+
+// Extra fractional bits of the phase step below the 32-bit phase
+#define STEP_FRAC_BITS 16
+
+/* ----- private static variables and types ----- */
+struct tone {
+	uint32_t phase;
+	uint64_t step;       // phase increment per sample << STEP_FRAC_BITS
+	uint64_t step_start; // step at the start of a sweep
+	int64_t sweep;       // change of step per sample
+	uint32_t sweep_len;  // samples per sweep
+	uint32_t sweep_left;
+	int16_t amplitude;
+	bool repeat;
+	bool active;
+	uint32_t seq; // bumped by every change of the settings
+};
+
+// Running copy of every tone, rendered without holding tone_lock
+struct tone_voice {
+	struct tone tones[TONE_GEN_MAX];
+	int stream; // mixer stream of an overlay
+};
+
+static int16_t sine_lut[LUT_SIZE + 1];
+static uint32_t tone_sample_rate;
+
+// Settings of the tones, written by the shell under tone_lock
+static struct tone tones[TONE_GEN_MAX];
+static struct k_spinlock tone_lock;
+
+// Rendered by tone_gen_fill, and each overlay from its own phases
+static struct tone_voice source_voice;
+static struct tone_voice overlay_voices[CONFIG_AUDIO_MIXER_STREAMS];
+
+/* ----- private function declarations ----- */
+static uint64_t tone_step(uint32_t freq_hz);
+static inline int16_t tone_next(struct tone *t);
+static void tone_voice_sync(struct tone_voice *v);
+static void tone_voice_fill(struct tone_voice *v, int16_t *buf, size_t frames);
+
+/* ----- function definitions ----- */
+static uint64_t tone_step(uint32_t freq_hz)
+{
+	return ((uint64_t)freq_hz << (32 + STEP_FRAC_BITS)) / tone_sample_rate;
+}
+
+static inline int16_t tone_next(struct tone *t)
+{
+	uint32_t idx = t->phase >> (32 - LUT_BITS);
+	int32_t frac = (t->phase >> (32 - LUT_BITS - FRAC_BITS)) & ((1 << FRAC_BITS) - 1);
+	int32_t a = sine_lut[idx];
+	int32_t s = a + (((sine_lut[idx + 1] - a) * frac) >> FRAC_BITS);
+
+	t->phase += (uint32_t)(t->step >> STEP_FRAC_BITS);
+
+	if (t->sweep_left > 0) {
+		t->step += t->sweep;
+		if (--t->sweep_left == 0 && t->repeat) {
+			t->step = t->step_start;
+			t->sweep_left = t->sweep_len;
+		}
+	}
+
+	return (int16_t)((s * t->amplitude) >> 15);
+}
+
+int tone_gen_init(uint32_t sample_rate)
+{
+	for (int i = 0; i <= LUT_SIZE; i++) {
+		sine_lut[i] = (int16_t)lroundf(32767.0f * sinf(2.0f * M_PI * i / LUT_SIZE));
+	}
+
+	tone_sample_rate = sample_rate;
+
+	return 0;
+}
+
+int tone_gen_set(int id, uint32_t freq_hz, int16_t amplitude)
+{
+	return tone_gen_sweep(id, freq_hz, freq_hz, 0, amplitude, false);
+}
+
+int tone_gen_sweep(int id, uint32_t f_start, uint32_t f_end, uint32_t duration_ms,
+		   int16_t amplitude, bool repeat)
+{
+	if (id < 0 || id >= TONE_GEN_MAX || f_start >= tone_sample_rate / 2 ||
+	    f_end >= tone_sample_rate / 2) {
+		return -EINVAL;
+	}
+
+	struct tone t = {
+		.step = tone_step(f_start),
+		.step_start = tone_step(f_start),
+		.sweep_len = (uint32_t)((uint64_t)duration_ms * tone_sample_rate / 1000),
+		.amplitude = amplitude,
+		.repeat = repeat,
+		.active = true,
+	};
+
+	if (t.sweep_len > 0 && f_start != f_end) {
+		t.sweep = ((int64_t)tone_step(f_end) - (int64_t)t.step_start) / t.sweep_len;
+		t.sweep_left = t.sweep_len;
+	}
+
+	k_spinlock_key_t key = k_spin_lock(&tone_lock);
+
+	t.seq = tones[id].seq + 1;
+	tones[id] = t;
+	k_spin_unlock(&tone_lock, key);
+
+	return 0;
+}
+
+void tone_gen_stop(int id)
+{
+	if (id >= 0 && id < TONE_GEN_MAX) {
+		k_spinlock_key_t key = k_spin_lock(&tone_lock);
+
+		tones[id].active = false;
+		tones[id].seq++;
+		k_spin_unlock(&tone_lock, key);
+	}
+}
+
+void tone_gen_stop_all(void)
+{
+	for (int i = 0; i < TONE_GEN_MAX; i++) {
+		tone_gen_stop(i);
+	}
+}
+
+bool tone_gen_active(void)
+{
+	for (int i = 0; i < TONE_GEN_MAX; i++) {
+		if (tones[i].active) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Take the settings changed since the last block. Only the copy is done under
+ * tone_lock, so the I2S and SDMMC interrupts are never held off for a render.
+ */
+static void tone_voice_sync(struct tone_voice *v)
+{
+	k_spinlock_key_t key = k_spin_lock(&tone_lock);
+
+	for (int id = 0; id < TONE_GEN_MAX; id++) {
+		struct tone *t = &v->tones[id];
+
+		if (t->seq != tones[id].seq) {
+			// Keep the running phase so retuning a tone does not click
+			uint32_t phase = t->phase;
+
+			*t = tones[id];
+			t->phase = phase;
+		}
+	}
+
+	k_spin_unlock(&tone_lock, key);
+}
+
+static void tone_voice_fill(struct tone_voice *v, int16_t *buf, size_t frames)
+{
+	uint32_t *out = (uint32_t *)buf;
+	bool first = true;
+
+	tone_voice_sync(v);
+
+	for (int id = 0; id < TONE_GEN_MAX; id++) {
+		struct tone *t = &v->tones[id];
+
+		if (!t->active) {
+			continue;
+		}
+
+		// The first tone writes both channels of a frame as one word, the rest add
+		// into it with saturation
+		for (size_t i = 0; i < frames; i++) {
+			uint32_t s = (uint16_t)tone_next(t);
+
+			s |= s << 16;
+			if (first) {
+				out[i] = s;
+			} else {
+#if AUDIO_SIMD
+				out[i] = __QADD16(out[i], s);
+#else
+				int32_t sum = (int16_t)out[i] + (int16_t)s;
+
+				sum = CLAMP(sum, INT16_MIN, INT16_MAX);
+				out[i] = (uint16_t)sum | ((uint32_t)(uint16_t)sum << 16);
+#endif
+			}
+		}
+		first = false;
+	}
+
+	if (first) {
+		memset(buf, 0, frames * sizeof(uint32_t));
+	}
+}
+
+void tone_gen_fill(int16_t *buf, size_t frames)
+{
+	tone_voice_fill(&source_voice, buf, frames);
+}
+
+static size_t tone_gen_mixer_fill(void *ctx, int16_t *buf, size_t frames)
+{
+	tone_voice_fill(ctx, buf, frames);
+
+	return frames;
+}
+
+static int tone_parse_id(const struct shell *shell, const char *arg)
+{
+	int err = 0;
+	int id = shell_strtol(arg, 10, &err);
+
+	if (err || id < 0 || id >= TONE_GEN_MAX) {
+		shell_error(shell, "Tone id must be 0..%d", TONE_GEN_MAX - 1);
+		return -EINVAL;
+	}
+
+	return id;
+}
+
+static int16_t tone_parse_amplitude(const char *arg)
+{
+	// Percent of full scale
+	long pct = CLAMP(strtol(arg, NULL, 10), 0, 100);
+
+	return (int16_t)(pct * INT16_MAX / 100);
+}
+
+static int cmd_tone_set(const struct shell *shell, size_t argc, char **argv)
+{
+	int id = tone_parse_id(shell, argv[1]);
+	int16_t amplitude = argc > 3 ? tone_parse_amplitude(argv[3]) : INT16_MAX / 2;
+
+	if (id < 0) {
+		return id;
+	}
+
+	return tone_gen_set(id, strtoul(argv[2], NULL, 10), amplitude);
+}
+
+static int cmd_tone_sweep(const struct shell *shell, size_t argc, char **argv)
+{
+	int id = tone_parse_id(shell, argv[1]);
+	int16_t amplitude = argc > 5 ? tone_parse_amplitude(argv[5]) : INT16_MAX / 2;
+	bool repeat = argc > 6 && strcmp(argv[6], "loop") == 0;
+
+	if (id < 0) {
+		return id;
+	}
+
+	return tone_gen_sweep(id, strtoul(argv[2], NULL, 10), strtoul(argv[3], NULL, 10),
+			      strtoul(argv[4], NULL, 10), amplitude, repeat);
+}
+
+static int cmd_tone_off(const struct shell *shell, size_t argc, char **argv)
+{
+	if (argc < 2 || strcmp(argv[1], "all") == 0) {
+		tone_gen_stop_all();
+		return 0;
+	}
+
+	int id = tone_parse_id(shell, argv[1]);
+
+	if (id < 0) {
+		return id;
+	}
+	tone_gen_stop(id);
+
+	return 0;
+}
+
+static int cmd_tone_overlay(const struct shell *shell, size_t argc, char **argv)
+{
+	int16_t gain = argc > 1 ? tone_parse_amplitude(argv[1]) : AUDIO_MIXER_UNITY;
+	struct tone_voice *v = NULL;
+	int id;
+
+	if (!tone_gen_active()) {
+		shell_error(shell, "No tone set");
+		return -ENOENT;
+	}
+
+	// A voice is free once the mixer no longer renders from it, fades included
+	for (int i = 0; i < ARRAY_SIZE(overlay_voices); i++) {
+		if (!audio_mixer_playing(overlay_voices[i].stream, &overlay_voices[i])) {
+			v = &overlay_voices[i];
+			break;
+		}
+	}
+	if (v == NULL) {
+		shell_error(shell, "No free mixer stream");
+		return -ENOSPC;
+	}
+
+	// Start every tone from phase 0, the first fill takes the settings of any tone set
+	memset(v->tones, 0, sizeof(v->tones));
+
+	id = audio_mixer_start(tone_gen_mixer_fill, v, gain);
+	if (id < 0) {
+		shell_error(shell, "No free mixer stream");
+		return id;
+	}
+	v->stream = id;
+	shell_print(shell, "Tones mixed as stream %d, stop with 'audio mix stop %d'", id, id);
+
+	return 0;
+}
+
+static int cmd_tone_list(const struct shell *shell, size_t argc, char **argv)
+{
+	for (int id = 0; id < TONE_GEN_MAX; id++) {
+		const struct tone *t = &tones[id];
+		uint32_t freq = (uint32_t)(((t->step >> STEP_FRAC_BITS) * tone_sample_rate) >> 32);
+
+		shell_print(shell, "%d: %s %u Hz, amplitude %d%%%s", id, t->active ? "on " : "off",
+			    freq, t->amplitude * 100 / INT16_MAX,
+			    t->sweep_left ? " (sweep)" : "");
+	}
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	tone_cmds,
+	SHELL_CMD_ARG(set, NULL, "<id> <freq_hz> [amplitude_pct]", cmd_tone_set, 3, 1),
+	SHELL_CMD_ARG(sweep, NULL, "<id> <f_start> <f_end> <duration_ms> [amplitude_pct] [loop]",
+		      cmd_tone_sweep, 5, 2),
+	SHELL_CMD_ARG(off, NULL, "[id|all]", cmd_tone_off, 1, 1),
+	SHELL_CMD_ARG(overlay, NULL, "Mix the tones over playback [gain_pct]", cmd_tone_overlay, 1,
+		      1),
+	SHELL_CMD(list, NULL, "List tones", cmd_tone_list),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_SUBCMD_ADD((audio), tone, &tone_cmds, "Configure the test tone generator", NULL, 1, 0);
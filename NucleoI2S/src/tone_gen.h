@@ -0,0 +1,35 @@
+#ifndef TONE_GEN_H_
+#define TONE_GEN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Multi-tone generator for test signals.
+ *
+ * Every tone is an integer phase-accumulator NCO reading a sine table with linear
+ * interpolation, so frequency stays exact over arbitrarily long runs. Up to
+ * CONFIG_AUDIO_TONE_MAX tones with their own amplitude and optional linear sweep
+ * are summed, with saturation, into 16-bit stereo blocks.
+ */
+
+#define TONE_GEN_MAX CONFIG_AUDIO_TONE_MAX
+
+int tone_gen_init(uint32_t sample_rate);
+
+// Play a steady tone, amplitude is Q15
+int tone_gen_set(int id, uint32_t freq_hz, int16_t amplitude);
+
+// Sweep linearly from f_start to f_end over duration_ms, then hold f_end or start over
+int tone_gen_sweep(int id, uint32_t f_start, uint32_t f_end, uint32_t duration_ms,
+		   int16_t amplitude, bool repeat);
+
+void tone_gen_stop(int id);
+void tone_gen_stop_all(void);
+bool tone_gen_active(void);
+
+// Fill frames 16-bit stereo frames with the sum of all active tones
+void tone_gen_fill(int16_t *buf, size_t frames);
+
+#endif /* TONE_GEN_H_ */
@@ -0,0 +1,212 @@
+#include <ctype.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+
+#include "wav_index.h"
+
+/* ----- definitions ----- */
+// Entry of a file that was forgotten, its slot and name are reused when it returns
+#define INDEX_GONE BIT(7)
+
+/* ----- private static variables and types ----- */
+static struct wav_index_entry entries[WAV_INDEX_FILES];
+static char names[CONFIG_AUDIO_INDEX_NAMES_SIZE];
+static int entry_count;
+static size_t names_used;
+
+static uint32_t scan_ms;
+static uint32_t scan_skipped;
+static uint32_t hits;
+static uint32_t misses;
+
+// Taken by the shell, the reader thread and the cache, never from an ISR
+static K_MUTEX_DEFINE(index_lock);
+
+/* ----- private function declarations ----- */
+static uint32_t index_hash(const char *name);
+static int index_lookup(const char *name, uint32_t hash);
+
+/* ----- function definitions ----- */
+// FNV-1a over the lower-cased name, FAT names differing only in case are one file
+static uint32_t index_hash(const char *name)
+{
+	uint32_t hash = 2166136261U;
+
+	for (; *name != '\0'; name++) {
+		hash = (hash ^ (uint8_t)tolower((unsigned char)*name)) * 16777619U;
+	}
+
+	return hash;
+}
+
+// Slot of name including forgotten ones, or -ENOENT. Called with index_lock held.
+static int index_lookup(const char *name, uint32_t hash)
+{
+	// The hashes are compared first, a name is only read back on a match
+	for (int i = 0; i < entry_count; i++) {
+		if (entries[i].hash == hash && strcasecmp(&names[entries[i].name], name) == 0) {
+			return i;
+		}
+	}
+
+	return -ENOENT;
+}
+
+void wav_index_clear(void)
+{
+	k_mutex_lock(&index_lock, K_FOREVER);
+	entry_count = 0;
+	names_used = 0;
+	hits = 0;
+	misses = 0;
+	k_mutex_unlock(&index_lock);
+}
+
+int wav_index_add(const char *name, uint32_t size, uint32_t mtime, const WavFormat *format,
+		  uint8_t flags)
+{
+	uint32_t hash = index_hash(name);
+	size_t len = strlen(name) + 1;
+	int ret = 0;
+	int i;
+
+	k_mutex_lock(&index_lock, K_FOREVER);
+
+	i = index_lookup(name, hash);
+	if (i < 0) {
+		if (entry_count == WAV_INDEX_FILES || names_used + len > sizeof(names)) {
+			ret = -ENOSPC;
+			goto out;
+		}
+		i = entry_count++;
+		entries[i].hash = hash;
+		entries[i].name = names_used;
+		memcpy(&names[names_used], name, len);
+		names_used += len;
+	}
+
+	entries[i].size = size;
+	entries[i].mtime = mtime;
+	entries[i].flags = flags;
+	entries[i].format = *format;
+
+out:
+	k_mutex_unlock(&index_lock);
+
+	return ret;
+}
+
+int wav_index_find(const char *name, struct wav_index_entry *entry)
+{
+	int ret = -ENOENT;
+	int i;
+
+	k_mutex_lock(&index_lock, K_FOREVER);
+	i = index_lookup(name, index_hash(name));
+	if (i >= 0 && !(entries[i].flags & INDEX_GONE)) {
+		*entry = entries[i];
+		ret = 0;
+		hits++;
+	} else {
+		misses++;
+	}
+	k_mutex_unlock(&index_lock);
+
+	return ret;
+}
+
+void wav_index_forget(const char *name)
+{
+	int i;
+
+	k_mutex_lock(&index_lock, K_FOREVER);
+	i = index_lookup(name, index_hash(name));
+	if (i >= 0) {
+		entries[i].flags |= INDEX_GONE;
+	}
+	k_mutex_unlock(&index_lock);
+}
+
+int wav_index_name(int id, char *name, size_t len)
+{
+	int ret = 0;
+
+	k_mutex_lock(&index_lock, K_FOREVER);
+	if (id < 0 || id >= entry_count || (entries[id].flags & INDEX_GONE)) {
+		ret = -ENOENT;
+	} else if (strlen(&names[entries[id].name]) >= len) {
+		ret = -ENAMETOOLONG;
+	} else {
+		strcpy(name, &names[entries[id].name]);
+	}
+	k_mutex_unlock(&index_lock);
+
+	return ret;
+}
+
+int wav_index_count(void)
+{
+	return entry_count;
+}
+
+void wav_index_scanned(uint32_t ms, uint32_t skipped)
+{
+	scan_ms = ms;
+	scan_skipped = skipped;
+}
+
+static int cmd_files(const struct shell *shell, size_t argc, char **argv)
+{
+	for (int i = 0; i < entry_count; i++) {
+		struct wav_index_entry e;
+		char name[MAX_FILE_NAME + 1];
+
+		// Printing is slow, the lock is only held to copy one entry
+		k_mutex_lock(&index_lock, K_FOREVER);
+		e = entries[i];
+		strncpy(name, &names[e.name], sizeof(name) - 1);
+		name[sizeof(name) - 1] = '\0';
+		k_mutex_unlock(&index_lock);
+
+		if (e.flags & INDEX_GONE) {
+			continue;
+		}
+		shell_print(shell, "%4d %-32s %-9s %6u Hz %u ch %2u bit %10u bytes%s", i, name,
+			    wav_format_name(e.format.audio_format), e.format.sample_rate,
+			    e.format.num_channels, e.format.bits_per_sample, e.format.data_size,
+			    (e.flags & WAV_INDEX_CUES) ? " cues" : "");
+	}
+
+	shell_print(shell, "%d files indexed in %u ms, %u skipped, names %zu of %zu bytes",
+		    entry_count, scan_ms, scan_skipped, names_used, sizeof(names));
+	shell_print(shell, "Lookups: %u hits, %u misses", hits, misses);
+
+	return 0;
+}
+
+static int cmd_files_rescan(const struct shell *shell, size_t argc, char **argv)
+{
+	int ret = wav_rescan();
+
+	if (ret < 0) {
+		shell_error(shell, "Scan failed: %d", ret);
+		return ret;
+	}
+
+	shell_print(shell, "%d files indexed in %u ms", ret, scan_ms);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(files_cmds,
+			       SHELL_CMD(rescan, NULL, "Index the card again after files changed",
+					 cmd_files_rescan),
+			       SHELL_SUBCMD_SET_END);
+
+SHELL_SUBCMD_ADD((audio), files, &files_cmds,
+		 "List the indexed files with their IDs, format and data size, and the scan time",
+		 cmd_files, 1, 0);
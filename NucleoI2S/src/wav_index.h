@@ -0,0 +1,57 @@
+#ifndef WAV_INDEX_H_
+#define WAV_INDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zephyr/sys/util.h>
+
+#include "wav_reader.h"
+
+/*
+ * In-RAM index of the playable files in the card's root.
+ *
+ * Built from a header-only scan when the card is mounted, so that opening an
+ * indexed file seeks straight to its data instead of walking the RIFF chunks
+ * again. Entries are found by a hash of the name, compared case-insensitively like
+ * FAT does, and numbered in directory order so files can be played by ID. Names
+ * are packed into a pool of CONFIG_AUDIO_INDEX_NAMES_SIZE bytes. An entry is only
+ * used while the file's size and last write time still match it.
+ */
+
+#define WAV_INDEX_FILES CONFIG_AUDIO_INDEX_FILES
+
+// The file has cue points, which are only read by a full parse
+#define WAV_INDEX_CUES BIT(0)
+
+struct wav_index_entry {
+	uint32_t hash;
+	uint32_t size;  // file size
+	uint32_t mtime; // FAT date and time of the last write, 0 when unknown
+	uint16_t name;  // offset in the name pool
+	uint8_t flags;
+	WavFormat format;
+};
+
+void wav_index_clear(void);
+
+// Add name or update its entry, -ENOSPC when the table or the name pool is full
+int wav_index_add(const char *name, uint32_t size, uint32_t mtime, const WavFormat *format,
+		  uint8_t flags);
+
+// Copy the entry of name, -ENOENT when it is not indexed
+int wav_index_find(const char *name, struct wav_index_entry *entry);
+
+// Drop name, for files that are being rewritten
+void wav_index_forget(const char *name);
+
+// Copy the name of file id, -ENOENT past the last one
+int wav_index_name(int id, char *name, size_t len);
+
+// IDs run up to one less than this, forgotten files leave a gap
+int wav_index_count(void);
+
+// Time taken by the last scan, set by the card mount
+void wav_index_scanned(uint32_t ms, uint32_t skipped);
+
+#endif /* WAV_INDEX_H_ */
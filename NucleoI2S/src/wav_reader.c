@@ -1,17 +1,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #include <zephyr/kernel.h>
 #include <zephyr/device.h>
 #include <zephyr/storage/disk_access.h>
 #include <zephyr/logging/log.h>
 #include <zephyr/fs/fs.h>
+#include <zephyr/sys/byteorder.h>
 #include <zephyr/shell/shell.h>
 #include <zephyr/drivers/i2c.h>
 
 #include <ff.h>
 #include "wav_reader.h"
+#include "wav_index.h"
+#include "audio_mem.h"
+#include "audio_stats.h"
 
 /* ----- module registers ----- */
 LOG_MODULE_REGISTER(wav_reader, LOG_LEVEL_INF);
@@ -31,10 +36,18 @@ LOG_MODULE_REGISTER(wav_reader, LOG_LEVEL_INF);
 #define SOME_DIR_NAME     "some"
 #define SOME_REQUIRED_LEN MAX(sizeof(SOME_FILE_NAME), sizeof(SOME_DIR_NAME))
 
+/* RIFF sizes of 0 or 0xFFFFFFFF are written by streaming encoders that never patched the header */
+#define RIFF_SIZE_UNKNOWN(size) ((size) == 0 || (size) == UINT32_MAX)
+
+// Size of a fmt chunk that carries the WAVE_FORMAT_EXTENSIBLE fields
+#define FMT_CHUNK_EXTENSIBLE_SIZE 40
+
+// FLAC metadata block type and size of STREAMINFO, which must come first
+#define FLAC_BLOCK_STREAMINFO 0
+#define FLAC_STREAMINFO_SIZE  34
+
 /* ----- private static variables and types ----- */
 static FATFS fat_fs;
-static FIL wav_file;
-static FILINFO fno;
 static FRESULT res;
 
 /* mounting info */
@@ -43,160 +56,934 @@ static struct fs_mount_t mp = {
 	.fs_data = &fat_fs,
 };
 static const char *disk_mount_pt = DISK_MOUNT_PT;
+static bool mounted;
+
+/* KSDATAFORMAT_SUBTYPE_* GUIDs share everything but the leading format tag */
+static const uint8_t ksdataformat_guid_tail[14] = {0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80,
+						   0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71};
 
 /* ----- private function declarations ----- */
+static int wav_mount(void);
+static int wav_path(char *fpath, size_t len, const char *file_name);
+static bool wav_playable_name(const char *name);
+static uint32_t wav_mtime(const char *fpath);
+static int wav_scan_file(const char *name, uint32_t size, WavFile *wav);
+static int wav_scan(void);
+static int wav_parse(WavFile *wav);
+static int wav_write_header(WavFile *wav);
+static int wav_next_chunk(WavFile *wav, uint32_t *pos, uint32_t riff_end, ChunkHeader *chunk);
+static int wav_parse_fmt(WavFile *wav, const ChunkHeader *chunk);
+static int wav_check_format(const WavFormat *format);
+static int wav_parse_riff(WavFile *wav, uint32_t *data_size);
+static int wav_parse_flac(WavFile *wav, uint32_t *data_size);
+static int32_t wav_fs_read(WavFile *wav, void *buffer, uint32_t size);
+static int32_t wav_stage_fill(WavFile *wav);
+static void wav_parse_cue(WavFile *wav, const ChunkHeader *chunk);
+static void wav_fast_seek_init(WavFile *wav);
 
 /* ----- function definitions ----- */
-void read_wav_file(const char *file_name)
+
+/*
+ * Mount the card on first use and keep it mounted, so opening the next track
+ * while the current one plays costs only the directory lookup. The playable files
+ * are indexed right after the mount.
+ */
+static int wav_mount(void)
 {
-	WavHeader wav_header;
-	UINT bytes_read;
+	if (mounted) {
+		return 0;
+	}
 
-	// Mount the filesystem
 	mp.mnt_point = disk_mount_pt;
 	res = fs_mount(&mp);
 	if (res != FR_OK) {
 		LOG_ERR("Failed to mount filesystem: %d", res);
-		return;
+		return res;
+	}
+	mounted = true;
+
+	// Without an index every file is still opened with a full header parse
+	wav_scan();
+
+	return 0;
+}
+
+static bool wav_playable_name(const char *name)
+{
+	const char *ext = strrchr(name, '.');
+
+	return ext != NULL && (strcasecmp(ext, ".wav") == 0 || strcasecmp(ext, ".flac") == 0);
+}
+
+// FAT date and time of the last write to a file, 0 when unknown. fs_stat does not report it.
+static uint32_t wav_mtime(const char *fpath)
+{
+	FILINFO info;
+
+	// FatFS paths start after the slash of the mount point, like Zephyr passes them
+	if (f_stat(&fpath[1], &info) != FR_OK) {
+		return 0;
+	}
+
+	return (uint32_t)info.fdate << 16 | info.ftime;
+}
+
+// Parse the header of one file and index it, wav is scratch space
+static int wav_scan_file(const char *name, uint32_t size, WavFile *wav)
+{
+	char fpath[MAX_PATH];
+	uint32_t mtime;
+	int ret;
+
+	ret = wav_path(fpath, sizeof(fpath), name);
+	if (ret < 0) {
+		return ret;
+	}
+
+	memset(wav, 0, sizeof(*wav));
+	fs_file_t_init(&wav->file);
+	ret = fs_open(&wav->file, fpath, FS_O_READ);
+	if (ret < 0) {
+		return ret;
+	}
+	mtime = wav_mtime(fpath);
+
+	ret = wav_parse(wav);
+	fs_close(&wav->file);
+	if (ret < 0) {
+		return ret;
+	}
+
+	return wav_index_add(name, size, mtime, &wav->format,
+			     wav->cue_count > 0 ? WAV_INDEX_CUES : 0);
+}
+
+/*
+ * Index every playable file in the root. Only headers are read, and the chunks
+ * after the samples only when the RIFF size says there are any.
+ */
+static int wav_scan(void)
+{
+	static struct fs_dirent entry;
+	static WavFile scan_wav;
+	struct fs_dir_t dirp;
+	int64_t start = k_uptime_get();
+	uint32_t skipped = 0;
+	int ret;
+
+	wav_index_clear();
+
+	fs_dir_t_init(&dirp);
+	ret = fs_opendir(&dirp, disk_mount_pt);
+	if (ret < 0) {
+		LOG_ERR("Cannot index %s: %d", disk_mount_pt, ret);
+		return ret;
+	}
+
+	while ((ret = fs_readdir(&dirp, &entry)) == 0 && entry.name[0] != 0) {
+		if (entry.type != FS_DIR_ENTRY_FILE || !wav_playable_name(entry.name)) {
+			continue;
+		}
+		if (wav_scan_file(entry.name, entry.size, &scan_wav) < 0) {
+			LOG_WRN("Not indexed: %s", entry.name);
+			skipped++;
+		}
+	}
+
+	fs_closedir(&dirp);
+
+	wav_index_scanned(k_uptime_get() - start, skipped);
+	LOG_INF("Indexed %d files in %u ms, %u skipped", wav_index_count(),
+		(uint32_t)(k_uptime_get() - start), skipped);
+
+	return ret < 0 ? ret : wav_index_count();
+}
+
+int wav_storage_init(void)
+{
+	int ret = wav_mount();
+
+	if (ret == 0) {
+		LOG_INF("Storage ready at %u ms", k_uptime_get_32());
+	}
+
+	return ret;
+}
+
+int wav_rescan(void)
+{
+	int ret;
+
+	if (!mounted) {
+		// The first mount scans by itself
+		ret = wav_mount();
+		return ret < 0 ? ret : wav_index_count();
+	}
+
+	return wav_scan();
+}
+
+/*
+ * Read the chunk header at *pos and advance *pos to the header of the following
+ * chunk. The file is left positioned at the start of the chunk body, so the caller
+ * may read the body or simply call this again, which seeks over it.
+ */
+static int wav_next_chunk(WavFile *wav, uint32_t *pos, uint32_t riff_end, ChunkHeader *chunk)
+{
+	uint64_t next;
+	int ret;
+
+	if ((uint64_t)*pos + sizeof(ChunkHeader) > riff_end) {
+		return -ENOENT;
+	}
+
+	ret = fs_seek(&wav->file, *pos, FS_SEEK_SET);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = fs_read(&wav->file, chunk, sizeof(ChunkHeader));
+	if (ret < 0) {
+		return ret;
+	} else if (ret < (int)sizeof(ChunkHeader)) {
+		return -ENOENT;
+	}
+
+	// A corrupt size simply ends the walk at riff_end
+	next = (uint64_t)*pos + sizeof(ChunkHeader) + chunk->chunk_size + (chunk->chunk_size & 1);
+	*pos = MIN(next, riff_end);
+
+	return 0;
+}
+
+static int wav_parse_fmt(WavFile *wav, const ChunkHeader *chunk)
+{
+	WavFormat *format = &wav->format;
+	FmtChunk fmt = {0};
+	size_t fmt_size = MIN(chunk->chunk_size, sizeof(fmt));
+	int ret;
+
+	if (fmt_size < offsetof(FmtChunk, cb_size)) {
+		LOG_ERR("fmt chunk too short: %u", chunk->chunk_size);
+		return -EINVAL;
+	}
+
+	ret = fs_read(&wav->file, &fmt, fmt_size);
+	if (ret < 0) {
+		return ret;
+	} else if (ret < (int)fmt_size) {
+		return -EINVAL;
+	}
+
+	format->audio_format = fmt.audio_format;
+	format->num_channels = fmt.num_channels;
+	format->sample_rate = fmt.sample_rate;
+	format->block_align = fmt.block_align;
+	format->bits_per_sample = fmt.bits_per_sample;
+	format->valid_bits = fmt.bits_per_sample;
+
+	if (fmt.audio_format == WAVE_FORMAT_IMA_ADPCM &&
+	    fmt_size >= offsetof(FmtChunk, channel_mask)) {
+		// The extra field of an IMA ADPCM fmt chunk is wSamplesPerBlock
+		format->samples_per_block = fmt.valid_bits_per_sample;
+	}
+
+	if (fmt.audio_format == WAVE_FORMAT_EXTENSIBLE) {
+		if (fmt_size < FMT_CHUNK_EXTENSIBLE_SIZE ||
+		    memcmp(&fmt.sub_format[2], ksdataformat_guid_tail,
+			   sizeof(ksdataformat_guid_tail)) != 0) {
+			LOG_ERR("Unsupported WAVE_FORMAT_EXTENSIBLE sub-format");
+			return -ENOTSUP;
+		}
+
+		format->audio_format = fmt.sub_format[0] | (fmt.sub_format[1] << 8);
+		if (fmt.valid_bits_per_sample != 0) {
+			format->valid_bits = fmt.valid_bits_per_sample;
+		}
+	}
+
+	return wav_check_format(format);
+}
+
+static int wav_check_format(const WavFormat *format)
+{
+	uint32_t header = 4U * format->num_channels; // ADPCM block header bytes
+	bool supported;
+	bool pcm = false;
+
+	switch (format->audio_format) {
+	case WAVE_FORMAT_PCM:
+		supported = format->bits_per_sample == 16 || format->bits_per_sample == 24 ||
+			    format->bits_per_sample == 32;
+		pcm = true;
+		break;
+	case WAVE_FORMAT_IEEE_FLOAT:
+		supported = format->bits_per_sample == 32;
+		pcm = true;
+		break;
+	case WAVE_FORMAT_IMA_ADPCM:
+		// A header sample per channel, then 8 samples per 4 bytes per channel
+		supported = format->bits_per_sample == 4 && format->block_align > header &&
+			    (format->block_align - header) % header == 0 &&
+			    format->samples_per_block ==
+				    (format->block_align - header) * 2 / format->num_channels + 1;
+		break;
+	case WAVE_FORMAT_FLAC:
+		supported = format->bits_per_sample >= 4 && format->bits_per_sample <= 24 &&
+			    format->samples_per_block >= 16;
+		break;
+	default:
+		supported = false;
+		break;
+	}
+
+	if (!supported || format->num_channels < 1 || format->num_channels > 2 ||
+	    format->valid_bits > format->bits_per_sample ||
+	    (pcm && format->block_align != format->num_channels * format->bits_per_sample / 8)) {
+		LOG_ERR("Unsupported format 0x%04x, %u ch, %u bit, align %u", format->audio_format,
+			format->num_channels, format->bits_per_sample, format->block_align);
+		return -ENOTSUP;
+	}
+
+	return 0;
+}
+
+static int wav_path(char *fpath, size_t len, const char *file_name)
+{
+	int ret = wav_mount();
+
+	if (ret < 0) {
+		return ret;
 	}
 
 	/* Combine the mount point and fname for a full path */
-	const char *separator = "/";
-	size_t newSize = strlen(mp.mnt_point) + strlen(separator) + strlen(file_name) + 1;
-	char *fpath = malloc(newSize);
-	if (fpath == NULL) {
+	ret = snprintf(fpath, len, "%s/%s", mp.mnt_point, file_name);
+	if (ret < 0 || ret >= (int)len) {
 		LOG_ERR("FAIL: could not combine mount point (%s) with fname (%s)", mp.mnt_point,
 			file_name);
+		return -ENAMETOOLONG;
 	}
-	strcpy(fpath, mp.mnt_point);
-	strcat(fpath, separator);
-	strcat(fpath, file_name);
 
-	// Open the WAV file
-	res = fs_open(&wav_file, fpath, FS_O_READ);
-	if (res != FR_OK) {
-		LOG_ERR("Failed to open file: %d", res);
-		free(fpath);
-		return;
-	}
+	return 0;
+}
 
-	// Read the WAV file header
-	res = fs_read(&wav_file, &wav_header, sizeof(WavHeader));
-	if (res < 0) {
-		LOG_ERR("Failed to read WAV header: %d", res);
-		fs_close(&wav_file);
-		free(fpath);
-		return;
-	}
+/*
+ * Walk the RIFF chunk list up to the data chunk. Returns with the file positioned
+ * at the first sample and the chunk's size in *data_size.
+ */
+static int wav_parse_riff(WavFile *wav, uint32_t *data_size)
+{
+	RiffHeader riff_header;
+	ChunkHeader chunk;
+	uint32_t riff_end;
+	uint32_t pos;
+	off_t data_start;
+	bool have_fmt = false;
+	int ret;
 
-	// Check if it's a valid WAV file
-	if (strncmp(wav_header.chunk_id, "RIFF", 4) != 0 ||
-	    strncmp(wav_header.format, "WAVE", 4) != 0) {
+	// Read the RIFF header
+	ret = fs_read(&wav->file, &riff_header, sizeof(riff_header));
+	if (ret < (int)sizeof(riff_header) || strncmp(riff_header.riff.chunk_id, "RIFF", 4) != 0 ||
+	    strncmp(riff_header.format, "WAVE", 4) != 0) {
 		LOG_ERR("Invalid WAV file format");
-		fs_close(&wav_file);
-		free(fpath);
-		return;
+		return ret < 0 ? ret : -EINVAL;
 	}
 
-	LOG_INF("WAV File Info:");
-	LOG_INF("  Sample Rate: %u Hz", wav_header.sample_rate);
-	LOG_INF("  Channels: %u", wav_header.num_channels);
-	LOG_INF("  Bits per Sample: %u", wav_header.bits_per_sample);
-
-	// Read WAV data (subchunk2) here, process the audio samples as needed
-
-	// If the subchunk2 is not DATA, then read past this chunk
-	uint8_t buffer[512]; // Adjust size based on your needs
-	if (strncmp(wav_header.subchunk2_id, "DATA", 4) != 0) {
-		int32_t subchunk2_sz = wav_header.subchunk2_size;
-
-		// Keep reading until we reach the end
-		while (subchunk2_sz > 0) {
-			int rd_sz = (subchunk2_sz < sizeof(buffer)) ? subchunk2_sz : sizeof(buffer);
-			res = fs_read(&wav_file, buffer, rd_sz);
-			if (res < 0) {
-				LOG_ERR("Failed to skip past subchunk2");
-				fs_close(&wav_file);
-				free(fpath);
-				return;
+	riff_end = RIFF_SIZE_UNKNOWN(riff_header.riff.chunk_size)
+			   ? UINT32_MAX
+			   : MIN((uint64_t)sizeof(ChunkHeader) + riff_header.riff.chunk_size,
+				 UINT32_MAX);
+
+	/*
+	 * Walk the chunk list. Metadata chunks (LIST, bext, JUNK, ...) are skipped with a
+	 * single fs_seek instead of being read through.
+	 */
+	pos = sizeof(riff_header);
+	while ((ret = wav_next_chunk(wav, &pos, riff_end, &chunk)) == 0) {
+		if (strncmp(chunk.chunk_id, "fmt ", 4) == 0) {
+			ret = wav_parse_fmt(wav, &chunk);
+			if (ret < 0) {
+				break;
 			}
-			subchunk2_sz -= res;
+			have_fmt = true;
+		} else if (strncmp(chunk.chunk_id, "data", 4) == 0) {
+			break;
+		} else {
+			LOG_DBG("Skipping '%.4s' chunk (%u bytes)", chunk.chunk_id,
+				chunk.chunk_size);
 		}
 	}
 
-	// Should be on the DATA subchunk now
-	SubchunkHeader subchunk_header;
-	res = fs_read(&wav_file, &subchunk_header, sizeof(subchunk_header));
-	if (res < 0) {
-		LOG_ERR("Error reading WAV data: %d", res);
-		free(fpath);
+	if (ret == 0 && !have_fmt) {
+		LOG_ERR("data chunk before fmt chunk");
+		ret = -EINVAL;
+	} else if (ret == -ENOENT) {
+		LOG_ERR("No data chunk found");
+	}
+	if (ret < 0) {
+		return ret;
 	}
 
-	// Free the unused path
-	free(fpath);
+	data_start = fs_tell(&wav->file);
+	*data_size = chunk.chunk_size;
+	if (RIFF_SIZE_UNKNOWN(chunk.chunk_size)) {
+		*data_size = UINT32_MAX - data_start;
+		return 0;
+	}
+
+	// Cue chunks are usually written after the samples
+	while (wav_next_chunk(wav, &pos, riff_end, &chunk) == 0) {
+		if (strncmp(chunk.chunk_id, "cue ", 4) == 0) {
+			wav_parse_cue(wav, &chunk);
+		}
+	}
+
+	return fs_seek(&wav->file, data_start, FS_SEEK_SET);
 }
 
-int32_t read_data(int16_t *buffer, uint32_t block_size)
+static void wav_parse_cue(WavFile *wav, const ChunkHeader *chunk)
 {
-	res = fs_read(&wav_file, buffer, block_size);
-	return res;
+	CuePoint point;
+	uint32_t count;
+
+	if (chunk->chunk_size < sizeof(count) ||
+	    fs_read(&wav->file, &count, sizeof(count)) != sizeof(count)) {
+		return;
+	}
+	count = MIN(count, (chunk->chunk_size - sizeof(count)) / sizeof(point));
+
+	for (uint32_t i = 0; i < count && wav->cue_count < WAV_MAX_CUES; i++) {
+		if (fs_read(&wav->file, &point, sizeof(point)) != sizeof(point)) {
+			break;
+		}
+		wav->cues[wav->cue_count++] = point.sample_offset;
+	}
 }
 
-/* List dir entry by path
- *
- * @param path Absolute path to list
- *
- * @return Negative errno code on error, number of listed entries on
- *         success.
+/*
+ * Build the cluster link map so that seeks in a fragmented file cost a table
+ * lookup. The map needs (fragments + 1) * 2 entries, a file with more fragments
+ * than CONFIG_AUDIO_SEEK_CLMT_SIZE allows is read without it.
  */
-void lsdir(void)
+static void wav_fast_seek_init(WavFile *wav)
 {
-	const char *path = disk_mount_pt;
-	struct fs_dir_t dirp;
-	static struct fs_dirent entry;
-	int count = 0;
+#if FF_USE_FASTSEEK
+	FIL *fp = wav->file.filep;
+	FRESULT res;
 
-	// Mount the filesystem
-	mp.mnt_point = disk_mount_pt;
-	res = fs_mount(&mp);
+	wav->clmt[0] = ARRAY_SIZE(wav->clmt);
+	fp->cltbl = wav->clmt;
+	res = f_lseek(fp, CREATE_LINKMAP);
 	if (res != FR_OK) {
-		LOG_ERR("Failed to mount filesystem: %d", res);
+		LOG_WRN("No cluster map (%d, %u entries needed), seeks walk the FAT", res,
+			wav->clmt[0]);
+		fp->cltbl = NULL;
 		return;
 	}
+	// FatFS stores the entries it used in the first one
+	LOG_INF("Cluster map: %u of %zu entries", wav->clmt[0], ARRAY_SIZE(wav->clmt));
+#else
+	LOG_DBG("FatFS built without fast seek, seeks walk the FAT");
+#endif
+}
 
-	fs_dir_t_init(&dirp);
+/*
+ * Native FLAC stream: "fLaC", metadata blocks, then frames. Only STREAMINFO is
+ * read, the frames run to the end of the file.
+ */
+static int wav_parse_flac(WavFile *wav, uint32_t *data_size)
+{
+	WavFormat *format = &wav->format;
+	uint8_t info[FLAC_STREAMINFO_SIZE];
+	uint8_t hdr[4];
+	bool have_info = false;
+	bool last = false;
+	off_t first_frame;
+	off_t end;
+	int ret;
 
-	/* Verify fs_opendir() */
-	res = fs_opendir(&dirp, path);
-	if (res) {
-		printk("Error opening dir %s [%d]\n", path, res);
-		return;
+	ret = fs_seek(&wav->file, sizeof(hdr), FS_SEEK_SET);
+	while (ret == 0 && !last) {
+		uint32_t len;
+
+		ret = fs_read(&wav->file, hdr, sizeof(hdr));
+		if (ret < (int)sizeof(hdr)) {
+			return ret < 0 ? ret : -EINVAL;
+		}
+		last = (hdr[0] & 0x80) != 0;
+		len = sys_get_be24(&hdr[1]);
+
+		if ((hdr[0] & 0x7f) == FLAC_BLOCK_STREAMINFO && len >= sizeof(info)) {
+			ret = fs_read(&wav->file, info, sizeof(info));
+			if (ret < (int)sizeof(info)) {
+				return ret < 0 ? ret : -EINVAL;
+			}
+			len -= sizeof(info);
+			have_info = true;
+		}
+
+		ret = fs_seek(&wav->file, len, FS_SEEK_CUR);
+	}
+	if (ret < 0) {
+		return ret;
 	}
 
-	printk("\nListing dir %s ...\n", path);
-	for (;;) {
-		/* Verify fs_readdir() */
-		res = fs_readdir(&dirp, &entry);
+	if (!have_info) {
+		LOG_ERR("FLAC stream without STREAMINFO");
+		return -EINVAL;
+	}
 
-		/* entry.name[0] == 0 means end-of-dir */
-		if (res || entry.name[0] == 0) {
-			break;
+	// Block sizes (2 x 16 bit), frame sizes (2 x 24 bit), then sample rate (20 bit),
+	// channels - 1 (3 bit) and bits per sample - 1 (5 bit)
+	format->audio_format = WAVE_FORMAT_FLAC;
+	format->samples_per_block = sys_get_be16(&info[2]);
+	format->sample_rate = sys_get_be24(&info[10]) >> 4;
+	format->num_channels = ((info[12] >> 1) & 0x07) + 1;
+	format->bits_per_sample = (((info[12] & 0x01) << 4) | (info[13] >> 4)) + 1;
+	format->valid_bits = format->bits_per_sample;
+
+	ret = wav_check_format(format);
+	if (ret < 0) {
+		return ret;
+	}
+
+	first_frame = fs_tell(&wav->file);
+	ret = fs_seek(&wav->file, 0, FS_SEEK_END);
+	if (ret < 0) {
+		return ret;
+	}
+	end = fs_tell(&wav->file);
+	*data_size = MIN((uint64_t)(end - first_frame), UINT32_MAX);
+
+	return fs_seek(&wav->file, first_frame, FS_SEEK_SET);
+}
+
+const char *wav_format_name(uint16_t audio_format)
+{
+	switch (audio_format) {
+	case WAVE_FORMAT_PCM:
+		return "PCM";
+	case WAVE_FORMAT_IEEE_FLOAT:
+		return "float";
+	case WAVE_FORMAT_IMA_ADPCM:
+		return "IMA ADPCM";
+	case WAVE_FORMAT_FLAC:
+		return "FLAC";
+	default:
+		return "unknown";
+	}
+}
+
+// Detect the container and parse its header, leaving the file at the first sample
+static int wav_parse(WavFile *wav)
+{
+	char magic[4];
+	uint32_t data_size = 0;
+	int ret;
+
+	ret = fs_read(&wav->file, magic, sizeof(magic));
+	if (ret == (int)sizeof(magic) && memcmp(magic, "fLaC", sizeof(magic)) == 0) {
+		ret = wav_parse_flac(wav, &data_size);
+	} else {
+		ret = fs_seek(&wav->file, 0, FS_SEEK_SET);
+		if (ret == 0) {
+			ret = wav_parse_riff(wav, &data_size);
 		}
+	}
+	if (ret < 0) {
+		return ret;
+	}
 
-		if (entry.type == FS_DIR_ENTRY_DIR) {
-			printk("[DIR ] %s\n", entry.name);
-		} else {
-			printk("[FILE] %s (size = %zu)\n", entry.name, entry.size);
+	wav->format.data_offset = fs_tell(&wav->file);
+	wav->format.data_size = data_size;
+	// A partial frame is dropped, a short last ADPCM block is still decoded
+	if (wav->format.block_align != 0 && wav->format.audio_format != WAVE_FORMAT_IMA_ADPCM) {
+		wav->format.data_size -= wav->format.data_size % wav->format.block_align;
+	}
+
+	return 0;
+}
+
+int read_wav_file(const char *file_name, WavFile *wav)
+{
+	struct wav_index_entry entry;
+	uint32_t start = audio_stats_now();
+	char fpath[MAX_PATH];
+	uint32_t mtime;
+	uint32_t size;
+	int ret;
+
+	ret = wav_path(fpath, sizeof(fpath), file_name);
+	if (ret < 0) {
+		return ret;
+	}
+
+	// Open the WAV file
+	memset(wav, 0, sizeof(*wav));
+	fs_file_t_init(&wav->file);
+	ret = fs_open(&wav->file, fpath, FS_O_READ);
+	if (ret < 0) {
+		LOG_ERR("Failed to open file: %d", ret);
+		return ret;
+	}
+	mtime = wav_mtime(fpath);
+	wav_fast_seek_init(wav);
+	size = f_size((FIL *)wav->file.filep);
+
+	// A file unchanged since it was indexed goes straight to its first sample
+	if (wav_index_find(file_name, &entry) == 0 && entry.size == size &&
+	    entry.mtime == mtime && !(entry.flags & WAV_INDEX_CUES)) {
+		wav->format = entry.format;
+		ret = fs_seek(&wav->file, wav->format.data_offset, FS_SEEK_SET);
+	} else {
+		ret = wav_parse(wav);
+		if (ret == 0) {
+			wav_index_add(file_name, size, mtime, &wav->format,
+				      wav->cue_count > 0 ? WAV_INDEX_CUES : 0);
 		}
-		count++;
+	}
+	if (ret < 0) {
+		fs_close(&wav->file);
+		return ret;
 	}
 
-	/* Verify fs_closedir() */
-	fs_closedir(&dirp);
-	if (res == 0) {
-		res = count;
+	wav->data_remaining = wav->format.data_size;
+	wav->is_open = true;
+	audio_stats_stage(AUDIO_STAGE_OPEN, start);
+
+	LOG_INF("WAV File Info:");
+	LOG_INF("  Sample Rate: %u Hz", wav->format.sample_rate);
+	LOG_INF("  Channels: %u", wav->format.num_channels);
+	LOG_INF("  Bits per Sample: %u (%u valid)", wav->format.bits_per_sample,
+		wav->format.valid_bits);
+	LOG_INF("  Format: %s", wav_format_name(wav->format.audio_format));
+	LOG_INF("  Data: %u bytes at offset %u", wav->format.data_size, wav->format.data_offset);
+	for (int i = 0; i < wav->cue_count; i++) {
+		LOG_INF("  Cue %d at frame %u", i + 1, wav->cues[i]);
+	}
+
+	return 0;
+}
+
+void close_wav_file(WavFile *wav)
+{
+	if (wav->is_open) {
+		fs_close(&wav->file);
+		wav->is_open = false;
+	}
+}
+
+// Every fs_read of sample data is accounted here, whether staged or not
+static int32_t wav_fs_read(WavFile *wav, void *buffer, uint32_t size)
+{
+	uint32_t start = audio_stats_now();
+	int32_t num_read = fs_read(&wav->file, buffer, size);
+
+	audio_stats_stage(AUDIO_STAGE_READ, start);
+
+	return num_read;
+}
+
+// Refill the empty staging buffer, returns the number of bytes fetched
+static int32_t wav_stage_fill(WavFile *wav)
+{
+	// The stage is empty, so the file is positioned data_remaining bytes before the end
+	uint32_t pos = wav->format.data_offset + wav->format.data_size - wav->data_remaining;
+	// The first read stops at a sector boundary so the ones after it are aligned
+	uint32_t size = MIN(wav->stage_size - pos % WAV_SECTOR_SIZE, wav->data_remaining);
+	int32_t num_read;
+
+	audio_mem_dma_write_prepare(wav->stage, size);
+	num_read = wav_fs_read(wav, wav->stage, size);
+	audio_mem_dma_write_complete(wav->stage, size);
+
+	wav->stage_pos = 0;
+	wav->stage_len = MAX(num_read, 0);
+
+	return num_read;
+}
+
+int wav_seek(WavFile *wav, uint32_t offset)
+{
+	// Data offset of the first staged byte, the stage_pos byte is the next to read
+	uint32_t staged = wav->format.data_size - wav->data_remaining - wav->stage_pos;
+	int ret;
+
+	if (!wav->is_open) {
+		return -EBADF;
+	}
+
+	offset = MIN(offset, wav->format.data_size);
+
+	if (wav->stage != NULL && offset >= staged && offset < staged + wav->stage_len) {
+		// Short loops stay within the staged chunk
+		wav->stage_pos = offset - staged;
+		wav->data_remaining = wav->format.data_size - offset;
+		return 0;
+	}
+
+	ret = fs_seek(&wav->file, wav->format.data_offset + offset, FS_SEEK_SET);
+	if (ret < 0) {
+		LOG_ERR("Failed to seek: %d", ret);
+		return ret;
+	}
+
+	wav->data_remaining = wav->format.data_size - offset;
+	wav->stage_pos = 0;
+	wav->stage_len = 0;
+
+	return 0;
+}
+
+void wav_set_read_buffer(WavFile *wav, void *buf, uint32_t size)
+{
+	wav->stage = buf;
+	wav->stage_size = size;
+	wav->stage_pos = 0;
+	wav->stage_len = 0;
+}
+
+int32_t wav_read_staged(WavFile *wav, const uint8_t **data, uint32_t size)
+{
+	int32_t num_read;
+
+	if (!wav->is_open) {
+		return -EBADF;
+	}
+	if (wav->stage == NULL) {
+		return -EINVAL;
+	}
+
+	size = MIN(size, wav->data_remaining);
+	if (size == 0) {
+		return 0;
+	}
+
+	if (wav->stage_pos == wav->stage_len) {
+		num_read = wav_stage_fill(wav);
+		if (num_read <= 0) {
+			return num_read;
+		}
+	}
+
+	size = MIN(size, wav->stage_len - wav->stage_pos);
+	*data = wav->stage + wav->stage_pos;
+	wav->stage_pos += size;
+	wav->data_remaining -= size;
+
+	return size;
+}
+
+int32_t read_data(WavFile *wav, void *buffer, uint32_t block_size)
+{
+	uint8_t *dst = buffer;
+	uint32_t done = 0;
+	int32_t num_read;
+
+	if (!wav->is_open) {
+		return -EBADF;
+	}
+
+	// Never read past the data chunk into trailing metadata
+	block_size = MIN(block_size, wav->data_remaining);
+
+	if (wav->stage == NULL) {
+		num_read = wav_fs_read(wav, buffer, block_size);
+		if (num_read > 0) {
+			wav->data_remaining -= num_read;
+		}
+		return num_read;
+	}
+
+	while (done < block_size) {
+		const uint8_t *src;
+
+		num_read = wav_read_staged(wav, &src, block_size - done);
+		if (num_read <= 0) {
+			// Hand out what was staged, the error shows on the next call
+			if (done > 0) {
+				break;
+			}
+			return num_read;
+		}
+
+		// One copy per sample buys large sector-aligned card reads. Reading straight
+		// into the caller's block would cost card commands per block again, block
+		// sizes are rarely a multiple of the sector size.
+		memcpy(dst + done, src, num_read);
+		done += num_read;
+	}
+
+	return done;
+}
+
+// Write the header for the current data size at the start of the file
+static int wav_write_header(WavFile *wav)
+{
+	const WavFormat *format = &wav->format;
+	uint8_t header[WAV_WRITE_HEADER_SIZE] = {0};
+	RiffHeader riff = {
+		.riff = {.chunk_id = {'R', 'I', 'F', 'F'},
+			 .chunk_size =
+				 WAV_WRITE_HEADER_SIZE - sizeof(ChunkHeader) + format->data_size},
+		.format = {'W', 'A', 'V', 'E'},
+	};
+	ChunkHeader fmt_header = {.chunk_id = {'f', 'm', 't', ' '},
+				  .chunk_size = offsetof(FmtChunk, cb_size)};
+	FmtChunk fmt = {
+		.audio_format = format->audio_format,
+		.num_channels = format->num_channels,
+		.sample_rate = format->sample_rate,
+		.byte_rate = format->sample_rate * format->block_align,
+		.block_align = format->block_align,
+		.bits_per_sample = format->bits_per_sample,
+	};
+	size_t pos = 0;
+	ChunkHeader junk = {.chunk_id = {'J', 'U', 'N', 'K'}};
+	ChunkHeader data = {.chunk_id = {'d', 'a', 't', 'a'}, .chunk_size = format->data_size};
+	int ret;
+
+	memcpy(&header[pos], &riff, sizeof(riff));
+	pos += sizeof(riff);
+	memcpy(&header[pos], &fmt_header, sizeof(fmt_header));
+	pos += sizeof(fmt_header);
+	memcpy(&header[pos], &fmt, fmt_header.chunk_size);
+	pos += fmt_header.chunk_size;
+
+	// Pad up to the data chunk header that ends the first sector
+	junk.chunk_size = WAV_WRITE_HEADER_SIZE - pos - 2 * sizeof(ChunkHeader);
+	memcpy(&header[pos], &junk, sizeof(junk));
+	memcpy(&header[WAV_WRITE_HEADER_SIZE - sizeof(data)], &data, sizeof(data));
+
+	ret = fs_seek(&wav->file, 0, FS_SEEK_SET);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = fs_write(&wav->file, header, sizeof(header));
+	if (ret < 0) {
+		return ret;
+	}
+
+	return ret < (int)sizeof(header) ? -ENOSPC : 0;
+}
+
+int create_wav_file(const char *file_name, WavFile *wav, uint16_t num_channels,
+		    uint32_t sample_rate, uint32_t max_data)
+{
+	char fpath[MAX_PATH];
+	int ret;
+
+	ret = wav_path(fpath, sizeof(fpath), file_name);
+	if (ret < 0) {
+		return ret;
+	}
+
+	// The old header is gone, the file is parsed again when it is next opened
+	wav_index_forget(file_name);
+
+	memset(wav, 0, sizeof(*wav));
+	fs_file_t_init(&wav->file);
+	ret = fs_open(&wav->file, fpath, FS_O_CREATE | FS_O_RDWR | FS_O_TRUNC);
+	if (ret < 0) {
+		LOG_ERR("Failed to create %s: %d", fpath, ret);
+		return ret;
 	}
-	fs_unmount(&mp);
 
-	return;
-}
\ No newline at end of file
+	wav->format.audio_format = WAVE_FORMAT_PCM;
+	wav->format.num_channels = num_channels;
+	wav->format.sample_rate = sample_rate;
+	wav->format.bits_per_sample = 16;
+	wav->format.valid_bits = 16;
+	wav->format.block_align = num_channels * sizeof(int16_t);
+	wav->format.data_offset = WAV_WRITE_HEADER_SIZE;
+	max_data -= max_data % wav->format.block_align;
+
+#if FF_USE_EXPAND
+	// Contiguous clusters for the whole recording, the file is trimmed when it is finished
+	res = f_expand(wav->file.filep, WAV_WRITE_HEADER_SIZE + max_data, 1);
+	if (res != FR_OK) {
+		LOG_WRN("Could not preallocate %u bytes (%d), writes will allocate clusters",
+			WAV_WRITE_HEADER_SIZE + max_data, res);
+	}
+#else
+	LOG_WRN("FatFS built without f_expand, writes will allocate clusters");
+#endif
+
+	ret = wav_write_header(wav);
+	if (ret < 0) {
+		LOG_ERR("Failed to write header: %d", ret);
+		fs_close(&wav->file);
+		return ret;
+	}
+
+	wav->data_remaining = max_data;
+	wav->is_open = true;
+
+	return 0;
+}
+
+int32_t write_data(WavFile *wav, const void *buffer, uint32_t size)
+{
+	int32_t num_written;
+
+	if (!wav->is_open) {
+		return -EBADF;
+	}
+
+	// Stay within the preallocated clusters
+	num_written = fs_write(&wav->file, buffer, MIN(size, wav->data_remaining));
+	if (num_written > 0) {
+		wav->data_remaining -= num_written;
+		wav->format.data_size += num_written;
+	}
+
+	return num_written;
+}
+
+int finish_wav_file(WavFile *wav)
+{
+	int ret;
+
+	if (!wav->is_open) {
+		return -EBADF;
+	}
+
+	ret = fs_truncate(&wav->file, WAV_WRITE_HEADER_SIZE + wav->format.data_size);
+	if (ret == 0) {
+		ret = wav_write_header(wav);
+	}
+
+	fs_close(&wav->file);
+	wav->is_open = false;
+
+	return ret;
+}
+
+int wav_list(wav_list_cb_t cb, void *ctx)
+{
+	char name[MAX_PATH];
+	int count = 0;
+	int ret;
+
+	ret = wav_mount();
+	if (ret < 0) {
+		return ret;
+	}
+
+	// Served from the index, files whose header does not parse are left out
+	for (int id = 0; id < wav_index_count(); id++) {
+		size_t len;
+
+		if (wav_index_name(id, name, sizeof(name)) < 0) {
+			continue;
+		}
+		len = strlen(name);
+		if (len > 4 && strcasecmp(&name[len - 4], ".wav") == 0) {
+			cb(name, ctx);
+			count++;
+		}
+	}
+
+	return count;
+}
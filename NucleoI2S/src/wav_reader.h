@@ -1,34 +1,162 @@
 #ifndef WAV_READER_H_
 #define WAV_READER_H_
 
+#include <zephyr/fs/fs.h>
 #include <ff.h> // FatFS headers
 
-// WAV file header structure
+// Format tags found in the fmt chunk
+#define WAVE_FORMAT_PCM        0x0001
+#define WAVE_FORMAT_IEEE_FLOAT 0x0003
+#define WAVE_FORMAT_IMA_ADPCM  0x0011
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+// Registered tag for FLAC in WAV, also used for native FLAC files
+#define WAVE_FORMAT_FLAC       0xF1AC
+
+// Every RIFF chunk starts with this header, the body is padded to an even size
 typedef struct {
-	char chunk_id[4]; // "RIFF"
+	char chunk_id[4];
 	uint32_t chunk_size;
-	char format[4];       // "WAVE"
-	char subchunk1_id[4]; // "fmt "
-	uint32_t subchunk1_size;
+} ChunkHeader;
+
+// RIFF header at the start of the file
+typedef struct {
+	ChunkHeader riff; // "RIFF"
+	char format[4];   // "WAVE"
+} RiffHeader;
+
+// Body of the fmt chunk, the fields after bits_per_sample only exist for EXTENSIBLE
+typedef struct {
 	uint16_t audio_format;
 	uint16_t num_channels;
 	uint32_t sample_rate;
 	uint32_t byte_rate;
 	uint16_t block_align;
 	uint16_t bits_per_sample;
-	char subchunk2_id[4];
-	uint32_t subchunk2_size;
-} WavHeader;
+	uint16_t cb_size;
+	uint16_t valid_bits_per_sample;
+	uint32_t channel_mask;
+	uint8_t sub_format[16];
+} FmtChunk;
+
+// Entry of the cue chunk, sample_offset is the frame the cue marks
+typedef struct {
+	uint32_t id;
+	uint32_t position;
+	char chunk_id[4]; // "data"
+	uint32_t chunk_start;
+	uint32_t block_start;
+	uint32_t sample_offset;
+} CuePoint;
+
+// Cue points kept per file, the rest are ignored
+#define WAV_MAX_CUES 8
+
+// Stream format of an opened WAV file
+typedef struct {
+	uint16_t audio_format; // one of the WAVE_FORMAT_* tags above, never EXTENSIBLE
+	uint16_t num_channels;
+	uint32_t sample_rate;
+	uint16_t block_align;     // bytes per frame, bytes per ADPCM block, 0 for FLAC
+	uint16_t bits_per_sample; // container size of one sample
+	uint16_t valid_bits;      // significant bits, <= bits_per_sample
+	uint16_t samples_per_block; // frames per ADPCM block, largest FLAC block
+	uint32_t data_offset;     // file offset of the first sample
+	uint32_t data_size;       // length of the data chunk in bytes
+} WavFormat;
 
 typedef struct {
-	char subchunk_id[4]; // "data"
-	uint32_t subchunk_size;
-} SubchunkHeader;
+	struct fs_file_t file;
+	WavFormat format;
+	uint32_t data_remaining; // bytes read_data has yet to return
+	bool is_open;
+	// Optional staging buffer set with wav_set_read_buffer
+	uint8_t *stage;
+	uint32_t stage_size;
+	uint32_t stage_pos; // next byte to hand out
+	uint32_t stage_len; // bytes fetched into stage
+	uint32_t cues[WAV_MAX_CUES]; // frames marked in the cue chunk, in file order
+	uint8_t cue_count;
+#if FF_USE_FASTSEEK
+	// FatFS cluster link map, seeks look clusters up here instead of walking the FAT
+	DWORD clmt[CONFIG_AUDIO_SEEK_CLMT_SIZE];
+#endif
+} WavFile;
+
+// FatFS transfers whole sectors of this size straight to the caller's buffer
+#define WAV_SECTOR_SIZE 512
+
+// Header size of files written by create_wav_file, a JUNK chunk pads it so that
+// the samples start on a sector boundary
+#define WAV_WRITE_HEADER_SIZE 512
+
+/*
+ * Open a WAV or native FLAC file and position it at the first sample of the data
+ * chunk or at the first FLAC frame. For compressed formats data_size counts the
+ * encoded bytes.
+ */
+int read_wav_file(const char *file_name, WavFile *wav);
+void close_wav_file(WavFile *wav);
+
+// Name of a fmt chunk format tag, for logs and listings
+const char *wav_format_name(uint16_t audio_format);
+
+/*
+ * Read up to block_size bytes of sample (or encoded) data, returns 0 at the end of
+ * the data. With a read buffer set the bytes are copied out of it.
+ */
+int32_t read_data(WavFile *wav, void *buffer, uint32_t block_size);
+
+/*
+ * Take up to size bytes of data in place from the staging buffer, refilling it
+ * when it is empty, and point *data at them. They stay valid until the next read
+ * or seek. Returns fewer bytes than size where the staged chunk ends, 0 at the end
+ * of the data and -EINVAL without a buffer set with wav_set_read_buffer.
+ */
+int32_t wav_read_staged(WavFile *wav, const uint8_t **data, uint32_t size);
+
+/*
+ * Continue reading at offset bytes into the sample (or encoded) data. When the
+ * offset is still in the staging buffer no card access is needed. Offsets past the
+ * end are clamped to it.
+ */
+int wav_seek(WavFile *wav, uint32_t offset);
+
+/*
+ * Serve read_data from buf, which is refilled with one large fs_read at a time.
+ * After the first refill every read starts on a sector boundary and, except at the
+ * end of the data, covers whole sectors, so FatFS reads them with multi-block
+ * commands straight into buf instead of copying through its window. buf must be
+ * a DMA buffer (see audio_mem.h) and size a multiple of WAV_SECTOR_SIZE. Pass
+ * NULL to read straight into the caller's buffers again.
+ */
+void wav_set_read_buffer(WavFile *wav, void *buf, uint32_t size);
+
+/*
+ * Create a 16-bit PCM WAV file for writing. Clusters for max_data bytes of samples
+ * are allocated up front when FatFS is built with f_expand, so writes never wait
+ * for the FAT allocator.
+ */
+int create_wav_file(const char *file_name, WavFile *wav, uint16_t num_channels,
+		    uint32_t sample_rate, uint32_t max_data);
+
+// Append sample data, returns fewer bytes than size once max_data is reached
+int32_t write_data(WavFile *wav, const void *buffer, uint32_t size);
+
+// Trim the file to the data written, patch the sizes into the header and close it
+int finish_wav_file(WavFile *wav);
+
+/*
+ * Mount the card and index its playable files, see wav_index.h. The card stays
+ * mounted, later calls return at once. Any file access mounts on demand, calling
+ * this at boot only moves the scan out of the first play command.
+ */
+int wav_storage_init(void);
 
-// Function to read a WAV file
-void read_wav_file(const char *file_name);
-int32_t read_data(int16_t *buffer, uint32_t block_size);
+// Index the card again, returns the number of indexed files
+int wav_rescan(void);
 
-void lsdir(void);
+// Call cb with the name of every .wav file in the card's root, returns the count
+typedef void (*wav_list_cb_t)(const char *name, void *ctx);
+int wav_list(wav_list_cb_t cb, void *ctx);
 
 #endif /* WAV_READER_H_ */
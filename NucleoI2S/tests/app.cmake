@@ -0,0 +1,33 @@
+# SPDX-License-Identifier: Apache-2.0
+#
+# Shared by the test suites. Include it before find_package(Zephyr): the suite is
+# then configured like the application, with its Kconfig, prj.conf and board
+# files, plus the suite's own prj.conf. After find_package, app_test_sources()
+# adds every application source but main.c, whose main() ztest replaces.
+#
+#   west twister -T NucleoI2S/tests -p native_sim
+
+set(APP_DIR ${CMAKE_CURRENT_LIST_DIR}/..)
+
+set(KCONFIG_ROOT ${APP_DIR}/Kconfig)
+set(APPLICATION_CONFIG_DIR ${APP_DIR})
+list(APPEND EXTRA_CONF_FILE ${CMAKE_CURRENT_SOURCE_DIR}/prj.conf)
+list(APPEND DTS_ROOT ${APP_DIR})
+
+macro(app_test_sources)
+  file(GLOB app_test_sources ${APP_DIR}/src/*.c)
+  list(REMOVE_ITEM app_test_sources ${APP_DIR}/src/main.c)
+  target_sources(app PRIVATE ${app_test_sources})
+  target_include_directories(app PRIVATE ${APP_DIR}/src)
+  if(CONFIG_AUDIO_SEEK_FAST)
+    target_include_directories(zephyr_interface BEFORE INTERFACE ${APP_DIR}/fatfs)
+  endif()
+
+  target_sources_ifdef(CONFIG_I2S_SINK_SIM app PRIVATE ${APP_DIR}/sim/i2s_sink_sim.c)
+  if(CONFIG_ARCH_POSIX)
+    target_include_directories(app PRIVATE ${APP_DIR}/sim)
+  endif()
+  if(CONFIG_NATIVE_LIBRARY)
+    target_sources(native_simulator INTERFACE ${APP_DIR}/sim/host_clock.c)
+  endif()
+endmacro()
@@ -0,0 +1,16 @@
+/*
+ * Mean DWT cycles per 25 ms block of each kernel on the NUCLEO-H723ZG at 550 MHz,
+ * from a -Os build. A kernel 0 has not been measured and is only held to its
+ * budget. Paste the BENCH_KERNEL lines the bench suite prints to update them.
+ */
+
+// Runs are deterministic on the M7, only cache and flash wait states move them
+#define BENCH_TOLERANCE_PCT 10
+
+#define BENCH_BASELINES(BENCH_KERNEL)                                                              \
+	BENCH_KERNEL(tone, 0)                                                                      \
+	BENCH_KERNEL(convert, 0)                                                                   \
+	BENCH_KERNEL(resample, 0)                                                                  \
+	BENCH_KERNEL(mix, 0)                                                                       \
+	BENCH_KERNEL(filter, 0)                                                                    \
+	BENCH_KERNEL(read, 0)
@@ -0,0 +1,80 @@
+#include <string.h>
+
+#include <zephyr/ztest.h>
+
+#include "audio_bench.h"
+
+#include BENCH_BASELINE
+
+/* ----- private static variables and types ----- */
+struct bench_baseline {
+	const char *name;
+	uint32_t cycles; // 0 when not measured yet
+};
+
+#define BENCH_KERNEL(name, cycles) {#name, cycles},
+static const struct bench_baseline baselines[] = {BENCH_BASELINES(BENCH_KERNEL)};
+#undef BENCH_KERNEL
+
+/* ----- function definitions ----- */
+static const struct bench_baseline *baseline_find(const char *name)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(baselines); i++) {
+		if (strcmp(baselines[i].name, name) == 0) {
+			return &baselines[i];
+		}
+	}
+
+	return NULL;
+}
+
+ZTEST_SUITE(bench, NULL, NULL, NULL, NULL, NULL);
+
+/*
+ * Every kernel within its share of the block period on any platform and, where it
+ * has been measured, within the tolerance of this platform's baseline
+ */
+ZTEST(bench, test_kernels)
+{
+	struct audio_bench_kernel res[AUDIO_BENCH_KERNELS];
+	uint32_t checked = 0;
+	uint32_t failed = 0;
+
+	zassert_ok(audio_bench_kernels_time(res));
+
+	// In the form of the baseline file, so a new measurement can be pasted there
+	for (size_t i = 0; i < ARRAY_SIZE(res); i++) {
+		TC_PRINT("BENCH_KERNEL(%s, %u) // max %u\n", res[i].name, res[i].mean, res[i].max);
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(res); i++) {
+		zassert_true(res[i].share <= res[i].budget,
+			     "%s takes %u.%02u%% of the block, budget %u.%02u%%", res[i].name,
+			     res[i].share / 100, res[i].share % 100, res[i].budget / 100,
+			     res[i].budget % 100);
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(res); i++) {
+		const struct bench_baseline *base = baseline_find(res[i].name);
+		uint64_t limit;
+
+		zassert_not_null(base, "No baseline for %s", res[i].name);
+		if (base->cycles == 0) {
+			continue;
+		}
+
+		limit = (uint64_t)base->cycles * (100 + BENCH_TOLERANCE_PCT) / 100;
+		if (res[i].mean > limit) {
+			TC_PRINT("%s regressed: %u cycles, baseline %u + %u%%\n", res[i].name,
+				 res[i].mean, base->cycles, BENCH_TOLERANCE_PCT);
+			failed++;
+		}
+		checked++;
+	}
+
+	if (checked == 0) {
+		TC_PRINT("No kernel has a baseline on this platform yet, budgets only\n");
+	}
+
+	zassert_equal(failed, 0, "%u of %u kernels regressed", failed, checked);
+}
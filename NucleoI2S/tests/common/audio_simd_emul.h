@@ -0,0 +1,49 @@
+#ifndef AUDIO_SIMD_EMUL_H_
+#define AUDIO_SIMD_EMUL_H_
+
+#include <stdint.h>
+
+/*
+ * The Cortex-M DSP intrinsics used by the packed kernels, in portable C with the
+ * semantics of the ARM instructions. Test builds on native_sim define
+ * AUDIO_SIMD_EMULATE to run those kernels against the scalar references on the
+ * host, the board runs them on the real instructions.
+ */
+
+static inline int32_t emul_sat16(int32_t x)
+{
+	return x > INT16_MAX ? INT16_MAX : (x < INT16_MIN ? INT16_MIN : x);
+}
+
+static inline int32_t __QADD(int32_t a, int32_t b)
+{
+	int64_t sum = (int64_t)a + b;
+
+	return sum > INT32_MAX ? INT32_MAX : (sum < INT32_MIN ? INT32_MIN : (int32_t)sum);
+}
+
+static inline uint32_t __QADD16(uint32_t a, uint32_t b)
+{
+	int32_t lo = emul_sat16((int16_t)a + (int16_t)b);
+	int32_t hi = emul_sat16((int16_t)(a >> 16) + (int16_t)(b >> 16));
+
+	return (uint16_t)lo | ((uint32_t)(uint16_t)hi << 16);
+}
+
+static inline int32_t __SMULBB(uint32_t a, uint32_t b)
+{
+	return (int32_t)(int16_t)a * (int16_t)b;
+}
+
+static inline int32_t __SMULTB(uint32_t a, uint32_t b)
+{
+	return (int32_t)(int16_t)(a >> 16) * (int16_t)b;
+}
+
+// Bottom half of a with the top half of b shifted left, and the reverse
+#define __PKHBT(a, b, sh) \
+	(((uint32_t)(a) & 0x0000FFFFu) | (((uint32_t)(b) << (sh)) & 0xFFFF0000u))
+#define __PKHTB(a, b, sh) \
+	(((uint32_t)(a) & 0xFFFF0000u) | ((uint32_t)((int32_t)(b) >> (sh)) & 0x0000FFFFu))
+
+#endif /* AUDIO_SIMD_EMUL_H_ */
@@ -0,0 +1,148 @@
+#include <math.h>
+#include <string.h>
+
+#include <zephyr/ztest.h>
+
+#include "audio_convert.h"
+#include "audio_simd.h"
+
+/* ----- definitions ----- */
+
+// Odd lengths leave a scalar tail after the packed loops of every kernel
+#define SAMPLES 1021
+
+#define SEED        1u
+#define DITHER_SEED 0x2545f491u
+#define LCG_NEXT(x) ((x) * 1664525u + 1013904223u)
+
+/* ----- private static variables ----- */
+static uint32_t input[SAMPLES];
+static int16_t ref[2 * SAMPLES];
+static union {
+	uint32_t words[SAMPLES];
+	int16_t pcm[2 * SAMPLES];
+} fast;
+
+/* ----- function definitions ----- */
+
+// Fixed noise over the full range, then the values where rounding saturates
+static void *convert_setup(void)
+{
+	static const uint32_t edges[] = {
+		0x7FFFFFFF, 0x80000000, 0x7FFF7FFF, 0x7FFF8000, 0xFFFF7FFF, 0xFFFF8000, 0x00008000,
+		0x00007FFF, 0x00000000, 0xFFFFFFFF,
+	};
+	uint32_t seed = SEED;
+
+	for (size_t i = 0; i < SAMPLES; i++) {
+		input[i] = seed = LCG_NEXT(seed);
+	}
+	memcpy(input, edges, sizeof(edges));
+
+	TC_PRINT("%s kernels against the scalar reference\n", AUDIO_SIMD ? "Packed" : "Scalar");
+
+	return NULL;
+}
+
+static void convert_before(void *fixture)
+{
+	memset(ref, 0x55, sizeof(ref));
+	memset(&fast, 0xAA, sizeof(fast));
+}
+
+ZTEST_SUITE(convert, NULL, convert_setup, convert_before, NULL, NULL);
+
+ZTEST(convert, test_s24)
+{
+	// Every length up to a full word group, each with the dither carried through
+	for (size_t n = SAMPLES - 4; n <= SAMPLES; n++) {
+		uint32_t dither_ref = DITHER_SEED;
+		uint32_t dither_fast = DITHER_SEED;
+
+		audio_convert_s24_to_q15_ref(ref, (const uint8_t *)input, n, &dither_ref);
+		memcpy(fast.words, input, sizeof(input));
+		audio_convert_s24_to_q15(fast.pcm, (const uint8_t *)fast.words, n, &dither_fast);
+
+		zassert_mem_equal(fast.pcm, ref, n * sizeof(int16_t), "%zu samples differ", n);
+		zassert_equal(dither_fast, dither_ref, "Dither state differs after %zu samples", n);
+	}
+}
+
+ZTEST(convert, test_s32)
+{
+	for (size_t n = SAMPLES - 1; n <= SAMPLES; n++) {
+		audio_convert_s32_to_q15_ref(ref, (const int32_t *)input, n);
+		memcpy(fast.words, input, sizeof(input));
+		audio_convert_s32_to_q15(fast.pcm, (const int32_t *)fast.words, n);
+
+		zassert_mem_equal(fast.pcm, ref, n * sizeof(int16_t), "%zu samples differ", n);
+	}
+
+	// Rounding to nearest saturates instead of wrapping
+	zassert_equal(ref[0], INT16_MAX);
+	zassert_equal(ref[1], INT16_MIN);
+	zassert_equal(ref[3], INT16_MAX);
+}
+
+ZTEST(convert, test_f32)
+{
+	static const float edges[] = {
+		1.0f, -1.0f, 0.99999994f, -0.99999994f, NAN, -INFINITY, INFINITY, 0.5f, -0.5f,
+		1.5e-5f, -1.5e-5f, 2.0f,
+	};
+	static float fsrc[SAMPLES];
+
+	// Floats up to +-2.0 so both sides saturate
+	for (size_t i = 0; i < SAMPLES; i++) {
+		fsrc[i] = (float)(int32_t)input[i] / (float)(1 << 30);
+	}
+	memcpy(fsrc, edges, sizeof(edges));
+
+	audio_convert_f32_to_q15_ref(ref, fsrc, SAMPLES);
+	memcpy(fast.words, fsrc, sizeof(fsrc));
+	audio_convert_f32_to_q15(fast.pcm, (const float *)fast.words, SAMPLES);
+
+	zassert_mem_equal(fast.pcm, ref, SAMPLES * sizeof(int16_t), "Samples differ");
+	zassert_equal(ref[0], INT16_MAX);
+	zassert_equal(ref[1], INT16_MIN);
+	zassert_equal(ref[4], 0);
+}
+
+ZTEST(convert, test_mono_to_stereo)
+{
+	for (size_t n = SAMPLES - 1; n <= SAMPLES; n++) {
+		memcpy(ref, input, n * sizeof(int16_t));
+		audio_convert_mono_to_stereo_ref(ref, n);
+		memcpy(fast.pcm, input, n * sizeof(int16_t));
+		audio_convert_mono_to_stereo(fast.pcm, n);
+
+		zassert_mem_equal(fast.pcm, ref, 2 * n * sizeof(int16_t), "%zu frames differ", n);
+	}
+}
+
+// The block conversion chains a kernel and the upmix in place
+ZTEST(convert, test_block_mono_s24)
+{
+	const WavFormat format = {
+		.audio_format = WAVE_FORMAT_PCM,
+		.num_channels = 1,
+		.bits_per_sample = 24,
+		.valid_bits = 24,
+		.block_align = 3,
+	};
+	struct audio_convert cv;
+	uint32_t dither = DITHER_SEED;
+	size_t frames;
+
+	zassert_ok(audio_convert_init(&cv, &format));
+	frames = audio_convert_max_frames(&cv, sizeof(fast));
+	zassert_equal(frames, sizeof(fast) / AUDIO_OUT_FRAME_BYTES);
+
+	audio_convert_s24_to_q15_ref(ref, (const uint8_t *)input, frames, &dither);
+	audio_convert_mono_to_stereo_ref(ref, frames);
+	memcpy(fast.words, input, sizeof(input));
+	zassert_equal(audio_convert_block(&cv, fast.words, frames),
+		      frames * AUDIO_OUT_FRAME_BYTES);
+
+	zassert_mem_equal(fast.pcm, ref, 2 * frames * sizeof(int16_t), "Frames differ");
+}
@@ -0,0 +1,224 @@
+#include <string.h>
+
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/ztest.h>
+
+#include "audio_decode.h"
+#include "audio_stats.h"
+
+/* ----- definitions ----- */
+
+// Longest expected output, in samples
+#define MAX_SAMPLES 12288
+
+#define FIXTURE(file, enc_data, raw_data)                                                          \
+	{                                                                                          \
+		.name = file, .enc = enc_data, .enc_size = sizeof(enc_data), .raw = raw_data,     \
+		.raw_size = sizeof(raw_data),                                                      \
+	}
+
+struct fixture {
+	const char *name;
+	const uint8_t *enc;
+	size_t enc_size;
+	const uint8_t *raw;
+	size_t raw_size;
+};
+
+/* ----- private static variables ----- */
+static const uint8_t adpcm_s16_wav[] = {
+#include "adpcm_s16.wav.inc"
+};
+static const uint8_t adpcm_s16_raw[] = {
+#include "adpcm_s16.raw.inc"
+};
+static const uint8_t adpcm_m16_wav[] = {
+#include "adpcm_m16.wav.inc"
+};
+static const uint8_t adpcm_m16_raw[] = {
+#include "adpcm_m16.raw.inc"
+};
+static const uint8_t flac_s16_flac[] = {
+#include "flac_s16.flac.inc"
+};
+static const uint8_t flac_s16_raw[] = {
+#include "flac_s16.raw.inc"
+};
+static const uint8_t flac_s24_flac[] = {
+#include "flac_s24.flac.inc"
+};
+static const uint8_t flac_s24_raw[] = {
+#include "flac_s24.raw.inc"
+};
+static const uint8_t flac_m8_flac[] = {
+#include "flac_m8.flac.inc"
+};
+static const uint8_t flac_m8_raw[] = {
+#include "flac_m8.raw.inc"
+};
+
+static const struct fixture adpcm_s16 = FIXTURE("adpcm_s16.wav", adpcm_s16_wav, adpcm_s16_raw);
+static const struct fixture adpcm_m16 = FIXTURE("adpcm_m16.wav", adpcm_m16_wav, adpcm_m16_raw);
+static const struct fixture flac_s16 = FIXTURE("flac_s16.flac", flac_s16_flac, flac_s16_raw);
+static const struct fixture flac_s24 = FIXTURE("flac_s24.flac", flac_s24_flac, flac_s24_raw);
+static const struct fixture flac_m8 = FIXTURE("flac_m8.flac", flac_m8_flac, flac_m8_raw);
+
+static WavFile wav;
+static struct audio_decode dec;
+static int16_t pcm[MAX_SAMPLES];
+
+/* ----- function definitions ----- */
+
+/*
+ * Set wav up as read_wav_file would for the fixture, with the encoded data as its
+ * staging buffer so that it is read from memory. Only the fields the decoder uses
+ * are parsed.
+ */
+static void fixture_open(const struct fixture *f)
+{
+	const uint8_t *p = f->enc;
+	WavFormat *format = &wav.format;
+
+	memset(&wav, 0, sizeof(wav));
+
+	if (memcmp(p, "fLaC", 4) == 0) {
+		bool last = false;
+
+		// STREAMINFO comes first, then any other metadata blocks
+		format->audio_format = WAVE_FORMAT_FLAC;
+		format->samples_per_block = sys_get_be16(&p[8 + 2]);
+		format->num_channels = ((p[8 + 12] >> 1) & 0x07) + 1;
+		format->bits_per_sample = (((p[8 + 12] & 0x01) << 4) | (p[8 + 13] >> 4)) + 1;
+		for (p += 4; !last; p += 4 + sys_get_be24(&p[1])) {
+			last = (p[0] & 0x80) != 0;
+		}
+	} else {
+		zassert_mem_equal(&p[8], "WAVE", 4);
+		for (p += 12; memcmp(p, "data", 4) != 0; p += 8 + sys_get_le32(&p[4])) {
+			if (memcmp(p, "fmt ", 4) == 0) {
+				format->audio_format = sys_get_le16(&p[8]);
+				format->num_channels = sys_get_le16(&p[10]);
+				format->block_align = sys_get_le16(&p[20]);
+				format->bits_per_sample = sys_get_le16(&p[22]);
+				format->samples_per_block = sys_get_le16(&p[26]);
+			}
+		}
+		zassert_equal(format->audio_format, WAVE_FORMAT_IMA_ADPCM);
+		format->data_size = sys_get_le32(&p[4]);
+		p += 8;
+	}
+
+	if (format->data_size == 0) {
+		format->data_size = f->enc + f->enc_size - p;
+	}
+	format->data_offset = p - f->enc;
+
+	// The decoder only reads the staging buffer, it is never refilled
+	wav.stage = (uint8_t *)p;
+	wav.stage_size = format->data_size;
+	wav.stage_len = format->data_size;
+	wav.data_remaining = format->data_size;
+	wav.is_open = true;
+
+	zassert_ok(audio_decode_init(&dec, format));
+}
+
+// Decode the rest of the track chunk frames at a time into pcm, returns the frames
+static size_t decode_all(size_t chunk)
+{
+	const size_t max_frames = ARRAY_SIZE(pcm) / dec.channels;
+	size_t total = 0;
+	int ret;
+
+	do {
+		ret = audio_decode_frames(&dec, &wav, &pcm[total * dec.channels],
+					  MIN(chunk, max_frames - total));
+		zassert_true(ret >= 0, "Decode failed: %d", ret);
+		total += ret;
+	} while (ret > 0 && total < max_frames);
+
+	return total;
+}
+
+static void check_decode(const struct fixture *f, size_t chunk)
+{
+	enum audio_stage stage;
+	struct audio_stage_summary summary;
+	size_t frames;
+
+	fixture_open(f);
+	stage = dec.format == WAVE_FORMAT_IMA_ADPCM ? AUDIO_STAGE_DECODE_ADPCM
+						    : AUDIO_STAGE_DECODE_FLAC;
+	audio_stats_reset();
+
+	frames = decode_all(chunk);
+
+	zassert_equal(frames * dec.channels * sizeof(int16_t), f->raw_size,
+		      "%s: %zu frames decoded", f->name, frames);
+	zassert_mem_equal(pcm, f->raw, f->raw_size, "%s: samples differ", f->name);
+
+	// Cost on this platform, for comparing the codecs and the targets
+	audio_stats_stage_get(stage, &summary);
+	TC_PRINT("%s in %zu frame calls: %u us per 1000 frames\n", f->name, chunk,
+		 (uint32_t)(summary.total_us * 1000 / frames));
+}
+
+ZTEST_SUITE(decode, NULL, NULL, NULL, NULL, NULL);
+
+ZTEST(decode, test_adpcm_stereo)
+{
+	// Whole blocks at a time, then calls that end in the middle of blocks
+	check_decode(&adpcm_s16, 1017);
+	check_decode(&adpcm_s16, 333);
+}
+
+ZTEST(decode, test_adpcm_mono)
+{
+	check_decode(&adpcm_m16, 505);
+	check_decode(&adpcm_m16, 64);
+}
+
+// Seeks replay the block up to the target, also into the short last block
+ZTEST(decode, test_adpcm_seek)
+{
+	static const uint32_t targets[] = {2500, 1017, 40, 3002, 0};
+	const int16_t *raw = (const int16_t *)adpcm_s16.raw;
+	const size_t raw_frames = adpcm_s16.raw_size / (2 * sizeof(int16_t));
+
+	fixture_open(&adpcm_s16);
+
+	for (size_t i = 0; i < ARRAY_SIZE(targets); i++) {
+		size_t frames;
+
+		zassert_ok(audio_decode_seek(&dec, &wav, targets[i]));
+		frames = decode_all(100);
+
+		zassert_equal(frames, raw_frames - targets[i], "Seek to %u", targets[i]);
+		zassert_mem_equal(pcm, &raw[2 * targets[i]], frames * 2 * sizeof(int16_t),
+				  "Seek to %u", targets[i]);
+	}
+}
+
+ZTEST(decode, test_flac_s16)
+{
+	check_decode(&flac_s16, 4608);
+	check_decode(&flac_s16, 77);
+}
+
+// 24-bit samples are rounded to 16 bits
+ZTEST(decode, test_flac_s24)
+{
+	check_decode(&flac_s24, 4608);
+	check_decode(&flac_s24, 1000);
+}
+
+ZTEST(decode, test_flac_mono_8bit)
+{
+	check_decode(&flac_m8, 4608);
+}
+
+ZTEST(decode, test_flac_no_seek)
+{
+	fixture_open(&flac_s16);
+	zassert_equal(audio_decode_seek(&dec, &wav, 0), -ENOTSUP);
+}
@@ -0,0 +1,274 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/ztest.h>
+
+#include "audio_dsp.h"
+
+/* ----- definitions ----- */
+#define RATE         48000
+#define BLOCK_FRAMES 1200 // 25 ms
+#define THRESHOLD    -60  // 0.1 dBFS
+#define RELEASE_MS   20
+#define LOOKAHEAD    CONFIG_AUDIO_LIMITER_LOOKAHEAD
+
+#define SEED        1u
+#define LCG_NEXT(x) ((x) * 1664525u + 1013904223u)
+
+// Blocks the filters are given to settle before the output is measured
+#define SETTLE_BLOCKS 8
+
+/* ----- private static variables ----- */
+static int16_t block[2 * BLOCK_FRAMES];
+static int16_t limit; // largest output sample the threshold allows
+static uint32_t seed;
+
+/* ----- function definitions ----- */
+
+// Full-scale noise
+static int16_t noise(void)
+{
+	seed = LCG_NEXT(seed);
+
+	return (int16_t)(seed >> 16);
+}
+
+// Process the block and return its largest magnitude, INT16_MIN counts as 32768
+static int process(void)
+{
+	int peak = 0;
+
+	audio_dsp_process(block, BLOCK_FRAMES);
+	for (size_t i = 0; i < ARRAY_SIZE(block); i++) {
+		peak = MAX(peak, abs(block[i]));
+	}
+
+	return peak;
+}
+
+// A sine of freq over the block, continuing from frame, the right channel at half level
+static void sine(double amp, uint32_t freq, uint32_t frame)
+{
+	for (size_t i = 0; i < BLOCK_FRAMES; i++) {
+		double v = amp * sin(2 * M_PI * freq * (frame + i) / RATE);
+
+		block[2 * i] = (int16_t)lround(v);
+		block[2 * i + 1] = (int16_t)lround(v / 2);
+	}
+}
+
+// Level of the left channel in dB against amp, the block holds whole periods
+static double level_db(double amp)
+{
+	double sum = 0;
+
+	for (size_t i = 0; i < BLOCK_FRAMES; i++) {
+		sum += (double)block[2 * i] * block[2 * i];
+	}
+
+	return 20 * log10(sqrt(sum / BLOCK_FRAMES) / (amp / M_SQRT2));
+}
+
+static void *dsp_setup(void)
+{
+	// The threshold in the internal scale, rounded to the output as the chain does
+	double threshold = (INT32_MAX >> AUDIO_DSP_HEADROOM_BITS) * pow(10.0, THRESHOLD / 200.0);
+
+	limit = (int16_t)(threshold / (1 << (16 - AUDIO_DSP_HEADROOM_BITS)) + 0.5);
+	TC_PRINT("Limiting to %d with %d frames of look-ahead\n", limit, LOOKAHEAD);
+
+	return NULL;
+}
+
+static void dsp_before(void *fixture)
+{
+	seed = SEED;
+	zassert_ok(audio_dsp_init(RATE));
+	zassert_ok(audio_dsp_set_limiter(true, THRESHOLD, RELEASE_MS));
+}
+
+ZTEST_SUITE(dsp, NULL, dsp_setup, dsp_before, NULL, NULL);
+
+/*
+ * A peak that falls on every frame needs a slightly higher gain each frame, so
+ * every gain stays queued until it leaves the look-ahead window. The bursts fade
+ * slowly from full scale, then drop to just above the threshold at a point that
+ * moves with each block, with the shortest release so the gain follows quickly.
+ */
+ZTEST(dsp, test_limiter_decay)
+{
+	zassert_ok(audio_dsp_set_limiter(true, THRESHOLD, 1));
+
+	for (int b = 0; b < 40; b++) {
+		size_t drop = LOOKAHEAD + 3 * b;
+
+		for (size_t i = 0; i < BLOCK_FRAMES; i++) {
+			size_t t = i % 400;
+			int16_t v = t < drop ? INT16_MAX - t : limit + 400 - t;
+
+			block[2 * i] = i & 1 ? v : -v;
+			block[2 * i + 1] = block[2 * i] / 2;
+		}
+
+		zassert_true(process() <= limit, "Block %d above %d", b, limit);
+	}
+}
+
+// Lone full-scale clicks on a quiet tone, the look-ahead must catch each one
+ZTEST(dsp, test_limiter_clicks)
+{
+	for (int b = 0; b < 40; b++) {
+		for (size_t i = 0; i < BLOCK_FRAMES; i++) {
+			int16_t v = (int16_t)(3000 * sinf(2 * 3.14159265f * 440 * i / RATE));
+
+			seed = LCG_NEXT(seed);
+			if ((seed >> 24) == 0) {
+				v = (seed & BIT(8)) ? INT16_MAX : INT16_MIN;
+			}
+			block[2 * i] = v;
+			block[2 * i + 1] = -v;
+		}
+
+		zassert_true(process() <= limit, "Block %d above %d", b, limit);
+	}
+}
+
+// Full-scale squares, different in each channel
+ZTEST(dsp, test_limiter_square)
+{
+	for (int b = 0; b < 20; b++) {
+		for (size_t i = 0; i < BLOCK_FRAMES; i++) {
+			block[2 * i] = (i / 7) & 1 ? INT16_MAX : INT16_MIN;
+			block[2 * i + 1] = (i / (b + 1)) & 1 ? INT16_MIN : INT16_MAX;
+		}
+
+		zassert_true(process() <= limit, "Block %d above %d", b, limit);
+	}
+}
+
+// After a loud passage the gain recovers, and material below the threshold then
+// only comes out delayed by the look-ahead
+ZTEST(dsp, test_limiter_recovery)
+{
+	static int16_t input[2 * BLOCK_FRAMES];
+
+	for (size_t i = 0; i < ARRAY_SIZE(block); i++) {
+		block[i] = noise();
+	}
+	process();
+
+	for (int b = 0; b < 4; b++) {
+		for (size_t i = 0; i < BLOCK_FRAMES; i++) {
+			float phase = 2 * 3.14159265f * 1000 * i / RATE;
+
+			input[2 * i] = (int16_t)(limit / 2 * sinf(phase));
+			input[2 * i + 1] = input[2 * i] / 3;
+		}
+		memcpy(block, input, sizeof(block));
+		zassert_true(process() <= limit);
+	}
+
+	// Release, look-ahead and the averaging window are well within the blocks above
+	zassert_mem_equal(&block[2 * LOOKAHEAD], input,
+			  (BLOCK_FRAMES - LOOKAHEAD) * 2 * sizeof(int16_t), "Gain did not recover");
+}
+
+// A peak band at its centre frequency applies the requested gain, up to the largest
+ZTEST(dsp, test_eq_peak)
+{
+	static const int16_t gains[] = {-120, -30, 60, 120};
+
+	zassert_ok(audio_dsp_set_limiter(false, THRESHOLD, RELEASE_MS));
+
+	for (size_t g = 0; g < ARRAY_SIZE(gains); g++) {
+		struct audio_dsp_band band = {AUDIO_DSP_PEAK, 1000, gains[g], 100};
+		double amp = 4000;
+		double db;
+
+		zassert_ok(audio_dsp_init(RATE));
+		zassert_ok(audio_dsp_set_band(1, &band));
+
+		for (int b = 0; b <= SETTLE_BLOCKS; b++) {
+			sine(amp, band.freq, b * BLOCK_FRAMES);
+			process();
+		}
+
+		db = level_db(amp);
+		TC_PRINT("Peak of %d.%d dB measured %.3f dB\n", gains[g] / 10, abs(gains[g] % 10),
+			 db);
+		zassert_true(fabs(db - gains[g] / 10.0) < 0.01, "Peak of %d measured %.3f dB",
+			     gains[g], db);
+	}
+}
+
+// A high-pass removes DC and passes a tone well above its corner
+ZTEST(dsp, test_eq_highpass)
+{
+	struct audio_dsp_band band = {AUDIO_DSP_HIGHPASS, 50, 0, 71};
+	double amp = 8000;
+	int peak;
+	double db;
+
+	zassert_ok(audio_dsp_set_limiter(false, THRESHOLD, RELEASE_MS));
+	zassert_ok(audio_dsp_set_band(0, &band));
+
+	for (int b = 0; b <= SETTLE_BLOCKS; b++) {
+		for (size_t i = 0; i < ARRAY_SIZE(block); i++) {
+			block[i] = 12000;
+		}
+		peak = process();
+	}
+	zassert_true(peak <= 1, "DC left at %d", peak);
+
+	for (int b = 0; b <= SETTLE_BLOCKS; b++) {
+		sine(amp, 2000, b * BLOCK_FRAMES);
+		process();
+	}
+	db = level_db(amp);
+	zassert_true(fabs(db) < 0.01, "2 kHz passed at %.3f dB", db);
+}
+
+/*
+ * Bypassed bands in front of the last enabled one pass samples unchanged, as does
+ * a 0 dB peak. With every band off the limiter alone only delays quiet material.
+ */
+ZTEST(dsp, test_eq_bypass)
+{
+	static int16_t input[2 * BLOCK_FRAMES];
+	static int16_t tail[2 * LOOKAHEAD];
+	struct audio_dsp_band flat = {AUDIO_DSP_PEAK, 1000, 0, 100};
+	struct audio_dsp_band off = {AUDIO_DSP_OFF};
+
+	zassert_ok(audio_dsp_set_limiter(false, THRESHOLD, RELEASE_MS));
+	zassert_ok(audio_dsp_set_band(AUDIO_DSP_BANDS - 1, &flat));
+
+	for (int b = 0; b < 4; b++) {
+		for (size_t i = 0; i < ARRAY_SIZE(block); i++) {
+			block[i] = noise();
+		}
+		memcpy(input, block, sizeof(block));
+		process();
+		zassert_mem_equal(block, input, sizeof(block), "Block %d changed", b);
+	}
+
+	zassert_ok(audio_dsp_set_band(AUDIO_DSP_BANDS - 1, &off));
+	zassert_ok(audio_dsp_set_limiter(true, THRESHOLD, RELEASE_MS));
+
+	for (int b = 0; b < 4; b++) {
+		for (size_t i = 0; i < ARRAY_SIZE(block); i++) {
+			block[i] = noise() % limit;
+		}
+		memcpy(input, block, sizeof(block));
+		process();
+
+		// The first frames are the last ones of the previous block
+		if (b > 0) {
+			zassert_mem_equal(block, tail, sizeof(tail), "Block %d start changed", b);
+		}
+		zassert_mem_equal(&block[2 * LOOKAHEAD], input,
+				  (BLOCK_FRAMES - LOOKAHEAD) * 2 * sizeof(int16_t),
+				  "Block %d changed", b);
+		memcpy(tail, &input[2 * (BLOCK_FRAMES - LOOKAHEAD)], sizeof(tail));
+	}
+}
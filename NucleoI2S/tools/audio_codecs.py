@@ -0,0 +1,395 @@
+"""Encoders for the compressed formats the app decodes, used to build test files.
+
+IMA ADPCM is written as WAV (format tag 0x0011) in the standard block layout, and
+FLAC as a native stream. The FLAC encoder is not tuned for size: it rotates
+through the subframe types, residual coding options, block size codes and stereo
+modes so that a short file exercises every decoder path.
+
+ima_adpcm_decode() is an independent reference decoder, it produces the samples
+the app's decoder must match bit for bit.
+"""
+
+import struct
+
+IMA_STEP = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767,
+]
+IMA_INDEX = [-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8]
+
+
+def _clamp(v, lo, hi):
+    return max(lo, min(hi, v))
+
+
+def _ima_step(pred, index, nib):
+    step = IMA_STEP[index]
+    diff = step >> 3
+    if nib & 4:
+        diff += step
+    if nib & 2:
+        diff += step >> 1
+    if nib & 1:
+        diff += step >> 2
+    pred = pred - diff if nib & 8 else pred + diff
+    return _clamp(pred, -32768, 32767), _clamp(index + IMA_INDEX[nib], 0, 88)
+
+
+def _ima_encode_sample(pred, index, sample):
+    step = IMA_STEP[index]
+    delta = sample - pred
+    nib = 8 if delta < 0 else 0
+    delta = abs(delta)
+    for bit in (4, 2, 1):
+        if delta >= step:
+            nib |= bit
+            delta -= step
+        step >>= 1
+    pred, index = _ima_step(pred, index, nib)
+    return nib, pred, index
+
+
+def ima_adpcm_wav(channels, rate, frames, block_align):
+    """Encode frames, a list of per-channel sample tuples, as an IMA ADPCM WAV.
+
+    The last block is cut short after the whole 8-sample groups it needs, as
+    encoders do at the end of a stream, instead of being padded to block_align.
+    """
+    header = 4 * channels
+    spb = (block_align - header) * 2 // channels + 1
+    data = bytearray()
+    index = [0] * channels
+
+    for start in range(0, len(frames), spb):
+        block = frames[start:start + spb]
+        out = bytearray()
+        preds = []
+        for c in range(channels):
+            pred = block[0][c]
+            preds.append(pred)
+            out += struct.pack("<hBB", pred, index[c], 0)
+
+        groups = (len(block) - 1 + 7) // 8
+        for g in range(groups):
+            for c in range(channels):
+                nibs = []
+                for i in range(8):
+                    n = 1 + g * 8 + i
+                    sample = block[n][c] if n < len(block) else block[-1][c]
+                    nib, preds[c], index[c] = _ima_encode_sample(preds[c], index[c], sample)
+                    nibs.append(nib)
+                out += bytes(nibs[i] | (nibs[i + 1] << 4) for i in range(0, 8, 2))
+        data += out
+
+    fmt = struct.pack("<HHIIHHHH", 0x0011, channels, rate, rate * block_align // spb,
+                      block_align, 4, 2, spb)
+    fact = struct.pack("<I", len(frames))
+    body = (b"WAVE" + b"fmt " + struct.pack("<I", len(fmt)) + fmt + b"fact" +
+            struct.pack("<I", len(fact)) + fact + b"data" + struct.pack("<I", len(data)) +
+            bytes(data))
+    if len(data) & 1:
+        body += b"\0"
+    return b"RIFF" + struct.pack("<I", len(body)) + body
+
+
+def ima_adpcm_decode(wav):
+    """Decode an IMA ADPCM WAV written by ima_adpcm_wav, returns per-channel tuples."""
+    channels, block_align = struct.unpack_from("<H", wav, 22)[0], struct.unpack_from("<H", wav, 32)[0]
+    pos = 12
+    while wav[pos:pos + 4] != b"data":
+        pos += 8 + struct.unpack_from("<I", wav, pos + 4)[0]
+    size = struct.unpack_from("<I", wav, pos + 4)[0]
+    data = wav[pos + 8:pos + 8 + size]
+    header = 4 * channels
+    frames = []
+
+    for start in range(0, len(data), block_align):
+        block = data[start:start + block_align]
+        if len(block) < header:
+            break
+        groups = (len(block) - header) // header
+        chans = []
+        for c in range(channels):
+            pred, index = struct.unpack_from("<hB", block, 4 * c)
+            index = min(index, 88)
+            samples = [pred]
+            for g in range(groups):
+                word = block[header + g * header + 4 * c:header + g * header + 4 * c + 4]
+                for byte in word:
+                    for nib in (byte & 0x0F, byte >> 4):
+                        pred, index = _ima_step(pred, index, nib)
+                        samples.append(pred)
+            chans.append(samples)
+        frames += list(zip(*chans))
+    return frames
+
+
+class _BitWriter:
+    def __init__(self):
+        self.bits = []
+
+    def put(self, value, n):
+        for i in range(n - 1, -1, -1):
+            self.bits.append((value >> i) & 1)
+
+    def put_signed(self, value, n):
+        self.put(value & ((1 << n) - 1), n)
+
+    def unary(self, q):
+        self.bits.extend([0] * q)
+        self.bits.append(1)
+
+    def align(self):
+        while len(self.bits) % 8:
+            self.bits.append(0)
+
+    def data(self):
+        self.align()
+        return bytes(int("".join(map(str, self.bits[i:i + 8])), 2)
+                     for i in range(0, len(self.bits), 8))
+
+
+def _crc8(data):
+    crc = 0
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+def _crc16(data):
+    crc = 0
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x8005) & 0xFFFF if crc & 0x8000 else (crc << 1) & 0xFFFF
+    return crc
+
+
+def _utf8_number(n):
+    if n < 0x80:
+        return bytes([n])
+    out = []
+    limit = 0x3F
+    while n > limit:
+        out.insert(0, 0x80 | (n & 0x3F))
+        n >>= 6
+        limit >>= 1
+    lead = (0xFF << (7 - len(out))) & 0xFF
+    return bytes([lead | n] + out)
+
+
+def _residual(w, res, order, partition_order, wide_param, escape_partition):
+    n = len(res) + order
+    psize = n >> partition_order
+    parts = []
+    i = 0
+    for p in range(1 << partition_order):
+        count = psize - (order if p == 0 else 0)
+        parts.append(res[i:i + count])
+        i += count
+
+    # Rice parameters above 14 need the 5-bit parameter coding
+    ks = [min(max((sum(abs(r) for r in part) // max(len(part), 1)).bit_length() - 1, 0), 30)
+          for part in parts]
+    wide_param = wide_param or max(ks) > 14
+    param_bits = 5 if wide_param else 4
+    w.put(1 if wide_param else 0, 2)
+    w.put(partition_order, 4)
+
+    for p, (part, k) in enumerate(zip(parts, ks)):
+        if p == escape_partition:
+            nbits = max((abs(r) * 2 + 1).bit_length() for r in part) if part else 0
+            w.put((1 << param_bits) - 1, param_bits)
+            w.put(nbits, 5)
+            for r in part:
+                w.put_signed(r, nbits)
+            continue
+        w.put(k, param_bits)
+        for r in part:
+            u = (r << 1) ^ (r >> 63)
+            w.unary(u >> k)
+            w.put(u & ((1 << k) - 1), k)
+
+
+def _fixed_residual(x, order):
+    res = list(x)
+    for _ in range(order):
+        res = [res[0]] + [res[i] - res[i - 1] for i in range(1, len(res))]
+    return res[order:]
+
+
+def _lpc_coefs(x, order, precision):
+    n = len(x)
+    r = [sum(x[i] * x[i - lag] for i in range(lag, n)) for lag in range(order + 1)]
+    r[0] = r[0] * 1.0001 + 1
+    a = [0.0] * (order + 1)
+    err = r[0]
+    for i in range(1, order + 1):
+        if err <= 0:
+            break
+        k = (r[i] - sum(a[j] * r[i - j] for j in range(1, i))) / err
+        prev = a[:]
+        a[i] = k
+        for j in range(1, i):
+            a[j] = prev[j] - k * prev[i - j]
+        err *= 1 - k * k
+    coefs = a[1:]
+    peak = max(abs(c) for c in coefs) or 1.0
+    shift = max(0, min(15, precision - 1 - max(int(peak).bit_length(), 1)))
+    limit = (1 << (precision - 1)) - 1
+    return [_clamp(round(c * (1 << shift)), -limit - 1, limit) for c in coefs], shift
+
+
+def _subframe(w, x, bps, kind, frame_no):
+    wasted = 0
+    if kind not in ("constant", "verbatim") and any(x):
+        while all(v & ((1 << (wasted + 1)) - 1) == 0 for v in x):
+            wasted += 1
+    if wasted:
+        x = [v >> wasted for v in x]
+        bps -= wasted
+
+    if kind == "constant":
+        w.put(0, 1)
+        w.put(0, 6)
+        w.put(0, 1)
+        w.put_signed(x[0], bps)
+        return
+    if kind == "verbatim":
+        w.put(0, 1)
+        w.put(1, 6)
+        w.put(0, 1)
+        for v in x:
+            w.put_signed(v, bps)
+        return
+
+    n = len(x)
+    order = int(kind[5:] if kind.startswith("fixed") else kind[3:])
+    partition_order = frame_no % 3 if n % 4 == 0 else 0
+    while partition_order and n >> partition_order < order:
+        partition_order -= 1
+    wide_param = frame_no % 2 == 1
+    escape = 1 if partition_order and frame_no % 4 == 2 else -1
+
+    if kind.startswith("fixed"):
+        type_code = 8 + order
+        res = _fixed_residual(x, order)
+        header = None
+    else:
+        precision = 15 if bps > 16 else 12
+        coefs, shift = _lpc_coefs(x, order, precision)
+        type_code = 32 + order - 1
+        res = []
+        for i in range(order, n):
+            acc = sum(coefs[j] * x[i - 1 - j] for j in range(order))
+            res.append(x[i] - (acc >> shift))
+        header = (precision, shift, coefs)
+
+    w.put(0, 1)
+    w.put(type_code, 6)
+    if wasted:
+        w.put(1, 1)
+        w.unary(wasted - 1)
+    else:
+        w.put(0, 1)
+    for v in x[:order]:
+        w.put_signed(v, bps)
+    if header:
+        precision, shift, coefs = header
+        w.put(precision - 1, 4)
+        w.put_signed(shift, 5)
+        for c in coefs:
+            w.put_signed(c, precision)
+    _residual(w, res, order, partition_order, wide_param, escape)
+
+
+# Block sizes with the header code that carries them: 1, 2-5 and 8-15 are implied,
+# 6 and 7 add an 8 or 16-bit size after the frame number
+_BLOCK_CODES = {192: 1, 576: 2, 1152: 3, 2304: 4, 4608: 5, 256: 8, 512: 9, 1024: 10, 2048: 11,
+                4096: 12}
+
+_KINDS = ["fixed2", "lpc8", "fixed0", "lpc4", "fixed1", "verbatim", "fixed3", "fixed4",
+          "lpc12", "constant"]
+
+
+def flac_stream(channels, rate, bps, frames, block_sizes, kinds=None):
+    """Encode frames, a list of per-channel sample tuples, as a native FLAC stream.
+
+    block_sizes lists the frame lengths in order, the last one repeats. Stereo
+    frames cycle through independent, left/side, side/right and mid/side coding,
+    subframes through kinds, by default every subframe type.
+    """
+    kinds = kinds or _KINDS
+    info = struct.pack(">HH", max(block_sizes), max(block_sizes)) + b"\0" * 6
+    info += struct.pack(">Q", (rate << 44) | ((channels - 1) << 41) | ((bps - 1) << 36) |
+                        len(frames))
+    info += b"\0" * 16
+    out = bytearray(b"fLaC" + bytes([0x80]) + struct.pack(">I", len(info))[1:] + info)
+
+    pos = 0
+    frame_no = 0
+    while pos < len(frames):
+        size = block_sizes[min(frame_no, len(block_sizes) - 1)]
+        block = frames[pos:pos + size]
+        size = len(block)
+        chans = [[f[c] for f in block] for c in range(channels)]
+
+        if channels == 2:
+            assign = [1, 8, 9, 10][frame_no % 4]
+            left, right = chans
+            if assign == 8:
+                chans = [left, [a - b for a, b in zip(left, right)]]
+            elif assign == 9:
+                chans = [[a - b for a, b in zip(left, right)], right]
+            elif assign == 10:
+                chans = [[(a + b) >> 1 for a, b in zip(left, right)],
+                         [a - b for a, b in zip(left, right)]]
+        else:
+            assign = channels - 1
+
+        w = _BitWriter()
+        code = _BLOCK_CODES.get(size, 6 if size <= 256 else 7)
+        rate_code = 13 if frame_no == 1 else 0  # one frame states its rate in Hz
+        size_code = {8: 1, 12: 2, 16: 4, 20: 5, 24: 6}[bps] if frame_no % 2 else 0
+        w.put(0xFFF9, 16)  # variable block size, headers carry the sample number
+        w.put(code, 4)
+        w.put(rate_code, 4)
+        w.put(assign, 4)
+        w.put(size_code, 3)
+        w.put(0, 1)
+        hdr = w.data() + _utf8_number(pos)
+        if code == 6:
+            hdr += bytes([size - 1])
+        elif code == 7:
+            hdr += struct.pack(">H", size - 1)
+        if rate_code == 13:
+            hdr += struct.pack(">H", rate)
+        hdr += bytes([_crc8(hdr)])
+
+        w = _BitWriter()
+        for c, x in enumerate(chans):
+            side = (assign == 9 and c == 0) or (assign in (8, 10) and c == 1)
+            kind = kinds[(frame_no * channels + c) % len(kinds)]
+            if kind.startswith("lpc") and int(kind[3:]) >= size:
+                kind = "fixed2"
+            if kind.startswith("fixed") and int(kind[5:]) >= size:
+                kind = "verbatim"
+            if kind == "constant" and len(set(x)) > 1:
+                kind = "fixed1"
+            if all(v == x[0] for v in x):
+                kind = "constant"
+            _subframe(w, x, bps + side, kind, frame_no)
+        body = hdr + w.data()
+        out += body + struct.pack(">H", _crc16(body))
+
+        pos += size
+        frame_no += 1
+
+    return bytes(out)
@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""Write the encoded test files and their expected decoder output.
+
+Each fixture in tests/decode/fixtures comes with a .raw file holding the 16-bit
+interleaved samples the app's decoder must produce: the IMA ADPCM reference
+decode, or the source samples of the lossless FLAC files scaled to 16 bits as the
+decoder does. The files are committed, run this again after changing the
+encoders:
+
+    python3 NucleoI2S/tools/mkfixtures.py
+"""
+
+import math
+import os
+import random
+import struct
+import sys
+
+from audio_codecs import flac_stream, ima_adpcm_decode, ima_adpcm_wav
+
+FIXTURES = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "tests", "decode",
+                        "fixtures")
+
+
+def test_signal(rate, channels, bits, frames, seed):
+    """Tones and noise near full scale, with a silent stretch, a stretch with the low
+    bits clear, identical channels for a while and a few clipped peaks."""
+    rng = random.Random(seed)
+    full_scale = (1 << (bits - 1)) - 1
+    out = []
+
+    for n in range(frames):
+        t = n / rate
+        frame = []
+        for ch in range(channels):
+            f = 440.0 * (1.5 if ch else 1.0)
+            v = 0.45 * math.sin(2 * math.pi * f * t) + 0.3 * math.sin(2 * math.pi * 3100.0 * t)
+            v += rng.uniform(-0.05, 0.05)
+            frame.append(int(round(v * full_scale)))
+        out.append(frame)
+
+    # Each stretch is a fifth of the file, long enough to hold whole FLAC frames
+    part = frames // 5
+    for n in range(part, 2 * part):
+        out[n] = [0] * channels
+    for n in range(2 * part, 3 * part):
+        out[n] = [v & ~7 for v in out[n]]
+    for n in range(3 * part, 4 * part):
+        out[n] = [out[n][0]] * channels
+    for n in range(4 * part, frames, frames // 7):
+        out[n] = [full_scale if n & 1 else -full_scale - 1] * channels
+    return [tuple(f) for f in out]
+
+
+def to_s16(frames, bits):
+    """The decoder's 16-bit output: round to nearest from wider samples, shift up
+    narrower ones."""
+    shift = bits - 16
+    out = bytearray()
+    for frame in frames:
+        for v in frame:
+            if shift > 0:
+                v = min((v + (1 << (shift - 1))) >> shift, 32767)
+            else:
+                v <<= -shift
+            out += struct.pack("<h", v)
+    return bytes(out)
+
+
+def write(name, data, raw):
+    with open(os.path.join(FIXTURES, name), "wb") as f:
+        f.write(data)
+    with open(os.path.join(FIXTURES, os.path.splitext(name)[0] + ".raw"), "wb") as f:
+        f.write(raw)
+    print(f"{name}: {len(data)} bytes, {len(raw)} bytes decoded")
+
+
+def main():
+    os.makedirs(FIXTURES, exist_ok=True)
+
+    # Two whole blocks and a short one, 3 frames of padding in its last word group
+    frames = test_signal(44100, 2, 16, 3000, 1)
+    wav = ima_adpcm_wav(2, 44100, frames, 1024)
+    write("adpcm_s16.wav", wav, to_s16(ima_adpcm_decode(wav), 16))
+
+    frames = test_signal(22050, 1, 16, 1234, 2)
+    wav = ima_adpcm_wav(1, 22050, frames, 256)
+    write("adpcm_m16.wav", wav, to_s16(ima_adpcm_decode(wav), 16))
+
+    # Every block size code, odd sizes in 8 and 16 bits and a short last frame
+    frames = test_signal(44100, 2, 16, 6000, 3)
+    blocks = [192, 576, 100, 1152, 256, 300, 512, 600, 1024, 2048, 16]
+    write("flac_s16.flac", flac_stream(2, 44100, 16, frames, blocks), to_s16(frames, 16))
+
+    frames = test_signal(48000, 2, 24, 2500, 4)
+    blocks = [500, 500, 256, 244, 500, 4608]
+    write("flac_s24.flac", flac_stream(2, 48000, 24, frames, blocks), to_s16(frames, 24))
+
+    frames = test_signal(22050, 1, 8, 1000, 5)
+    blocks = [200, 200, 200, 16]
+    write("flac_m8.flac", flac_stream(1, 22050, 8, frames, blocks), to_s16(frames, 8))
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+"""Build the simulated flash image for the native_sim target.
+
+The image holds the stock native_sim partitions followed by a FAT formatted
+card with a set of test WAV files, laid out as in boards/native_sim.overlay.
+Run the app with it attached:
+
+    west build -b native_sim NucleoI2S
+    python3 NucleoI2S/tools/mksdimage.py sd.bin
+    build/zephyr/zephyr.exe --flash=sd.bin
+
+Extra WAV files given with --add are copied onto the card as well. Needs
+mtools (mformat, mcopy) on the host.
+"""
+
+import argparse
+import math
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+import wave
+
+from audio_codecs import flac_stream, ima_adpcm_wav
+
+MIB = 1024 * 1024
+
+# Must match &flash0 and sdcard_partition in boards/native_sim.overlay
+FLASH_SIZE = 34 * MIB
+CARD_OFFSET = 2 * MIB
+CARD_SIZE = 32 * MIB
+ERASE_VALUE = b"\xff"
+
+# name, sample rate, channels, bytes per sample
+TEST_FILES = [
+    ("s16_441.wav", 44100, 2, 2),  # output format, converter and resampler bypassed
+    ("s16_48k.wav", 48000, 2, 2),  # 160/147 resampling
+    ("s24_96k.wav", 96000, 2, 3),  # 24-bit narrowing and 147/320 resampling
+    ("m16_22k.wav", 22050, 1, 2),  # mono upmix and 2x interpolation
+]
+
+# name, sample rate, channels, bits per sample, codec
+ENCODED_FILES = [
+    ("a16_441.wav", 44100, 2, 16, "adpcm"),  # IMA ADPCM, 1024 byte blocks
+    ("f16_441.flac", 44100, 2, 16, "flac"),
+    ("f24_48k.flac", 48000, 2, 24, "flac"),  # rounded to 16 bits, then resampled
+]
+
+
+def test_frames(rate, channels, bits, seconds):
+    """Two tones at -6 dBFS each, the right channel a fifth above the left."""
+    full_scale = (1 << (bits - 1)) - 1
+    frames = []
+
+    for n in range(rate * seconds):
+        t = n / rate
+        frame = []
+        for ch in range(channels):
+            f = 440.0 * (1.5 if ch else 1.0)
+            v = 0.5 * math.sin(2 * math.pi * f * t) + 0.5 * math.sin(2 * math.pi * 1000.0 * t)
+            frame.append(int(round(v * 0.999 * full_scale)))
+        frames.append(tuple(frame))
+    return frames
+
+
+def write_test_wav(path, rate, channels, width, seconds):
+    frames = bytearray()
+    for frame in test_frames(rate, channels, 8 * width, seconds):
+        for sample in frame:
+            frames += struct.pack("<i", sample)[:width]
+
+    with wave.open(path, "wb") as w:
+        w.setnchannels(channels)
+        w.setsampwidth(width)
+        w.setframerate(rate)
+        w.writeframes(bytes(frames))
+
+
+def write_encoded(path, rate, channels, bits, codec, seconds):
+    frames = test_frames(rate, channels, bits, seconds)
+    if codec == "adpcm":
+        data = ima_adpcm_wav(channels, rate, frames, 1024)
+    else:
+        data = flac_stream(channels, rate, bits, frames, [4096], ["lpc8"])
+
+    with open(path, "wb") as f:
+        f.write(data)
+
+
+def build_card(path, files):
+    sectors = CARD_SIZE // 512
+    with open(path, "wb") as f:
+        f.truncate(CARD_SIZE)
+
+    subprocess.run(["mformat", "-i", path, "-T", str(sectors), "-h", "64", "-s", "32",
+                    "-H", "0", "-v", "SIMCARD", "::"], check=True)
+    for name in files:
+        subprocess.run(["mcopy", "-i", path, name, "::/"], check=True)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("output", help="flash image to write")
+    parser.add_argument("--seconds", type=int, default=10, help="length of each test file")
+    parser.add_argument("--add", nargs="*", default=[], help="more WAV files to copy")
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as tmp:
+        files = []
+        for name, rate, channels, width in TEST_FILES:
+            path = os.path.join(tmp, name)
+            write_test_wav(path, rate, channels, width, args.seconds)
+            files.append(path)
+        for name, rate, channels, bits, codec in ENCODED_FILES:
+            path = os.path.join(tmp, name)
+            write_encoded(path, rate, channels, bits, codec, args.seconds)
+            files.append(path)
+
+        card = os.path.join(tmp, "card.img")
+        build_card(card, files + args.add)
+
+        with open(card, "rb") as f:
+            card_data = f.read()
+
+    with open(args.output, "wb") as f:
+        f.write(ERASE_VALUE * CARD_OFFSET)
+        f.write(card_data)
+        f.write(ERASE_VALUE * (FLASH_SIZE - CARD_OFFSET - CARD_SIZE))
+
+    print(f"{args.output}: {len(files) + len(args.add)} files on a "
+          f"{CARD_SIZE // MIB} MiB card at offset {CARD_OFFSET:#x}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())